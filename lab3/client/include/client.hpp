@@ -2,24 +2,83 @@
 
 #include <string>
 #include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <span>
+#include <unordered_map>
+#include <vector>
 #include "TCPClient.hpp"
+#include "compression.hpp"
 #include "logger.hpp"
 
 namespace client {
 
+constexpr size_t UPLOAD_CHUNK_SIZE = 64 * 1024;
+// How long the server may hold a FETCH for a job that has not finished yet.
+constexpr uint32_t FETCH_WAIT_MS = 60 * 1000;
+
 class ClientApp {
 public:
 	ClientApp(const std::string& host, uint16_t port, Logger& logger);
 
-	void compile(const std::string& path);
+	// Uploads all files back to back over one connection and saves each result as it arrives. A higher priority
+	// moves these jobs ahead of this client's other waiting ones.
+	void compile(const std::vector<std::string>& paths, uint8_t priority = 0);
+
+	// Hands the files to the server as jobs without waiting for them to build; collect() fetches the results later,
+	// also over a new connection.
+	void submit(const std::vector<std::string>& paths, uint8_t priority = 0);
+	void collect();
+
+	// Sends the files as one BATCH request (several above MAX_BATCH_FILES); the server builds them in parallel and
+	// each result is saved as it arrives.
+	void compile_batch(const std::vector<std::string>& paths, uint8_t priority = 0);
 
 	void play();
 
 private:
+	// A compile whose result has not fully arrived yet. A compressed result is decompressed as its frames come in.
+	struct PendingCompile {
+		std::filesystem::path path;
+		std::unique_ptr<Inflater> inflater;
+		std::vector<uint8_t> result;
+		// Submitted job the result is fetched for, 0 for a plain compile.
+		uint64_t job = 0;
+	};
+	using PendingCompiles = std::unordered_map<uint32_t, PendingCompile>;
+
+	// A BATCH whose files have not all been answered; files are in manifest order.
+	struct PendingBatch {
+		uint32_t request_id = 0;
+		std::vector<PendingCompile> files;
+		size_t left = 0;
+	};
+
 	std::string host_;
 	uint16_t    port_;
 	Logger&     logger_;
-	TCPClient make_connection();
+	std::unique_ptr<TCPClient> conn_;
+	// The server agreed on HELLO to deflated transfers over conn_.
+	bool compress_;
+	// Submitted jobs whose results have not been fetched yet.
+	std::unordered_map<uint64_t, std::filesystem::path> submitted_;
+
+	// The connection is opened on first use and kept for later requests; it is reopened after a failure.
+	TCPClient& connection();
+	void negotiate(TCPClient& conn);
+	void drop_connection();
+	void send_files(Opcode opcode, const std::vector<std::string>& paths, uint8_t priority);
+	void upload(TCPClient& conn, Opcode opcode, const std::filesystem::path& path, uint8_t priority,
+	            PendingCompiles& pending);
+	void collect_result(const FrameView& result, PendingCompiles& pending);
+	// Adds a reply frame to job's result; false while more frames of it are due. Only compressed results span
+	// frames and are kept in job.result, a plain one is the frame's payload.
+	bool assemble(PendingCompile& job, const FrameHeader& header, std::span<const uint8_t> payload);
+	void send_batch(TCPClient& conn, std::span<const std::filesystem::path> files, uint8_t priority);
+	void collect_batch_result(const FrameView& result, PendingBatch& batch);
+	static std::vector<uint8_t> deflate_all(std::span<const uint8_t> data);
+	void save_result(const std::filesystem::path& original_path, Status status, std::span<const uint8_t> result_data);
+	void play_game(TCPClient& conn);
 };
 
 } 
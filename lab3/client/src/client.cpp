@@ -1,56 +1,428 @@
 #include "client.hpp"
 
+#include <algorithm>
 #include <cstring>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <iterator>
+#include <stdexcept>
 #include <vector>
 
+#include "custom_exceptions.hpp"
+
 namespace client {
 
 ClientApp::ClientApp(const std::string& host, uint16_t port, Logger& logger)
-    : host_(host), port_(port), logger_(logger) {}
+    : host_(host), port_(port), logger_(logger), compress_(false) {}
 
-TCPClient ClientApp::make_connection() {
-	TCPClient conn(host_, port_, logger_);
-	conn.connect();
-	return conn;
+TCPClient& ClientApp::connection() {
+	if (!conn_ || !conn_->is_connected()) {
+		auto conn = std::make_unique<TCPClient>(host_, port_, logger_);
+		conn->connect();
+		negotiate(*conn);
+		conn_ = std::move(conn);
+	}
+	return *conn_;
 }
 
-void ClientApp::compile(const std::string& path_str) {
-	namespace fs = std::filesystem;
+void ClientApp::negotiate(TCPClient& conn) {
+	FrameHeader hello;
+	hello.opcode = Opcode::HELLO;
+	hello.request_id = conn.next_request_id();
+	uint8_t encodings = ENCODING_DEFLATE;
+	conn.send(hello, {&encodings, 1});
+	auto reply = conn.receive();
+	compress_ = reply.header.status == Status::OK && reply.payload.size() == 1 &&
+	            (reply.payload[0] & ENCODING_DEFLATE);
+	logger_.info(std::string("Compressed transfers ") + (compress_ ? "enabled" : "not supported by the server"));
+}
 
-	fs::path original_path(path_str);
+void ClientApp::drop_connection() {
+	if (conn_) {
+		conn_->close();
+		conn_.reset();
+	}
+}
+
+void ClientApp::compile(const std::vector<std::string>& paths, uint8_t priority) {
+	send_files(Opcode::COMPILE, paths, priority);
+}
 
-	if (!fs::exists(original_path) || !fs::is_regular_file(original_path)) {
-		logger_.error("File does not exist or is not a regular file: " + path_str);
-		std::cerr << "Error: File does not exist or is not a regular file: " << path_str << std::endl;
+void ClientApp::submit(const std::vector<std::string>& paths, uint8_t priority) {
+	send_files(Opcode::SUBMIT, paths, priority);
+}
+
+void ClientApp::collect() {
+	if (submitted_.empty()) {
+		std::cout << "No submitted jobs to collect." << std::endl;
 		return;
 	}
+	PendingCompiles pending;
+	try {
+		auto& conn = connection();
+		for (const auto& [job, path] : submitted_) {
+			FrameHeader request;
+			request.opcode = Opcode::FETCH;
+			request.request_id = conn.next_request_id();
+			std::vector<uint8_t> payload(sizeof(uint64_t) + sizeof(uint32_t));
+			put_be64(payload.data(), job);
+			put_be32(payload.data() + sizeof(uint64_t), FETCH_WAIT_MS);
+			conn.send(request, payload);
+			pending.emplace(request.request_id, PendingCompile{path, nullptr, {}, job});
+		}
+		while (!pending.empty()) {
+			collect_result(conn.receive(), pending);
+		}
+	} catch (const std::exception& ex) {
+		logger_.error("Collecting results failed: " + std::string(ex.what()));
+		std::cerr << "Error: " << ex.what() << std::endl;
+		drop_connection();
+	}
+}
 
-	auto conn = make_connection();
-
-	conn.send(std::vector<uint8_t>{'C', 'O', 'M', 'P', 'I', 'L', 'E'});
+void ClientApp::send_files(Opcode opcode, const std::vector<std::string>& paths, uint8_t priority) {
+	namespace fs = std::filesystem;
 
-	std::string filename_only = original_path.filename().string();
-	conn.send(std::vector<uint8_t>(filename_only.begin(), filename_only.end()));
+	PendingCompiles pending;
+	try {
+		auto& conn = connection();
+		for (const auto& path_str : paths) {
+			fs::path original_path(path_str);
+			if (!fs::exists(original_path) || !fs::is_regular_file(original_path)) {
+				logger_.error("File does not exist or is not a regular file: " + path_str);
+				std::cerr << "Error: File does not exist or is not a regular file: " << path_str << std::endl;
+				continue;
+			}
+			upload(conn, opcode, original_path, priority, pending);
+		}
+		while (!pending.empty()) {
+			collect_result(conn.receive(), pending);
+		}
+	} catch (const std::exception& ex) {
+		logger_.error("Compile request failed: " + std::string(ex.what()));
+		std::cerr << "Error: " << ex.what() << std::endl;
+		drop_connection();
+	}
+}
 
+void ClientApp::upload(TCPClient& conn, Opcode opcode, const std::filesystem::path& original_path, uint8_t priority,
+                       PendingCompiles& pending) {
 	std::ifstream ifs(original_path, std::ios::binary);
 	if (!ifs) {
-		logger_.error("Failed to open file: " + path_str);
-		std::cerr << "Error: Failed to open file: " << path_str << std::endl;
+		logger_.error("Failed to open file: " + original_path.string());
+		std::cerr << "Error: Failed to open file: " << original_path.string() << std::endl;
+		return;
+	}
+
+	std::string filename_only = original_path.filename().string();
+	if (filename_only.size() > UINT16_MAX) {
+		logger_.error("File name too long: " + filename_only);
+		std::cerr << "Error: File name too long: " << filename_only << std::endl;
+		return;
+	}
+
+	// The first frame carries the name and the first chunk, so small files go out in a single write; larger ones
+	// continue in COMPILE_DATA frames that the server copies straight into the compiler's buffer.
+	FrameHeader request;
+	request.opcode = opcode;
+	request.request_id = conn.next_request_id();
+	pending.emplace(request.request_id, PendingCompile{original_path, nullptr, {}});
+	size_t priority_len = priority > 0 ? 1 : 0;
+	size_t prefix = priority_len + sizeof(uint16_t) + filename_only.size();
+	std::vector<uint8_t> chunk(prefix + UPLOAD_CHUNK_SIZE);
+	chunk[0] = priority;
+	put_be16(chunk.data() + priority_len, static_cast<uint16_t>(filename_only.size()));
+	std::memcpy(chunk.data() + priority_len + sizeof(uint16_t), filename_only.data(), filename_only.size());
+	uint8_t first_flags = priority_len ? FLAG_PRIORITY : 0;
+	uint8_t stream_flags = compress_ ? FLAG_COMPRESSED : 0;
+
+	// Compressed uploads deflate the file a chunk at a time and send a frame whenever one is full.
+	std::unique_ptr<Deflater> deflater;
+	std::vector<uint8_t> input;
+	size_t input_pos = 0;
+	bool input_done = false;
+	if (compress_) {
+		deflater = std::make_unique<Deflater>();
+		input.reserve(UPLOAD_CHUNK_SIZE);
+	}
+	auto fill = [&](std::span<uint8_t> out, bool& more) -> size_t {
+		if (!deflater) {
+			ifs.read(reinterpret_cast<char*>(out.data()), static_cast<std::streamsize>(out.size()));
+			more = ifs && ifs.peek() != std::char_traits<char>::eof();
+			return static_cast<size_t>(ifs.gcount());
+		}
+		size_t produced = 0;
+		while (produced < out.size() && !deflater->done()) {
+			if (input_pos == input.size() && !input_done) {
+				input.resize(UPLOAD_CHUNK_SIZE);
+				ifs.read(reinterpret_cast<char*>(input.data()), static_cast<std::streamsize>(input.size()));
+				input.resize(static_cast<size_t>(ifs.gcount()));
+				input_pos = 0;
+				input_done = !ifs || ifs.peek() == std::char_traits<char>::eof();
+			}
+			CodecStep step =
+			    deflater->deflate(std::span(input).subspan(input_pos), out.subspan(produced), input_done);
+			input_pos += step.consumed;
+			produced += step.produced;
+		}
+		more = !deflater->done();
+		return produced;
+	};
+
+	size_t uploaded = 0;
+	while (true) {
+		bool more;
+		size_t got = fill({chunk.data() + prefix, UPLOAD_CHUNK_SIZE}, more);
+		request.flags = (more ? FLAG_MORE : 0) | first_flags | stream_flags;
+		conn.send(request, {chunk.data(), prefix + got});
+		uploaded += got;
+		// Results of earlier uploads are picked up between chunks so neither side stalls on a full socket buffer.
+		while (conn.wait_readable(0)) {
+			collect_result(conn.receive(), pending);
+		}
+		if (!more) {
+			break;
+		}
+		request.opcode = Opcode::COMPILE_DATA;
+		prefix = 0;
+		first_flags = 0;
+	}
+	logger_.debug("Uploaded " + std::to_string(uploaded) + (compress_ ? " compressed" : "") + " bytes of " +
+	              filename_only + " as request " + std::to_string(request.request_id));
+}
+
+void ClientApp::collect_result(const FrameView& result, PendingCompiles& pending) {
+	auto it = pending.find(result.header.request_id);
+	if (it == pending.end()) {
+		logger_.warning("Response for unknown request " + std::to_string(result.header.request_id) + ": " +
+		                status_name(result.header.status));
+		return;
+	}
+	PendingCompile& job = it->second;
+	if (result.header.opcode == Opcode::SUBMIT) {
+		std::string filename_only = job.path.filename().string();
+		if (result.header.status == Status::OK && result.payload.size() == sizeof(uint64_t)) {
+			uint64_t id = get_be64(result.payload.data());
+			submitted_[id] = job.path;
+			std::cout << "Submitted " << filename_only << " as job " << id << "\n";
+			logger_.info("Submitted " + filename_only + " as job " + std::to_string(id));
+		} else {
+			std::cerr << "Server error: " << status_name(result.header.status) << "\n";
+			logger_.error("Server answered " + std::string(status_name(result.header.status)) + " to the submission of " +
+			              filename_only);
+		}
+		pending.erase(it);
+		return;
+	}
+	if (result.header.status == Status::JOB_PENDING || result.header.status == Status::JOB_NOT_FOUND) {
+		std::string filename_only = job.path.filename().string();
+		if (result.header.status == Status::JOB_PENDING) {
+			std::cout << "Job for " << filename_only << " is still running, collect it later\n";
+		} else {
+			std::cerr << "Job for " << filename_only << " is gone from the server (expired?)\n";
+			logger_.warning("Job " + std::to_string(job.job) + " for " + filename_only + " not found on the server");
+			submitted_.erase(job.job);
+		}
+		pending.erase(it);
+		return;
+	}
+	if (!assemble(job, result.header, result.payload)) {
+		return;
+	}
+
+	PendingCompile done = std::move(job);
+	pending.erase(it);
+	submitted_.erase(done.job);
+	if (done.inflater) {
+		save_result(done.path, result.header.status, done.result);
+	} else {
+		save_result(done.path, result.header.status, result.payload);
+	}
+}
+
+bool ClientApp::assemble(PendingCompile& job, const FrameHeader& header, std::span<const uint8_t> payload) {
+	if (!(header.flags & FLAG_COMPRESSED)) {
+		return true;
+	}
+	if (!job.inflater) {
+		job.inflater = std::make_unique<Inflater>();
+	}
+	size_t size = job.result.size();
+	while (!job.inflater->done()) {
+		if (size == job.result.size()) {
+			job.result.resize(std::max<size_t>(job.result.size() * 2, UPLOAD_CHUNK_SIZE));
+		}
+		std::span<uint8_t> out = std::span(job.result).subspan(size);
+		CodecStep step = job.inflater->inflate(payload, out);
+		payload = payload.subspan(step.consumed);
+		size += step.produced;
+		if (payload.empty() && step.produced < out.size()) {
+			break;
+		}
+	}
+	job.result.resize(size);
+	if (header.flags & FLAG_MORE) {
+		return false;
+	}
+	if (!job.inflater->done()) {
+		throw CompressionException("Compressed result for " + job.path.filename().string() + " is truncated");
+	}
+	return true;
+}
+
+void ClientApp::compile_batch(const std::vector<std::string>& paths, uint8_t priority) {
+	namespace fs = std::filesystem;
+
+	std::vector<fs::path> files;
+	for (const auto& path_str : paths) {
+		fs::path original_path(path_str);
+		if (!fs::exists(original_path) || !fs::is_regular_file(original_path)) {
+			logger_.error("File does not exist or is not a regular file: " + path_str);
+			std::cerr << "Error: File does not exist or is not a regular file: " << path_str << std::endl;
+			continue;
+		}
+		if (original_path.filename().string().size() > UINT16_MAX) {
+			logger_.error("File name too long: " + path_str);
+			std::cerr << "Error: File name too long: " << path_str << std::endl;
+			continue;
+		}
+		files.push_back(original_path);
+	}
+	try {
+		auto& conn = connection();
+		for (size_t first = 0; first < files.size(); first += MAX_BATCH_FILES) {
+			size_t count = std::min(MAX_BATCH_FILES, files.size() - first);
+			send_batch(conn, std::span(files).subspan(first, count), priority);
+		}
+	} catch (const std::exception& ex) {
+		logger_.error("Batch compile failed: " + std::string(ex.what()));
+		std::cerr << "Error: " << ex.what() << std::endl;
+		drop_connection();
+	}
+}
+
+void ClientApp::send_batch(TCPClient& conn, std::span<const std::filesystem::path> files, uint8_t priority) {
+	PendingBatch batch;
+	batch.request_id = conn.next_request_id();
+	batch.left = files.size();
+
+	// The manifest goes out in the first frame, so every file is read (and deflated) up front.
+	std::vector<uint8_t> body;
+	std::vector<uint8_t> manifest(priority > 0 ? 1 : 0);
+	if (priority > 0) {
+		manifest[0] = priority;
+	}
+	manifest.resize(manifest.size() + sizeof(uint16_t));
+	put_be16(manifest.data() + manifest.size() - sizeof(uint16_t), static_cast<uint16_t>(files.size()));
+	for (const auto& path : files) {
+		std::ifstream ifs(path, std::ios::binary);
+		if (!ifs) {
+			throw std::runtime_error("Failed to open file: " + path.string());
+		}
+		std::vector<uint8_t> data((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+		if (compress_) {
+			data = deflate_all(data);
+		}
+		std::string name = path.filename().string();
+		size_t at = manifest.size();
+		manifest.resize(at + sizeof(uint16_t) + name.size() + sizeof(uint32_t));
+		put_be16(manifest.data() + at, static_cast<uint16_t>(name.size()));
+		std::memcpy(manifest.data() + at + sizeof(uint16_t), name.data(), name.size());
+		put_be32(manifest.data() + at + sizeof(uint16_t) + name.size(), static_cast<uint32_t>(data.size()));
+		body.insert(body.end(), data.begin(), data.end());
+		batch.files.push_back(PendingCompile{path, nullptr, {}});
+	}
+
+	FrameHeader request;
+	request.opcode = Opcode::BATCH;
+	request.request_id = batch.request_id;
+	uint8_t first_flags = priority > 0 ? FLAG_PRIORITY : 0;
+	uint8_t stream_flags = compress_ ? FLAG_COMPRESSED : 0;
+	std::span<const uint8_t> rest(body);
+	std::vector<uint8_t> chunk = std::move(manifest);
+	while (true) {
+		size_t take = std::min(rest.size(), UPLOAD_CHUNK_SIZE);
+		chunk.insert(chunk.end(), rest.begin(), rest.begin() + static_cast<std::ptrdiff_t>(take));
+		rest = rest.subspan(take);
+		request.flags = (rest.empty() ? 0 : FLAG_MORE) | first_flags | stream_flags;
+		conn.send(request, chunk);
+		while (conn.wait_readable(0)) {
+			collect_batch_result(conn.receive(), batch);
+		}
+		if (rest.empty()) {
+			break;
+		}
+		request.opcode = Opcode::COMPILE_DATA;
+		first_flags = 0;
+		chunk.clear();
+	}
+	logger_.debug("Uploaded a batch of " + std::to_string(files.size()) + " files (" + std::to_string(body.size()) +
+	              (compress_ ? " compressed" : "") + " bytes) as request " + std::to_string(batch.request_id));
+	while (batch.left > 0) {
+		collect_batch_result(conn.receive(), batch);
+	}
+}
+
+void ClientApp::collect_batch_result(const FrameView& result, PendingBatch& batch) {
+	if (result.header.request_id != batch.request_id) {
+		logger_.warning("Response for unknown request " + std::to_string(result.header.request_id) + ": " +
+		                status_name(result.header.status));
+		return;
+	}
+	if (result.payload.size() < sizeof(uint16_t)) {
+		std::cerr << "Server rejected the batch: " << status_name(result.header.status) << "\n";
+		logger_.error("Server answered " + std::string(status_name(result.header.status)) + " to batch request " +
+		              std::to_string(batch.request_id));
+		batch.left = 0;
+		return;
+	}
+	size_t index = get_be16(result.payload.data());
+	if (index >= batch.files.size()) {
+		throw TransmissionException("Batch reply for file " + std::to_string(index) + " of " +
+		                            std::to_string(batch.files.size()));
+	}
+	PendingCompile& job = batch.files[index];
+	std::span<const uint8_t> payload = result.payload.subspan(sizeof(uint16_t));
+	if (!assemble(job, result.header, payload)) {
 		return;
 	}
-	std::vector<uint8_t> buf((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
-	ifs.close();
-	conn.send(buf);
+	save_result(job.path, result.header.status, job.inflater ? std::span<const uint8_t>(job.result) : payload);
+	job.result = {};
+	--batch.left;
+}
+
+std::vector<uint8_t> ClientApp::deflate_all(std::span<const uint8_t> data) {
+	Deflater deflater;
+	std::vector<uint8_t> out(std::max<size_t>(data.size() / 2, UPLOAD_CHUNK_SIZE));
+	size_t size = 0;
+	while (!deflater.done()) {
+		if (size == out.size()) {
+			out.resize(out.size() * 2);
+		}
+		CodecStep step = deflater.deflate(data, std::span(out).subspan(size), true);
+		data = data.subspan(step.consumed);
+		size += step.produced;
+	}
+	out.resize(size);
+	return out;
+}
 
-	auto result_data = conn.receive();
-	std::string maybe_err_str(result_data.begin(), result_data.end());
+void ClientApp::save_result(const std::filesystem::path& original_path, Status status,
+                            std::span<const uint8_t> result_data) {
+	std::string filename_only = original_path.filename().string();
 
-	if (maybe_err_str == "COMPILATION_FAILED") {
+	if (status == Status::COMPILATION_FAILED) {
 		std::cerr << "Server: compilation failed for " << filename_only << "\n";
+		if (!result_data.empty()) {
+			std::cerr.write(reinterpret_cast<const char*>(result_data.data()),
+			                static_cast<std::streamsize>(result_data.size()));
+			std::cerr << "\n";
+		}
 		logger_.error("Server reported compilation failure for " + filename_only);
+	} else if (status != Status::OK) {
+		std::cerr << "Server error: " << status_name(status) << "\n";
+		logger_.error("Server answered " + std::string(status_name(status)) + " for " + filename_only);
 	} else {
 		std::string output_filename_stem = "out_" + original_path.stem().string();
 		std::string output_full_filename;
@@ -77,14 +449,21 @@ void ClientApp::compile(const std::string& path_str) {
 			             " (size: " + std::to_string(result_data.size()) + " bytes)");
 		}
 	}
-
-	conn.close();
 }
 
 void ClientApp::play() {
-	auto conn = make_connection();
+	try {
+		play_game(connection());
+	} catch (const std::exception& ex) {
+		logger_.error("Game failed: " + std::string(ex.what()));
+		std::cerr << "Error: " << ex.what() << std::endl;
+		drop_connection();
+	}
+	logger_.info("Sticks game finished or quit.");
+}
+
+void ClientApp::play_game(TCPClient& conn) {
 	int current_sticks_on_table = 21;
-	conn.send(std::vector<uint8_t>{'P', 'L', 'A', 'Y'});
 
 	while (true) {
 		int take = 0;
@@ -94,21 +473,24 @@ void ClientApp::play() {
 			std::cout << "Invalid number of sticks. Please take 1, 2, or 3." << std::endl;
 			continue;
 		}
-		conn.send(
-		    std::vector<uint8_t>(reinterpret_cast<uint8_t*>(&take), reinterpret_cast<uint8_t*>(&take) + sizeof(int)));
+		FrameHeader request;
+		request.opcode = Opcode::PLAY_MOVE;
+		request.request_id = conn.next_request_id();
+		uint8_t move[sizeof(int32_t)];
+		put_be32(move, static_cast<uint32_t>(take));
+		conn.send(request, move);
 
-		auto resp_data = conn.receive();
-		int server_take;
-		uint8_t client_won_byte;
-		uint8_t server_won_byte;
-		int sticks_after_server_turn;
-
-		size_t offset = 0;
-		std::memcpy(&server_take, resp_data.data() + offset, sizeof(int));
-		offset += sizeof(int);
-		client_won_byte = resp_data[offset++];
-		server_won_byte = resp_data[offset++];
-		std::memcpy(&sticks_after_server_turn, resp_data.data() + offset, sizeof(int));
+		auto resp = conn.receive();
+		if (resp.header.status != Status::OK || resp.payload.size() != 2 * sizeof(int32_t) + 2) {
+			std::cerr << "Server error: " << status_name(resp.header.status) << "\n";
+			logger_.error("Game move rejected: " + std::string(status_name(resp.header.status)));
+			break;
+		}
+		const uint8_t* resp_data = resp.payload.data();
+		int server_take = static_cast<int32_t>(get_be32(resp_data));
+		uint8_t client_won_byte = resp_data[4];
+		uint8_t server_won_byte = resp_data[5];
+		int sticks_after_server_turn = static_cast<int32_t>(get_be32(resp_data + 6));
 
 		bool client_won = static_cast<bool>(client_won_byte);
 		bool server_won = static_cast<bool>(server_won_byte);
@@ -131,9 +513,6 @@ void ClientApp::play() {
 			break;
 		}
 	}
-
-	conn.close();
-	logger_.info("Sticks game finished or quit.");
 }
 
 }  // namespace client
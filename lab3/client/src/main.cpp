@@ -1,6 +1,12 @@
 #include "client.hpp"
 #include "logger.hpp"
 
+#include <algorithm>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <vector>
+
 static Logger app_logger = Logger::Builder().set_log_level(LogLevel::DEBUG).add_file_handler("client.log").build();
 
 int main() {
@@ -11,6 +17,9 @@ int main() {
 		          << "1) Compile file\n"
 		          << "2) Play sticks game\n"
 		          << "3) Exit\n"
+		          << "4) Submit file(s) to compile in the background\n"
+		          << "5) Collect submitted results\n"
+		          << "6) Compile file(s) in one batch request\n"
 		          << "Select option: ";
 		int opt;
 		if (!(std::cin >> opt)) {
@@ -18,11 +27,29 @@ int main() {
 		}
 
 		switch (opt) {
-			case 1: {
-				std::cout << "Enter path to .cpp/.tex: ";
-				std::string path;
-				std::cin >> path;
-				app.compile(path);
+			case 1:
+			case 4:
+			case 6: {
+				std::cout << "Enter path(s) to .cpp/.tex (-p N first for priority N): ";
+				std::string line;
+				std::getline(std::cin >> std::ws, line);
+				std::istringstream paths_in(line);
+				std::vector<std::string> paths;
+				unsigned long priority = 0;
+				for (std::string path; paths_in >> path;) {
+					if (path == "-p" && paths.empty() && paths_in >> path) {
+						priority = std::min(std::strtoul(path.c_str(), nullptr, 10), 255ul);
+						continue;
+					}
+					paths.push_back(path);
+				}
+				if (opt == 1) {
+					app.compile(paths, static_cast<uint8_t>(priority));
+				} else if (opt == 4) {
+					app.submit(paths, static_cast<uint8_t>(priority));
+				} else {
+					app.compile_batch(paths, static_cast<uint8_t>(priority));
+				}
 				break;
 			}
 			case 2:
@@ -31,6 +58,9 @@ int main() {
 			case 3:
 				std::cout << "Goodbye!\n";
 				return 0;
+			case 5:
+				app.collect();
+				break;
 			default:
 				std::cout << "Unknown option\n";
 		}
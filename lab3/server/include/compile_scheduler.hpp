@@ -0,0 +1,151 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "logger.hpp"
+
+struct LaneConfig {
+	std::string name;
+	// Source extensions (".tex") served by this lane.
+	std::vector<std::string> extensions;
+	// Jobs of this lane allowed in the compiler at once, counted from claiming a ring slot until the answer is taken.
+	size_t max_jobs = 1;
+};
+
+struct SchedulerConfig {
+	// A file whose extension no lane lists goes to the first lane. The defaults leave some ring slots to spare, so
+	// one lane filling up never holds back the other.
+	std::vector<LaneConfig> lanes = {{"quick", {".cpp"}, 24}, {"heavy", {".tex"}, 4}};
+	// How long a job may wait for its lane before it is refused with SERVER_BUSY; 0 waits forever.
+	unsigned int queue_timeout_sec = 120;
+	// Jobs that may wait in one lane at once; more are refused with SERVER_BUSY.
+	size_t max_waiting = 512;
+};
+
+struct LaneStats {
+	std::string name;
+	size_t waiting = 0;
+	size_t active = 0;
+	uint64_t admitted = 0;
+	uint64_t timed_out = 0;
+	uint64_t refused = 0;
+	uint64_t total_wait_us = 0;
+	uint64_t max_wait_us = 0;
+};
+
+class CompileScheduler;
+
+// A job's place in its lane; gives it back when destroyed.
+class CompileAdmission {
+   public:
+	CompileAdmission() : scheduler_(nullptr), lane_(0) {}
+	CompileAdmission(CompileScheduler* scheduler, size_t lane) : scheduler_(scheduler), lane_(lane) {}
+	~CompileAdmission();
+
+	CompileAdmission(CompileAdmission&& other) noexcept;
+	CompileAdmission& operator=(CompileAdmission&& other) noexcept;
+	CompileAdmission(const CompileAdmission&) = delete;
+	CompileAdmission& operator=(const CompileAdmission&) = delete;
+
+	explicit operator bool() const { return scheduler_ != nullptr; }
+
+   private:
+	CompileScheduler* scheduler_;
+	size_t lane_;
+};
+
+// Decides which compile job goes to the compiler next. Jobs are split into lanes by source extension, each with
+// its own concurrency limit. Within a lane, clients with waiting jobs take turns one job at a time, and each
+// client's own jobs go highest priority first, then in arrival order. Thread-safe.
+class CompileScheduler {
+   public:
+	CompileScheduler(const SchedulerConfig& config, Logger& logger);
+	~CompileScheduler();
+
+	CompileScheduler(const CompileScheduler&) = delete;
+	CompileScheduler& operator=(const CompileScheduler&) = delete;
+
+	size_t laneFor(const std::string& filename) const;
+	const std::string& laneName(size_t lane) const;
+
+	// Blocks until the job may enter the compiler. Comes back empty once queue_timeout_sec has passed or when the
+	// lane already has max_waiting jobs waiting.
+	CompileAdmission admit(size_t lane, uint64_t client, uint8_t priority);
+
+	// Queues the job without blocking; on_admit gets its place once it is its turn, on whichever thread gave the
+	// last place up, and should hand the work off rather than run it there. A job still waiting after
+	// queue_timeout_sec, or withdrawn by cancel(), gets an empty admission instead. Returns false, without queueing
+	// the job or calling on_admit, when the lane already has max_waiting jobs waiting. A detached job outlives its
+	// client: cancel() leaves it queued.
+	bool admitAsync(size_t lane, uint64_t client, uint8_t priority, bool detached,
+	                std::function<void(CompileAdmission)> on_admit);
+
+	// Withdraws the client's waiting admitAsync() jobs that are not detached, as when its connection has closed.
+	void cancel(uint64_t client);
+
+	// Jobs all lanes together let into the compiler at once.
+	size_t capacity() const;
+
+	std::vector<LaneStats> stats() const;
+
+   private:
+	friend class CompileAdmission;
+	using Clock = std::chrono::steady_clock;
+
+	struct Waiter {
+		uint64_t client;
+		uint8_t priority;
+		uint64_t seq;
+		Clock::time_point enqueued;
+		bool admitted = false;
+		bool detached = false;
+		// Set for admitAsync() jobs.
+		std::function<void(CompileAdmission)> on_admit;
+	};
+	using Admitted = std::vector<std::pair<size_t, std::shared_ptr<Waiter>>>;
+
+	struct Lane {
+		LaneConfig config;
+		size_t active = 0;
+		// Clients with waiting jobs, next turn at the front.
+		std::deque<uint64_t> turns;
+		std::unordered_map<uint64_t, std::vector<std::shared_ptr<Waiter>>> waiting;
+		LaneStats stats;
+	};
+
+	void release(size_t lane);
+	// Gives up on admitAsync() jobs that have waited longer than queue_timeout_.
+	void sweepLoop();
+	// Tells withdrawn admitAsync() jobs they were not let in.
+	static void notifyWithdrawn(std::vector<std::shared_ptr<Waiter>>& withdrawn);
+	void enqueueLocked(size_t lane, uint64_t client, const std::shared_ptr<Waiter>& waiter);
+	// Hands free places of the lane to waiting jobs. Asynchronous ones are added to admitted, to be told once the
+	// lock is dropped.
+	void dispatchLocked(size_t lane, Admitted& admitted);
+	void notifyAdmitted(Admitted& admitted);
+	void withdrawLocked(Lane& lane, uint64_t client, const std::shared_ptr<Waiter>& waiter);
+
+	Logger& logger_;
+	std::chrono::seconds queue_timeout_;
+	size_t max_waiting_;
+	mutable std::mutex mutex_;
+	std::condition_variable cv_;
+	std::vector<Lane> lanes_;
+	uint64_t next_seq_;
+	bool stopping_;
+	std::condition_variable sweep_cv_;
+	std::thread sweeper_;
+};
+
+std::string format_scheduler_stats(const std::vector<LaneStats>& stats);
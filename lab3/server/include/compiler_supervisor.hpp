@@ -0,0 +1,85 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <atomic>
+#include <chrono>
+#include <compilation_shared_data.hpp>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "logger.hpp"
+
+struct SupervisorConfig {
+	// Compiler binary the supervisor restarts whenever no compiler is attached. Empty leaves that to someone else;
+	// the supervisor then only fails the jobs of a compiler that died.
+	std::string compiler_path;
+	// Start the compiler right away rather than first giving one started by someone else time to attach.
+	bool start_compiler = false;
+	std::vector<std::string> compiler_args;
+	// A compiler whose heartbeat is older than this is considered hung.
+	unsigned int heartbeat_timeout_sec = 5;
+};
+
+struct SupervisorStats {
+	uint64_t restarts = 0;
+	uint64_t failed_jobs = 0;
+	bool compiler_attached = false;
+};
+
+// Watches the compiler subserver through the heartbeat in the job ring. A compiler that exits, disappears or stops
+// beating is killed; the jobs it was running fail at once so their clients are not left waiting, and queued jobs
+// stay for its successor, which is started with backoff. A job kept well past its build limit by a compiler that is
+// still beating fails on its own, leaving the compiler and its other jobs alone.
+class CompilerSupervisor {
+   public:
+	CompilerSupervisor(CompilationSharedData& ring, ShmArena& arena, const SupervisorConfig& config, Logger& logger);
+	~CompilerSupervisor();
+
+	void start();
+	// Stops watching and shuts down a compiler this supervisor started, killing it after grace.
+	void stop(std::chrono::seconds grace);
+
+	SupervisorStats stats() const;
+
+   private:
+	using Clock = std::chrono::steady_clock;
+
+	void run();
+	void check();
+	// Why the attached compiler pid should be replaced, or empty when it looks healthy.
+	std::string diagnose(pid_t pid) const;
+	// Fails the jobs a live compiler has kept well past its build limit.
+	void failStuck();
+	// Kills the toolchain of jobs running well past the server's reply timeout, whose clients have given up.
+	void cancelAbandoned();
+	void kill(pid_t pid);
+	void failInFlight(const std::string& reason);
+	void failSlot(CompileSlot& slot, const std::string& message);
+	void spawn();
+
+	CompilationSharedData& ring_;
+	ShmArena& arena_;
+	SupervisorConfig config_;
+	Logger& logger_;
+
+	std::thread thread_;
+	std::mutex mutex_;
+	std::condition_variable cv_;
+	bool stopping_;
+
+	// Only touched by the supervisor thread, and by stop() once it has joined.
+	pid_t child_;
+	Clock::time_point child_started_;
+	Clock::time_point next_start_;
+	std::chrono::milliseconds restart_delay_;
+
+	std::atomic<uint64_t> restarts_;
+	std::atomic<uint64_t> failed_jobs_;
+};
+
+std::string format_supervisor_stats(const SupervisorStats& stats);
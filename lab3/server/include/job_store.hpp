@@ -0,0 +1,133 @@
+#pragma once
+
+#include <Protocol.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "logger.hpp"
+
+struct JobStoreConfig {
+	// Jobs kept at once, finished or not. When full, the oldest finished job makes room; SUBMIT is refused with
+	// SERVER_BUSY when every kept job is still unfinished.
+	size_t max_jobs = 1024;
+	// A finished job is forgotten this long after it finished.
+	unsigned int result_ttl_sec = 600;
+	// Total size of the kept results; the oldest finished jobs are forgotten early to stay within it.
+	uint64_t max_result_bytes = 256ull * 1024 * 1024;
+	// Total size of the uploads of jobs still waiting to start, which are held in memory until then. SUBMIT is
+	// refused with SERVER_BUSY past it.
+	uint64_t max_queued_bytes = 256ull * 1024 * 1024;
+	// Longest a STATUS or FETCH may wait for a job to finish.
+	unsigned int max_wait_sec = 60;
+};
+
+struct JobStoreStats {
+	size_t queued = 0;
+	size_t running = 0;
+	size_t finished = 0;
+	uint64_t result_bytes = 0;
+	uint64_t queued_bytes = 0;
+	uint64_t submitted = 0;
+	uint64_t expired = 0;
+	uint64_t evicted = 0;
+	uint64_t refused = 0;
+};
+
+// Wire values of the state byte in a STATUS reply.
+enum class JobState : uint8_t { QUEUED = 0, RUNNING = 1, FINISHED = 2 };
+
+// What a watcher learns about a job: nothing when it is unknown or has expired, its state otherwise, and its
+// outcome once it has finished.
+struct JobView {
+	bool found = false;
+	JobState state = JobState::QUEUED;
+	Status status = Status::OK;
+	std::shared_ptr<const std::vector<uint8_t>> result;
+};
+
+// Compile jobs submitted with SUBMIT, kept by a random 64-bit id until their results expire. Clients look at them
+// with watch(), which answers at once or as soon as the job finishes or the wait runs out; a waiting client holds
+// no server thread. Thread-safe.
+class JobStore {
+   public:
+	using Watcher = std::function<void(const JobView& view)>;
+
+	JobStore(const JobStoreConfig& config, Logger& logger);
+	~JobStore();
+
+	JobStore(const JobStore&) = delete;
+	JobStore& operator=(const JobStore&) = delete;
+
+	// Returns the id of a new QUEUED job holding upload_bytes until it starts, or 0 when the store is full or the
+	// queued uploads would go past max_queued_bytes.
+	uint64_t create(size_t upload_bytes);
+	void started(uint64_t id);
+	void finish(uint64_t id, Status status, std::vector<uint8_t> result);
+
+	// Calls watcher with the job once it has finished or wait has passed, whichever comes first; at once when the
+	// job is unknown or wait is zero. wait is capped at max_wait_sec. The call happens on this thread, on the one
+	// that finishes the job, or on the store's timer thread.
+	void watch(uint64_t id, std::chrono::milliseconds wait, Watcher watcher);
+
+	// Answers every outstanding watcher with the job as it is and stops the timer thread.
+	void stop();
+
+	JobStoreStats stats() const;
+
+   private:
+	using Clock = std::chrono::steady_clock;
+
+	struct Job {
+		JobState state = JobState::QUEUED;
+		Status status = Status::OK;
+		// Counted in queued_bytes until the job starts.
+		size_t upload_bytes = 0;
+		std::shared_ptr<const std::vector<uint8_t>> result;
+		Clock::time_point finished_at;
+		// Keyed by the watcher's deadline entry, so the timer and finish() agree on who answers it.
+		std::map<uint64_t, Watcher> watchers;
+	};
+
+	using Answer = std::pair<Watcher, JobView>;
+
+	void timerLoop();
+	JobView viewLocked(uint64_t id) const;
+	// Forgets finished jobs past their TTL.
+	void purgeLocked(Clock::time_point now);
+	// Forgets the oldest finished job; false when there is none.
+	bool evictOldestLocked();
+	void forgetLocked(uint64_t id);
+	// Stops counting the job's upload as queued.
+	void dequeueLocked(Job& job);
+	static void answer(std::vector<Answer>& answers);
+
+	JobStoreConfig config_;
+	Logger& logger_;
+
+	mutable std::mutex mutex_;
+	std::condition_variable cv_;
+	std::thread timer_;
+	bool stopping_;
+	std::mt19937_64 ids_;
+	std::unordered_map<uint64_t, Job> jobs_;
+	// Finished jobs, oldest first; ids already forgotten are skipped.
+	std::deque<uint64_t> finished_order_;
+	// Watcher deadlines: deadline entry id -> job id.
+	std::multimap<Clock::time_point, std::pair<uint64_t, uint64_t>> deadlines_;
+	uint64_t next_watch_;
+	JobStoreStats stats_;
+};
+
+std::string format_job_stats(const JobStoreStats& stats);
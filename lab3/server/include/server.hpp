@@ -3,18 +3,51 @@
 
 #include <sys/types.h>
 
+#include <EventLoop.hpp>
 #include <TCPServer.hpp>
+#include <WorkerPool.hpp>
 #include <compilation_shared_data.hpp>
 #include <cstdint>
-#include <semaphore.hpp>
+#include <memory>
 #include <shared_memory.hpp>
 #include <vector>
 
+#include "compile_scheduler.hpp"
+#include "compiler_supervisor.hpp"
+#include "job_store.hpp"
 #include "logger.hpp"
 
 static constexpr auto SHM_NAME = "/compile_shm";
-static constexpr auto SEM_REQ_NAME = "/sem_req";
-static constexpr auto SEM_RESP_NAME = "/sem_resp";
 static constexpr uint16_t SERVER_PORT = 5555;
 
-void handle_client(int client_fd, Logger& logger);
\ No newline at end of file
+enum class ServerMode { THREADED, REACTOR };
+
+struct ServerConfig {
+	ServerMode mode = ServerMode::REACTOR;
+	size_t io_threads = 2;
+	IoBackend io_backend = IoBackend::EPOLL;
+	ListenerConfig listener;
+	WorkerPoolConfig pool;
+	unsigned int stats_interval_sec = 30;
+	unsigned int drain_timeout_sec = 10;
+	// Shared memory for compile sources and results; only the pages in use are backed.
+	uint64_t compile_arena_bytes = 256ull * 1024 * 1024;
+	uint64_t max_source_bytes = 10ull * 1024 * 1024;
+	// How long a client waits for the compiler before its job is given up on; 0 waits forever.
+	unsigned int compile_reply_timeout_sec = 120;
+	SupervisorConfig supervisor;
+	SchedulerConfig scheduler;
+	JobStoreConfig jobs;
+};
+
+// What client handlers share for compiling. Compile jobs go through scheduler, where each connection counts as one
+// client for fair sharing; SUBMIT jobs are kept in jobs and built on runners.
+struct CompileServices {
+	CompileScheduler& scheduler;
+	JobStore& jobs;
+	WorkerPool& runners;
+};
+
+void handle_client(int client_fd, CompileServices& services, Logger& logger);
+
+std::unique_ptr<FrameSession> make_client_session(int client_fd, CompileServices& services, Logger& logger);
\ No newline at end of file
@@ -0,0 +1,350 @@
+#include "compile_scheduler.hpp"
+
+#include <algorithm>
+#include <filesystem>
+
+#include "compilation_shared_data.hpp"
+
+namespace {
+
+// How often waiting admitAsync() jobs are checked against the queue timeout.
+constexpr std::chrono::seconds SWEEP_INTERVAL(1);
+
+}  // namespace
+
+CompileAdmission::~CompileAdmission() {
+	if (scheduler_) {
+		scheduler_->release(lane_);
+	}
+}
+
+CompileAdmission::CompileAdmission(CompileAdmission&& other) noexcept
+    : scheduler_(other.scheduler_), lane_(other.lane_) {
+	other.scheduler_ = nullptr;
+}
+
+CompileAdmission& CompileAdmission::operator=(CompileAdmission&& other) noexcept {
+	if (this != &other) {
+		if (scheduler_) {
+			scheduler_->release(lane_);
+		}
+		scheduler_ = other.scheduler_;
+		lane_ = other.lane_;
+		other.scheduler_ = nullptr;
+	}
+	return *this;
+}
+
+CompileScheduler::CompileScheduler(const SchedulerConfig& config, Logger& logger)
+    : logger_(logger),
+      queue_timeout_(config.queue_timeout_sec),
+      max_waiting_(std::max<size_t>(config.max_waiting, 1)),
+      next_seq_(0),
+      stopping_(false) {
+	size_t slots = 0;
+	for (const LaneConfig& lane_config : config.lanes) {
+		Lane lane;
+		lane.config = lane_config;
+		lane.config.max_jobs = std::max<size_t>(lane.config.max_jobs, 1);
+		lane.stats.name = lane.config.name;
+		slots += lane.config.max_jobs;
+		lanes_.push_back(std::move(lane));
+	}
+	if (lanes_.empty()) {
+		Lane lane;
+		lane.config = {"default", {}, COMPILE_RING_SLOTS};
+		lane.stats.name = lane.config.name;
+		slots = COMPILE_RING_SLOTS;
+		lanes_.push_back(std::move(lane));
+	}
+	if (slots > COMPILE_RING_SLOTS) {
+		logger_.warning("CompileScheduler: Lanes allow " + std::to_string(slots) + " jobs but the ring has " +
+		                std::to_string(COMPILE_RING_SLOTS) + " slots; a busy lane can hold back the others");
+	}
+	for (const Lane& lane : lanes_) {
+		logger_.info("CompileScheduler: Lane " + lane.config.name + " runs up to " +
+		             std::to_string(lane.config.max_jobs) + " jobs");
+	}
+	if (queue_timeout_.count() > 0) {
+		sweeper_ = std::thread(&CompileScheduler::sweepLoop, this);
+	}
+}
+
+CompileScheduler::~CompileScheduler() {
+	{
+		std::lock_guard lock(mutex_);
+		stopping_ = true;
+	}
+	sweep_cv_.notify_all();
+	if (sweeper_.joinable()) {
+		sweeper_.join();
+	}
+}
+
+size_t CompileScheduler::laneFor(const std::string& filename) const {
+	std::string extension = std::filesystem::path(filename).extension().string();
+	for (size_t i = 0; i < lanes_.size(); ++i) {
+		const auto& extensions = lanes_[i].config.extensions;
+		if (std::find(extensions.begin(), extensions.end(), extension) != extensions.end()) {
+			return i;
+		}
+	}
+	return 0;
+}
+
+const std::string& CompileScheduler::laneName(size_t lane) const { return lanes_[lane].config.name; }
+
+CompileAdmission CompileScheduler::admit(size_t lane_index, uint64_t client, uint8_t priority) {
+	auto waiter = std::make_shared<Waiter>();
+	waiter->client = client;
+	waiter->priority = priority;
+	waiter->enqueued = Clock::now();
+
+	std::unique_lock lock(mutex_);
+	Lane& lane = lanes_[lane_index];
+	if (lane.stats.waiting >= max_waiting_) {
+		++lane.stats.refused;
+		return {};
+	}
+	enqueueLocked(lane_index, client, waiter);
+	Admitted admitted;
+	dispatchLocked(lane_index, admitted);
+
+	auto ready = [&waiter] { return waiter->admitted; };
+	if (queue_timeout_.count() == 0) {
+		cv_.wait(lock, ready);
+	} else if (!cv_.wait_until(lock, waiter->enqueued + queue_timeout_, ready)) {
+		withdrawLocked(lane, client, waiter);
+		++lane.stats.timed_out;
+		logger_.warning("CompileScheduler: Job of client " + std::to_string(client) + " waited " +
+		                std::to_string(queue_timeout_.count()) + " s for lane " + lane.config.name + ", giving up");
+		lock.unlock();
+		notifyAdmitted(admitted);
+		return {};
+	}
+	lock.unlock();
+	notifyAdmitted(admitted);
+	return CompileAdmission(this, lane_index);
+}
+
+bool CompileScheduler::admitAsync(size_t lane_index, uint64_t client, uint8_t priority, bool detached,
+                                  std::function<void(CompileAdmission)> on_admit) {
+	auto waiter = std::make_shared<Waiter>();
+	waiter->client = client;
+	waiter->priority = priority;
+	waiter->enqueued = Clock::now();
+	waiter->detached = detached;
+	waiter->on_admit = std::move(on_admit);
+
+	Admitted admitted;
+	{
+		std::lock_guard lock(mutex_);
+		Lane& lane = lanes_[lane_index];
+		if (lane.stats.waiting >= max_waiting_) {
+			++lane.stats.refused;
+			return false;
+		}
+		enqueueLocked(lane_index, client, waiter);
+		dispatchLocked(lane_index, admitted);
+	}
+	notifyAdmitted(admitted);
+	return true;
+}
+
+void CompileScheduler::cancel(uint64_t client) {
+	std::vector<std::shared_ptr<Waiter>> withdrawn;
+	{
+		std::lock_guard lock(mutex_);
+		for (Lane& lane : lanes_) {
+			auto it = lane.waiting.find(client);
+			if (it == lane.waiting.end()) {
+				continue;
+			}
+			std::vector<std::shared_ptr<Waiter>> queue = it->second;
+			for (const auto& waiter : queue) {
+				if (waiter->on_admit && !waiter->detached) {
+					withdrawLocked(lane, client, waiter);
+					withdrawn.push_back(waiter);
+				}
+			}
+		}
+	}
+	if (!withdrawn.empty()) {
+		logger_.info("CompileScheduler: Withdrew " + std::to_string(withdrawn.size()) + " waiting jobs of client " +
+		             std::to_string(client));
+	}
+	notifyWithdrawn(withdrawn);
+}
+
+size_t CompileScheduler::capacity() const {
+	size_t total = 0;
+	for (const Lane& lane : lanes_) {
+		total += lane.config.max_jobs;
+	}
+	return total;
+}
+
+void CompileScheduler::release(size_t lane_index) {
+	Admitted admitted;
+	{
+		std::lock_guard lock(mutex_);
+		--lanes_[lane_index].active;
+		dispatchLocked(lane_index, admitted);
+	}
+	notifyAdmitted(admitted);
+}
+
+void CompileScheduler::sweepLoop() {
+	std::unique_lock lock(mutex_);
+	while (!stopping_) {
+		sweep_cv_.wait_for(lock, SWEEP_INTERVAL);
+		auto now = Clock::now();
+		std::vector<std::shared_ptr<Waiter>> expired;
+		for (Lane& lane : lanes_) {
+			std::vector<std::shared_ptr<Waiter>> overdue;
+			for (const auto& [client, queue] : lane.waiting) {
+				for (const auto& waiter : queue) {
+					if (waiter->on_admit && now - waiter->enqueued >= queue_timeout_) {
+						overdue.push_back(waiter);
+					}
+				}
+			}
+			for (auto& waiter : overdue) {
+				withdrawLocked(lane, waiter->client, waiter);
+				++lane.stats.timed_out;
+				logger_.warning("CompileScheduler: Job of client " + std::to_string(waiter->client) + " waited " +
+				                std::to_string(queue_timeout_.count()) + " s for lane " + lane.config.name +
+				                ", giving up");
+				expired.push_back(std::move(waiter));
+			}
+		}
+		if (!expired.empty()) {
+			lock.unlock();
+			notifyWithdrawn(expired);
+			lock.lock();
+		}
+	}
+}
+
+void CompileScheduler::notifyWithdrawn(std::vector<std::shared_ptr<Waiter>>& withdrawn) {
+	for (auto& waiter : withdrawn) {
+		waiter->on_admit(CompileAdmission());
+	}
+	withdrawn.clear();
+}
+
+void CompileScheduler::enqueueLocked(size_t lane_index, uint64_t client, const std::shared_ptr<Waiter>& waiter) {
+	Lane& lane = lanes_[lane_index];
+	waiter->seq = next_seq_++;
+	auto& queue = lane.waiting[client];
+	if (queue.empty()) {
+		lane.turns.push_back(client);
+	}
+	queue.push_back(waiter);
+	++lane.stats.waiting;
+}
+
+void CompileScheduler::dispatchLocked(size_t lane_index, Admitted& admitted) {
+	Lane& lane = lanes_[lane_index];
+	bool woke = false;
+	auto now = Clock::now();
+	while (lane.active < lane.config.max_jobs && !lane.turns.empty()) {
+		uint64_t client = lane.turns.front();
+		lane.turns.pop_front();
+		auto it = lane.waiting.find(client);
+		auto& queue = it->second;
+		auto next = std::min_element(queue.begin(), queue.end(), [](const auto& a, const auto& b) {
+			return a->priority != b->priority ? a->priority > b->priority : a->seq < b->seq;
+		});
+		std::shared_ptr<Waiter> waiter = *next;
+		queue.erase(next);
+		if (queue.empty()) {
+			lane.waiting.erase(it);
+		} else {
+			lane.turns.push_back(client);
+		}
+
+		auto wait_us =
+		    static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(now - waiter->enqueued).count());
+		--lane.stats.waiting;
+		++lane.stats.admitted;
+		lane.stats.total_wait_us += wait_us;
+		lane.stats.max_wait_us = std::max(lane.stats.max_wait_us, wait_us);
+		++lane.active;
+		waiter->admitted = true;
+		if (waiter->on_admit) {
+			admitted.emplace_back(lane_index, std::move(waiter));
+		} else {
+			woke = true;
+		}
+	}
+	if (woke) {
+		cv_.notify_all();
+	}
+}
+
+void CompileScheduler::notifyAdmitted(Admitted& admitted) {
+	struct Pending {
+		CompileScheduler* scheduler;
+		size_t lane;
+		std::shared_ptr<Waiter> waiter;
+	};
+	// A callback that gives its place straight back, as when the runners refuse the job, admits the next job from
+	// inside this loop. Those are told by the outermost call on the thread instead of recursing once per queued job.
+	static thread_local std::deque<Pending>* telling = nullptr;
+	if (telling) {
+		for (auto& [lane_index, waiter] : admitted) {
+			telling->push_back({this, lane_index, std::move(waiter)});
+		}
+		return;
+	}
+	std::deque<Pending> pending;
+	for (auto& [lane_index, waiter] : admitted) {
+		pending.push_back({this, lane_index, std::move(waiter)});
+	}
+	telling = &pending;
+	struct Done {
+		~Done() { telling = nullptr; }
+	} done;
+	while (!pending.empty()) {
+		Pending next = std::move(pending.front());
+		pending.pop_front();
+		next.waiter->on_admit(CompileAdmission(next.scheduler, next.lane));
+	}
+}
+
+void CompileScheduler::withdrawLocked(Lane& lane, uint64_t client, const std::shared_ptr<Waiter>& waiter) {
+	auto it = lane.waiting.find(client);
+	auto& queue = it->second;
+	queue.erase(std::find(queue.begin(), queue.end(), waiter));
+	if (queue.empty()) {
+		lane.waiting.erase(it);
+		lane.turns.erase(std::find(lane.turns.begin(), lane.turns.end(), client));
+	}
+	--lane.stats.waiting;
+}
+
+std::vector<LaneStats> CompileScheduler::stats() const {
+	std::lock_guard lock(mutex_);
+	std::vector<LaneStats> out;
+	for (const Lane& lane : lanes_) {
+		out.push_back(lane.stats);
+		out.back().active = lane.active;
+	}
+	return out;
+}
+
+std::string format_scheduler_stats(const std::vector<LaneStats>& stats) {
+	std::string out;
+	for (const LaneStats& lane : stats) {
+		uint64_t avg_wait_us = lane.admitted ? lane.total_wait_us / lane.admitted : 0;
+		if (!out.empty()) {
+			out += "; ";
+		}
+		out += lane.name + " waiting=" + std::to_string(lane.waiting) + " active=" + std::to_string(lane.active) +
+		       " admitted=" + std::to_string(lane.admitted) + " timed_out=" + std::to_string(lane.timed_out) +
+		       " refused=" + std::to_string(lane.refused) +
+		       " wait_us(avg/max)=" + std::to_string(avg_wait_us) + "/" + std::to_string(lane.max_wait_us);
+	}
+	return out;
+}
@@ -0,0 +1,298 @@
+#include "compiler_supervisor.hpp"
+
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+namespace {
+
+constexpr std::chrono::milliseconds CHECK_INTERVAL(500);
+constexpr std::chrono::milliseconds MIN_RESTART_DELAY(500);
+constexpr std::chrono::milliseconds MAX_RESTART_DELAY(30000);
+// A compiler that has stayed up this long is healthy again, and its successor starts without delay.
+constexpr std::chrono::seconds STABLE_UPTIME(30);
+// Slack on top of the compiler's own job limit before a RUNNING job counts as stuck.
+constexpr uint64_t OVERDUE_GRACE_MS = 30000;
+// How long a compiler started by someone else has to attach before the supervisor starts its own.
+constexpr std::chrono::seconds ATTACH_GRACE(3);
+
+std::string describe_exit(int status) {
+	if (WIFEXITED(status)) {
+		return "exited with status " + std::to_string(WEXITSTATUS(status));
+	}
+	if (WIFSIGNALED(status)) {
+		return "was killed by signal " + std::to_string(WTERMSIG(status));
+	}
+	return "stopped";
+}
+
+}  // namespace
+
+CompilerSupervisor::CompilerSupervisor(CompilationSharedData& ring, ShmArena& arena, const SupervisorConfig& config,
+                                       Logger& logger)
+    : ring_(ring),
+      arena_(arena),
+      config_(config),
+      logger_(logger),
+      stopping_(false),
+      child_(0),
+      restart_delay_(MIN_RESTART_DELAY),
+      restarts_(0),
+      failed_jobs_(0) {}
+
+CompilerSupervisor::~CompilerSupervisor() { stop(std::chrono::seconds(0)); }
+
+void CompilerSupervisor::start() {
+	if (config_.start_compiler && !config_.compiler_path.empty()) {
+		spawn();
+	} else {
+		next_start_ = Clock::now() + ATTACH_GRACE;
+	}
+	thread_ = std::thread(&CompilerSupervisor::run, this);
+}
+
+void CompilerSupervisor::stop(std::chrono::seconds grace) {
+	{
+		std::lock_guard lock(mutex_);
+		if (stopping_) {
+			return;
+		}
+		stopping_ = true;
+	}
+	cv_.notify_all();
+	if (thread_.joinable()) {
+		thread_.join();
+	}
+	if (child_ <= 0) {
+		return;
+	}
+
+	logger_.info("Supervisor: Stopping compiler " + std::to_string(child_));
+	::kill(child_, SIGTERM);
+	auto deadline = Clock::now() + grace;
+	int status = 0;
+	while (waitpid(child_, &status, WNOHANG) == 0) {
+		if (Clock::now() >= deadline) {
+			logger_.warning("Supervisor: Compiler " + std::to_string(child_) + " ignored SIGTERM, killing it");
+			::kill(child_, SIGKILL);
+			waitpid(child_, &status, 0);
+			break;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	}
+	child_ = 0;
+}
+
+SupervisorStats CompilerSupervisor::stats() const {
+	SupervisorStats stats;
+	stats.restarts = restarts_.load();
+	stats.failed_jobs = failed_jobs_.load();
+	stats.compiler_attached = ring_.heartbeat.pid.load() != 0;
+	return stats;
+}
+
+void CompilerSupervisor::run() {
+	std::unique_lock lock(mutex_);
+	while (!stopping_) {
+		lock.unlock();
+		try {
+			check();
+		} catch (const std::exception& ex) {
+			logger_.error("Supervisor: Check failed: " + std::string(ex.what()));
+		}
+		lock.lock();
+		cv_.wait_for(lock, CHECK_INTERVAL, [this] { return stopping_; });
+	}
+}
+
+void CompilerSupervisor::check() {
+	std::string reason;
+	pid_t pid = ring_.heartbeat.pid.load();
+	if (child_ > 0) {
+		int status = 0;
+		if (waitpid(child_, &status, WNOHANG) == child_) {
+			reason = "compiler " + std::to_string(child_) + " " + describe_exit(status);
+			pid = pid == child_ ? pid : 0;
+			child_ = 0;
+		}
+	}
+	if (reason.empty() && pid != 0) {
+		reason = diagnose(pid);
+		if (!reason.empty()) {
+			kill(pid);
+		}
+	}
+
+	if (!reason.empty()) {
+		logger_.error("Supervisor: " + reason);
+		if (pid != 0) {
+			ring_.heartbeat.pid.compare_exchange_strong(pid, 0);
+		}
+		failInFlight(reason);
+		if (Clock::now() - child_started_ < STABLE_UPTIME) {
+			restart_delay_ = std::min(restart_delay_ * 2, MAX_RESTART_DELAY);
+		} else {
+			restart_delay_ = MIN_RESTART_DELAY;
+		}
+		next_start_ = Clock::now() + restart_delay_;
+	}
+
+	if (pid != 0 && reason.empty()) {
+		failStuck();
+	}
+	cancelAbandoned();
+
+	if (!config_.compiler_path.empty() && child_ == 0 && ring_.heartbeat.pid.load() == 0 &&
+	    Clock::now() >= next_start_) {
+		spawn();
+		restarts_.fetch_add(1);
+	}
+}
+
+std::string CompilerSupervisor::diagnose(pid_t pid) const {
+	if (::kill(pid, 0) < 0 && errno == ESRCH) {
+		return "compiler " + std::to_string(pid) + " is gone";
+	}
+	uint64_t now = heartbeat_clock_ms();
+	uint64_t beat = ring_.heartbeat.beat_ms.load();
+	if (now > beat && now - beat > config_.heartbeat_timeout_sec * 1000ull) {
+		return "compiler " + std::to_string(pid) + " missed its heartbeat for " + std::to_string((now - beat) / 1000) +
+		       " s";
+	}
+	return "";
+}
+
+void CompilerSupervisor::failStuck() {
+	uint64_t job_timeout_ms = ring_.heartbeat.job_timeout_sec.load() * 1000ull;
+	if (job_timeout_ms == 0) {
+		return;
+	}
+	uint64_t now = heartbeat_clock_ms();
+	for (size_t i = 0; i < COMPILE_RING_SLOTS; ++i) {
+		CompileSlot& slot = ring_.slots[i];
+		uint64_t ticket = slot.running_ticket.load(std::memory_order_acquire);
+		uint64_t started = slot.started_ms.load();
+		if (ticket == 0 || slot.status.load() != CompileStatus::RUNNING || now <= started ||
+		    now - started <= job_timeout_ms + OVERDUE_GRACE_MS) {
+			continue;
+		}
+		pid_t group = slot.toolchain_group.exchange(0);
+		if (group > 0) {
+			::kill(-group, SIGKILL);
+		}
+		// Losing the swap means the compiler finished the job after all and answers it itself.
+		if (!slot.running_ticket.compare_exchange_strong(ticket, 0, std::memory_order_acq_rel)) {
+			continue;
+		}
+		logger_.error("Supervisor: Job " + std::to_string(ticket) + " has been stuck in slot " + std::to_string(i) +
+		              " for " + std::to_string((now - started) / 1000) + " s");
+		failSlot(slot, "build aborted: stuck for " + std::to_string((now - started) / 1000) + " s; please retry");
+		logger_.warning("Supervisor: Failed the job in slot " + std::to_string(i));
+	}
+}
+
+void CompilerSupervisor::cancelAbandoned() {
+	uint64_t reply_timeout_ms = ring_.reply_timeout_sec * 1000ull;
+	if (reply_timeout_ms == 0) {
+		return;
+	}
+	uint64_t now = heartbeat_clock_ms();
+	for (size_t i = 0; i < COMPILE_RING_SLOTS; ++i) {
+		CompileSlot& slot = ring_.slots[i];
+		uint64_t started = slot.started_ms.load();
+		if (slot.status.load() != CompileStatus::RUNNING || now <= started ||
+		    now - started <= reply_timeout_ms + OVERDUE_GRACE_MS) {
+			continue;
+		}
+		// Nobody waits for the result any more; a failed build lets the compiler post done and the slot be reclaimed.
+		pid_t group = slot.toolchain_group.exchange(0);
+		if (group > 0) {
+			::kill(-group, SIGKILL);
+			logger_.warning("Supervisor: Killed the build in slot " + std::to_string(i) + ", running for " +
+			                std::to_string((now - started) / 1000) + " s after its client gave up");
+		}
+	}
+}
+
+void CompilerSupervisor::kill(pid_t pid) {
+	::kill(pid, SIGKILL);
+	if (pid == child_) {
+		int status = 0;
+		waitpid(child_, &status, 0);
+		child_ = 0;
+		return;
+	}
+	// Not ours to reap; give the kernel a moment to take it down before its jobs are touched.
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+}
+
+void CompilerSupervisor::failInFlight(const std::string& reason) {
+	std::string message = "build aborted: " + reason + "; please retry";
+	for (size_t i = 0; i < COMPILE_RING_SLOTS; ++i) {
+		CompileSlot& slot = ring_.slots[i];
+		if (slot.status.load(std::memory_order_acquire) != CompileStatus::RUNNING) {
+			continue;
+		}
+		// The build's processes outlive the compiler that started them.
+		pid_t group = slot.toolchain_group.exchange(0);
+		if (group > 0) {
+			::kill(-group, SIGKILL);
+		}
+		slot.running_ticket.store(0);
+		failSlot(slot, message);
+		logger_.warning("Supervisor: Failed the job in slot " + std::to_string(i));
+	}
+}
+
+void CompilerSupervisor::failSlot(CompileSlot& slot, const std::string& message) {
+	arena_.free(slot.result_offset);
+	slot.result_offset = arena_.allocate(message.size());
+	slot.result_size = slot.result_offset == ShmArena::NONE ? 0 : message.size();
+	if (slot.result_size > 0) {
+		std::memcpy(arena_.at(slot.result_offset), message.data(), message.size());
+	}
+	slot.status.store(CompileStatus::FAILURE, std::memory_order_release);
+	slot.done.post();
+	failed_jobs_.fetch_add(1);
+}
+
+void CompilerSupervisor::spawn() {
+	std::vector<char*> argv;
+	argv.push_back(const_cast<char*>(config_.compiler_path.c_str()));
+	for (const auto& arg : config_.compiler_args) {
+		argv.push_back(const_cast<char*>(arg.c_str()));
+	}
+	argv.push_back(nullptr);
+
+	// Its own process group keeps a terminal's Ctrl-C away from it; the server stops it after draining clients.
+	posix_spawnattr_t attr;
+	posix_spawnattr_init(&attr);
+	sigset_t no_signals;
+	sigemptyset(&no_signals);
+	posix_spawnattr_setsigmask(&attr, &no_signals);
+	posix_spawnattr_setpgroup(&attr, 0);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK);
+	pid_t pid;
+	int rc = posix_spawn(&pid, config_.compiler_path.c_str(), nullptr, &attr, argv.data(), environ);
+	posix_spawnattr_destroy(&attr);
+
+	child_started_ = Clock::now();
+	if (rc != 0) {
+		logger_.error("Supervisor: Cannot start " + config_.compiler_path + ": " + strerror(rc));
+		restart_delay_ = std::min(restart_delay_ * 2, MAX_RESTART_DELAY);
+		next_start_ = child_started_ + restart_delay_;
+		return;
+	}
+	child_ = pid;
+	logger_.info("Supervisor: Started compiler " + config_.compiler_path + " as pid " + std::to_string(pid));
+}
+
+std::string format_supervisor_stats(const SupervisorStats& stats) {
+	return std::string("compiler ") + (stats.compiler_attached ? "attached" : "detached") +
+	       " restarts=" + std::to_string(stats.restarts) + " failed_jobs=" + std::to_string(stats.failed_jobs);
+}
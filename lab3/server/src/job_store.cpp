@@ -0,0 +1,251 @@
+#include "job_store.hpp"
+
+#include <algorithm>
+
+namespace {
+
+// How often finished jobs are checked for expiry when no watcher is due sooner.
+constexpr std::chrono::seconds PURGE_INTERVAL(1);
+
+}  // namespace
+
+JobStore::JobStore(const JobStoreConfig& config, Logger& logger)
+    : config_(config), logger_(logger), stopping_(false), ids_(std::random_device{}()), next_watch_(1) {
+	timer_ = std::thread(&JobStore::timerLoop, this);
+}
+
+JobStore::~JobStore() { stop(); }
+
+uint64_t JobStore::create(size_t upload_bytes) {
+	std::lock_guard lock(mutex_);
+	purgeLocked(Clock::now());
+	if (upload_bytes > config_.max_queued_bytes - stats_.queued_bytes) {
+		++stats_.refused;
+		return 0;
+	}
+	while (jobs_.size() >= config_.max_jobs) {
+		if (!evictOldestLocked()) {
+			++stats_.refused;
+			return 0;
+		}
+	}
+	uint64_t id;
+	do {
+		id = ids_();
+	} while (id == 0 || jobs_.contains(id));
+	jobs_[id].upload_bytes = upload_bytes;
+	stats_.queued_bytes += upload_bytes;
+	++stats_.submitted;
+	return id;
+}
+
+void JobStore::started(uint64_t id) {
+	std::lock_guard lock(mutex_);
+	auto it = jobs_.find(id);
+	if (it != jobs_.end()) {
+		it->second.state = JobState::RUNNING;
+		dequeueLocked(it->second);
+	}
+}
+
+void JobStore::finish(uint64_t id, Status status, std::vector<uint8_t> result) {
+	std::vector<Answer> answers;
+	{
+		std::lock_guard lock(mutex_);
+		auto it = jobs_.find(id);
+		if (it == jobs_.end()) {
+			return;
+		}
+		if (result.size() > config_.max_result_bytes) {
+			logger_.warning("JobStore: Result of job " + std::to_string(id) + " (" + std::to_string(result.size()) +
+			                " bytes) is larger than the whole result store, dropping it");
+			status = Status::SERVER_BUSY;
+			result.clear();
+		}
+		// Make room first, so this job never evicts itself.
+		while (stats_.result_bytes + result.size() > config_.max_result_bytes && evictOldestLocked()) {
+		}
+		Job& job = it->second;
+		dequeueLocked(job);
+		stats_.result_bytes += result.size();
+		job.state = JobState::FINISHED;
+		job.status = status;
+		job.result = std::make_shared<const std::vector<uint8_t>>(std::move(result));
+		job.finished_at = Clock::now();
+		finished_order_.push_back(id);
+
+		JobView view = viewLocked(id);
+		for (auto& [watch, watcher] : job.watchers) {
+			answers.emplace_back(std::move(watcher), view);
+		}
+		job.watchers.clear();
+	}
+	answer(answers);
+}
+
+void JobStore::watch(uint64_t id, std::chrono::milliseconds wait, Watcher watcher) {
+	wait = std::min<std::chrono::milliseconds>(wait, std::chrono::seconds(config_.max_wait_sec));
+	JobView view;
+	{
+		std::lock_guard lock(mutex_);
+		auto it = jobs_.find(id);
+		if (it != jobs_.end() && it->second.state != JobState::FINISHED && wait.count() > 0 && !stopping_) {
+			auto deadline = Clock::now() + wait;
+			uint64_t watch = next_watch_++;
+			it->second.watchers.emplace(watch, std::move(watcher));
+			bool earliest = deadlines_.empty() || deadline < deadlines_.begin()->first;
+			deadlines_.emplace(deadline, std::make_pair(watch, id));
+			if (earliest) {
+				cv_.notify_all();
+			}
+			return;
+		}
+		view = viewLocked(id);
+	}
+	watcher(view);
+}
+
+void JobStore::stop() {
+	std::vector<Answer> answers;
+	{
+		std::lock_guard lock(mutex_);
+		if (stopping_) {
+			return;
+		}
+		stopping_ = true;
+		for (auto& [id, job] : jobs_) {
+			JobView view = viewLocked(id);
+			for (auto& [watch, watcher] : job.watchers) {
+				answers.emplace_back(std::move(watcher), view);
+			}
+			job.watchers.clear();
+		}
+		deadlines_.clear();
+	}
+	cv_.notify_all();
+	if (timer_.joinable()) {
+		timer_.join();
+	}
+	answer(answers);
+}
+
+JobStoreStats JobStore::stats() const {
+	std::lock_guard lock(mutex_);
+	JobStoreStats out = stats_;
+	for (const auto& [id, job] : jobs_) {
+		switch (job.state) {
+			case JobState::QUEUED:
+				++out.queued;
+				break;
+			case JobState::RUNNING:
+				++out.running;
+				break;
+			case JobState::FINISHED:
+				++out.finished;
+				break;
+		}
+	}
+	return out;
+}
+
+void JobStore::timerLoop() {
+	std::unique_lock lock(mutex_);
+	while (!stopping_) {
+		auto now = Clock::now();
+		purgeLocked(now);
+		std::vector<Answer> answers;
+		while (!deadlines_.empty() && deadlines_.begin()->first <= now) {
+			auto [watch, id] = deadlines_.begin()->second;
+			deadlines_.erase(deadlines_.begin());
+			auto job = jobs_.find(id);
+			if (job == jobs_.end()) {
+				continue;
+			}
+			auto watcher = job->second.watchers.find(watch);
+			if (watcher == job->second.watchers.end()) {
+				continue;
+			}
+			answers.emplace_back(std::move(watcher->second), viewLocked(id));
+			job->second.watchers.erase(watcher);
+		}
+		if (!answers.empty()) {
+			lock.unlock();
+			answer(answers);
+			lock.lock();
+			continue;
+		}
+		auto next = now + PURGE_INTERVAL;
+		if (!deadlines_.empty()) {
+			next = std::min(next, deadlines_.begin()->first);
+		}
+		cv_.wait_until(lock, next);
+	}
+}
+
+JobView JobStore::viewLocked(uint64_t id) const {
+	JobView view;
+	auto it = jobs_.find(id);
+	if (it == jobs_.end()) {
+		return view;
+	}
+	view.found = true;
+	view.state = it->second.state;
+	view.status = it->second.status;
+	view.result = it->second.result;
+	return view;
+}
+
+void JobStore::purgeLocked(Clock::time_point now) {
+	auto ttl = std::chrono::seconds(config_.result_ttl_sec);
+	while (!finished_order_.empty()) {
+		auto it = jobs_.find(finished_order_.front());
+		if (it != jobs_.end()) {
+			if (now - it->second.finished_at < ttl) {
+				break;
+			}
+			forgetLocked(it->first);
+			++stats_.expired;
+		}
+		finished_order_.pop_front();
+	}
+}
+
+bool JobStore::evictOldestLocked() {
+	while (!finished_order_.empty()) {
+		uint64_t id = finished_order_.front();
+		finished_order_.pop_front();
+		if (jobs_.contains(id)) {
+			forgetLocked(id);
+			++stats_.evicted;
+			return true;
+		}
+	}
+	return false;
+}
+
+void JobStore::forgetLocked(uint64_t id) {
+	auto it = jobs_.find(id);
+	if (it->second.result) {
+		stats_.result_bytes -= it->second.result->size();
+	}
+	jobs_.erase(it);
+}
+
+void JobStore::dequeueLocked(Job& job) {
+	stats_.queued_bytes -= job.upload_bytes;
+	job.upload_bytes = 0;
+}
+
+void JobStore::answer(std::vector<Answer>& answers) {
+	for (auto& [watcher, view] : answers) {
+		watcher(view);
+	}
+}
+
+std::string format_job_stats(const JobStoreStats& stats) {
+	return "queued=" + std::to_string(stats.queued) + " running=" + std::to_string(stats.running) +
+	       " finished=" + std::to_string(stats.finished) + " result_bytes=" + std::to_string(stats.result_bytes) +
+	       " queued_bytes=" + std::to_string(stats.queued_bytes) +
+	       " submitted=" + std::to_string(stats.submitted) + " expired=" + std::to_string(stats.expired) +
+	       " evicted=" + std::to_string(stats.evicted) + " refused=" + std::to_string(stats.refused);
+}
@@ -3,6 +3,12 @@
 #include <unistd.h>
 
 #include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
 
 #include "logger.hpp"
 #include "server.hpp"
@@ -18,7 +24,146 @@ void sigint_handler(int signum) {
 	server_is_running.store(false);
 }
 
-int main() {
+static std::string format_cache_stats(const CompileCacheStats& stats) {
+	return "hits=" + std::to_string(stats.hits.load()) + " misses=" + std::to_string(stats.misses.load()) +
+	       " evictions=" + std::to_string(stats.evictions.load()) + " entries=" + std::to_string(stats.entries.load()) +
+	       " bytes=" + std::to_string(stats.bytes.load());
+}
+
+// The compiler installed next to the server binary, or empty when there is none.
+static std::string default_compiler_path() {
+	std::error_code error;
+	std::filesystem::path path = std::filesystem::read_symlink("/proc/self/exe", error).parent_path() / "compiler";
+	return !error && std::filesystem::is_regular_file(path, error) ? path.string() : "";
+}
+
+// NAME=EXT[,EXT...]:JOBS, e.g. heavy=.tex:4
+static bool parse_lane(const std::string& spec, LaneConfig& lane) {
+	size_t equals = spec.find('=');
+	size_t colon = spec.rfind(':');
+	if (equals == std::string::npos || colon == std::string::npos || colon < equals || equals == 0) {
+		return false;
+	}
+	lane.name = spec.substr(0, equals);
+	std::string extensions = spec.substr(equals + 1, colon - equals - 1);
+	for (size_t start = 0; start < extensions.size();) {
+		size_t comma = extensions.find(',', start);
+		if (comma == std::string::npos) {
+			comma = extensions.size();
+		}
+		if (comma > start) {
+			lane.extensions.push_back(extensions.substr(start, comma - start));
+		}
+		start = comma + 1;
+	}
+	lane.max_jobs = std::strtoul(spec.c_str() + colon + 1, nullptr, 10);
+	return lane.max_jobs > 0;
+}
+
+static bool parse_config(int argc, char* argv[], ServerConfig& config) {
+	bool default_lanes = true;
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		bool has_value = i + 1 < argc;
+		if (arg == "--threaded") {
+			config.mode = ServerMode::THREADED;
+		} else if (arg == "--reactor") {
+			config.mode = ServerMode::REACTOR;
+		} else if (arg == "--io-threads" && has_value) {
+			config.io_threads = std::strtoul(argv[++i], nullptr, 10);
+		} else if (arg == "--io-backend" && has_value) {
+			std::string backend = argv[++i];
+			if (backend == "epoll") {
+				config.io_backend = IoBackend::EPOLL;
+			} else if (backend == "uring") {
+				config.io_backend = IoBackend::IO_URING;
+			} else {
+				app_logger.error("Unknown I/O backend: " + backend);
+				return false;
+			}
+		} else if (arg == "--acceptors" && has_value) {
+			config.listener.acceptors = std::strtoul(argv[++i], nullptr, 10);
+		} else if (arg == "--pin-acceptors") {
+			config.listener.pin_acceptors = true;
+		} else if (arg == "--workers" && has_value) {
+			config.pool.workers = std::strtoul(argv[++i], nullptr, 10);
+		} else if (arg == "--max-pending" && has_value) {
+			config.pool.max_pending = std::strtoul(argv[++i], nullptr, 10);
+		} else if (arg == "--overload" && has_value) {
+			std::string policy = argv[++i];
+			if (policy == "reject") {
+				config.pool.policy = OverloadPolicy::REJECT_NEW;
+			} else if (policy == "shed") {
+				config.pool.policy = OverloadPolicy::SHED_OLDEST;
+			} else {
+				app_logger.error("Unknown overload policy: " + policy);
+				return false;
+			}
+		} else if (arg == "--drain-timeout" && has_value) {
+			config.drain_timeout_sec = static_cast<unsigned int>(std::strtoul(argv[++i], nullptr, 10));
+		} else if (arg == "--compile-arena-mb" && has_value) {
+			config.compile_arena_bytes = std::strtoull(argv[++i], nullptr, 10) * 1024 * 1024;
+		} else if (arg == "--max-source-mb" && has_value) {
+			config.max_source_bytes = std::strtoull(argv[++i], nullptr, 10) * 1024 * 1024;
+		} else if (arg == "--compile-timeout" && has_value) {
+			config.compile_reply_timeout_sec = static_cast<unsigned int>(std::strtoul(argv[++i], nullptr, 10));
+		} else if (arg == "--compiler" && has_value) {
+			config.supervisor.compiler_path = argv[++i];
+			config.supervisor.start_compiler = true;
+		} else if (arg == "--compiler-arg" && has_value) {
+			config.supervisor.compiler_args.push_back(argv[++i]);
+		} else if (arg == "--heartbeat-timeout" && has_value) {
+			config.supervisor.heartbeat_timeout_sec = static_cast<unsigned int>(std::strtoul(argv[++i], nullptr, 10));
+		} else if (arg == "--lane" && has_value) {
+			LaneConfig lane;
+			if (!parse_lane(argv[++i], lane)) {
+				app_logger.error("Bad lane (expected NAME=EXT[,EXT...]:JOBS): " + std::string(argv[i]));
+				return false;
+			}
+			// The first --lane replaces the default lanes.
+			if (default_lanes) {
+				config.scheduler.lanes.clear();
+				default_lanes = false;
+			}
+			config.scheduler.lanes.push_back(lane);
+		} else if (arg == "--queue-timeout" && has_value) {
+			config.scheduler.queue_timeout_sec = static_cast<unsigned int>(std::strtoul(argv[++i], nullptr, 10));
+		} else if (arg == "--max-queued" && has_value) {
+			config.scheduler.max_waiting = std::strtoul(argv[++i], nullptr, 10);
+		} else if (arg == "--max-jobs" && has_value) {
+			config.jobs.max_jobs = std::strtoul(argv[++i], nullptr, 10);
+		} else if (arg == "--job-ttl" && has_value) {
+			config.jobs.result_ttl_sec = static_cast<unsigned int>(std::strtoul(argv[++i], nullptr, 10));
+		} else if (arg == "--job-store-mb" && has_value) {
+			config.jobs.max_result_bytes = std::strtoul(argv[++i], nullptr, 10) << 20;
+		} else if (arg == "--job-queue-mb" && has_value) {
+			config.jobs.max_queued_bytes = std::strtoul(argv[++i], nullptr, 10) << 20;
+		} else if (arg == "--max-job-wait" && has_value) {
+			config.jobs.max_wait_sec = static_cast<unsigned int>(std::strtoul(argv[++i], nullptr, 10));
+		} else if (arg == "--stats-interval" && has_value) {
+			config.stats_interval_sec = static_cast<unsigned int>(std::strtoul(argv[++i], nullptr, 10));
+		} else {
+			app_logger.error("Unknown or incomplete argument: " + arg);
+			return false;
+		}
+	}
+	return true;
+}
+
+int main(int argc, char* argv[]) {
+	ServerConfig config;
+	config.supervisor.compiler_path = default_compiler_path();
+	if (!parse_config(argc, argv, config)) {
+		app_logger.error(
+		    "Usage: server [--threaded | --reactor] [--io-threads N] [--io-backend epoll|uring] [--acceptors N] "
+		    "[--pin-acceptors] [--workers N] [--max-pending N] [--overload reject|shed] [--drain-timeout SEC] "
+		    "[--compile-arena-mb MB] [--max-source-mb MB] [--compile-timeout SEC] "
+		    "[--compiler PATH [--compiler-arg ARG]...] [--heartbeat-timeout SEC] [--lane NAME=EXT[,EXT...]:JOBS]... "
+		    "[--queue-timeout SEC] [--max-queued N] [--max-jobs N] [--job-ttl SEC] [--job-store-mb MB] "
+		    "[--job-queue-mb MB] [--max-job-wait SEC] [--stats-interval SEC]");
+		return 1;
+	}
+
 	app_logger.info("Main server starting...");
 	struct sigaction sa;
 	sa.sa_handler = sigint_handler;
@@ -33,27 +178,63 @@ int main() {
 		return 1;
 	}
 
-	SharedMemory shm(SHM_NAME, sizeof(CompilationSharedData), true, app_logger);
-	Semaphore sem_req(SEM_REQ_NAME, 0, app_logger);
-	Semaphore sem_resp(SEM_RESP_NAME, 0, app_logger);
-	app_logger.info("Compiler IPC (SHM, Semaphores) created.");
+	SharedMemory shm(SHM_NAME, COMPILE_ARENA_OFFSET + config.compile_arena_bytes, true, app_logger);
+	auto* compile_ring = reinterpret_cast<CompilationSharedData*>(shm.data());
+	compile_ring->max_source_size = config.max_source_bytes;
+	compile_ring->reply_timeout_sec = config.compile_reply_timeout_sec;
+	ShmArena compile_data = ShmArena::create(compile_arena(compile_ring), config.compile_arena_bytes);
+	app_logger.info("Compiler IPC (SHM) created.");
+	CompilerSupervisor supervisor(*compile_ring, compile_data, config.supervisor, app_logger);
+	supervisor.start();
+	CompileScheduler scheduler(config.scheduler, app_logger);
+	JobStore jobs(config.jobs, app_logger);
+	// Submitted jobs only get a runner once the scheduler has let them in, so one per compile slot is enough.
+	WorkerPool job_runners({scheduler.capacity(), scheduler.capacity(), OverloadPolicy::REJECT_NEW}, app_logger);
+	CompileServices services{scheduler, jobs, job_runners};
 
-	TCPServer tcp_server_instance(SERVER_PORT, app_logger);
-	tcp_server_instance.start([&](int fd) { handle_client(fd, app_logger); });
+	TCPServer tcp_server_instance(SERVER_PORT, app_logger, config.listener);
+	if (config.mode == ServerMode::THREADED) {
+		tcp_server_instance.start([&](int fd) { handle_client(fd, services, app_logger); }, config.pool);
+	} else {
+		tcp_server_instance.start([&](int fd) { return make_client_session(fd, services, app_logger); },
+		                          config.io_threads, config.pool, config.io_backend);
+	}
 
 	app_logger.info("Main server is listening on port " + std::to_string(SERVER_PORT) +
 	                ". Waiting for signal to shut down.");
 
-	while(server_is_running.load()) {
-		pause();
+	unsigned int since_stats = 0;
+	while (server_is_running.load()) {
+		if (config.stats_interval_sec == 0) {
+			pause();
+			continue;
+		}
+		sleep(1);
+		if (++since_stats >= config.stats_interval_sec) {
+			since_stats = 0;
+			app_logger.info("Worker pool: " + format_worker_stats(tcp_server_instance.workerStats()));
+			app_logger.info("Listener: " + format_listener_stats(tcp_server_instance.listenerStats()));
+			app_logger.info("Compile cache: " + format_cache_stats(compile_ring->cache));
+			app_logger.info("Object cache: " + format_cache_stats(compile_ring->objects));
+			app_logger.info("Compiler: " + format_supervisor_stats(supervisor.stats()));
+			app_logger.info("Compile lanes: " + format_scheduler_stats(scheduler.stats()));
+			app_logger.info("Compile jobs: " + format_job_stats(jobs.stats()));
+			app_logger.info("Compile arena: " + std::to_string(compile_data.used()) + " of " +
+			                std::to_string(compile_data.capacity()) + " bytes in use");
+		}
 	}
 
 	app_logger.info("Shutdown signal received. Stopping TCP server listener...");
-	tcp_server_instance.stop();
+	// Answer clients waiting on a job now rather than holding the drain up.
+	jobs.stop();
+	DrainReport drain = tcp_server_instance.stop(std::chrono::seconds(config.drain_timeout_sec));
+	app_logger.info("Connections at shutdown: " + std::to_string(drain.in_flight) + ", drained: " +
+	                std::to_string(drain.drained) + ", killed: " + std::to_string(drain.killed));
+
+	job_runners.shutdown();
+	supervisor.stop(std::chrono::seconds(config.drain_timeout_sec));
 
 	app_logger.info("Cleaning up compiler IPC resources...");
-	sem_req.unlink();
-	sem_resp.unlink();
 	shm.unlink();
 	app_logger.info("Compiler IPC resources unlinked.");
 
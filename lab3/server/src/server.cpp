@@ -1,20 +1,36 @@
 
 #include "server.hpp"
 
+#include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstring>
+#include <functional>
+#include <future>
 #include <iostream>
+#include <latch>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <semaphore>
+#include <span>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "../../subprocesses/compiler/include/compiler.hpp"
 #include "../../subprocesses/sticks_game/include/sticks_game.hpp"
+#include "Protocol.hpp"
 #include "TCPServer.hpp"
 #include "client_message_queue.hpp"
+#include "compression.hpp"
 #include "custom_exceptions.hpp"
-#include "semaphore.hpp"
 #include "shared_memory.hpp"
 
 class TCPClientConnection {
@@ -22,174 +38,1662 @@ class TCPClientConnection {
 	TCPClientConnection(int fd, Logger& log) : fd_(fd), log_(log) {}
 	~TCPClientConnection() {}
 
-	std::vector<uint8_t> receive() {
-		uint32_t net_size;
-		ssize_t recv_bytes = ::recv(fd_, &net_size, sizeof(net_size), MSG_WAITALL);
-		if (recv_bytes == 0) throw TransmissionException("Client disconnected while waiting for header.");
-		if (recv_bytes != sizeof(net_size)) {
+	// Returns nullopt when the client closed the connection between frames.
+	std::optional<FrameHeader> receive_header() {
+		uint8_t raw[FRAME_HEADER_SIZE];
+		ssize_t recv_bytes = ::recv(fd_, raw, sizeof(raw), MSG_WAITALL);
+		if (recv_bytes == 0) {
+			return std::nullopt;
+		}
+		if (recv_bytes != sizeof(raw)) {
 			log_.error("recv header failed: " + std::string(strerror(errno)) + ", received " +
 			           std::to_string(recv_bytes));
 			throw TransmissionException("recv header failed");
 		}
-		auto size = ntohl(net_size);
-		if (size > 1024 * 1024 * 20) {
-			log_.error("Declared payload size too large: " + std::to_string(size));
+		FrameHeader header = decode_frame_header(raw);
+		if (header.payload_len > MAX_FRAME_SIZE) {
+			log_.error("Declared payload size too large: " + std::to_string(header.payload_len));
 			throw TransmissionException("Declared payload size too large");
 		}
-		std::vector<uint8_t> buf(size);
-		if (size > 0) {
-			recv_bytes = ::recv(fd_, buf.data(), size, MSG_WAITALL);
-			if (recv_bytes == 0) throw TransmissionException("Client disconnected while waiting for payload.");
-			if (recv_bytes != static_cast<ssize_t>(size)) {
-				log_.error("recv payload failed: " + std::string(strerror(errno)) + ", received " +
-				           std::to_string(recv_bytes) + " expected " + std::to_string(size));
-				throw TransmissionException("recv payload failed");
+		return header;
+	}
+
+	// The returned view stays valid until the next receive_payload() on this connection.
+	std::span<const uint8_t> receive_payload(const FrameHeader& header) {
+		frame_.reset(header.payload_len);
+		receive_exact(frame_.data(), header.payload_len);
+		return frame_.view();
+	}
+
+	// Receives the payload into a buffer of its own, for keeping past the next frame.
+	PooledBuffer receive_buffer(const FrameHeader& header) {
+		PooledBuffer buffer = BufferPool::shared().acquire(header.payload_len);
+		receive_exact(buffer.data(), header.payload_len);
+		return buffer;
+	}
+
+	// Reads the payload straight into dest (e.g. shared memory).
+	void receive_payload_into(const FrameHeader& header, std::span<uint8_t> dest) {
+		if (header.payload_len > dest.size()) {
+			log_.error("Frame of " + std::to_string(header.payload_len) + " bytes does not fit into " +
+			           std::to_string(dest.size()) + " remaining bytes");
+			throw TransmissionException("Frame larger than destination buffer");
+		}
+		receive_exact(dest.data(), header.payload_len);
+	}
+
+	// Writes the header and the payload with a single sendmsg, continuing after short writes. payload may point
+	// straight into shared memory.
+	void send(FrameHeader header, std::span<const uint8_t> payload) {
+		header.payload_len = static_cast<uint32_t>(payload.size());
+		uint8_t raw[FRAME_HEADER_SIZE];
+		encode_frame_header(header, raw);
+		iovec iov[2] = {{raw, sizeof(raw)}, {const_cast<uint8_t*>(payload.data()), payload.size()}};
+		msghdr msg{};
+		msg.msg_iov = iov;
+		msg.msg_iovlen = payload.empty() ? 1 : 2;
+		size_t remaining = sizeof(raw) + payload.size();
+		while (remaining > 0) {
+			ssize_t sent = ::sendmsg(fd_, &msg, MSG_NOSIGNAL);
+			if (sent < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				log_.error("send frame failed: " + std::string(strerror(errno)) + ", " + std::to_string(remaining) +
+				           " bytes left");
+				throw TransmissionException("send frame failed");
 			}
+			remaining -= static_cast<size_t>(sent);
+			size_t written = static_cast<size_t>(sent);
+			while (written > 0) {
+				if (written >= msg.msg_iov->iov_len) {
+					written -= msg.msg_iov->iov_len;
+					++msg.msg_iov;
+					--msg.msg_iovlen;
+				} else {
+					msg.msg_iov->iov_base = static_cast<uint8_t*>(msg.msg_iov->iov_base) + written;
+					msg.msg_iov->iov_len -= written;
+					written = 0;
+				}
+			}
+		}
+	}
+
+   private:
+	void receive_exact(uint8_t* dest, uint32_t size) {
+		if (size == 0) {
+			return;
 		}
-		return buf;
+		ssize_t recv_bytes = ::recv(fd_, dest, size, MSG_WAITALL);
+		if (recv_bytes == 0) throw TransmissionException("Client disconnected while waiting for payload.");
+		if (recv_bytes != static_cast<ssize_t>(size)) {
+			log_.error("recv payload failed: " + std::string(strerror(errno)) + ", received " +
+			           std::to_string(recv_bytes) + " expected " + std::to_string(size));
+			throw TransmissionException("recv payload failed");
+		}
+	}
+
+	int fd_;
+	Logger& log_;
+	PooledBuffer frame_;
+};
+
+namespace {
+
+// Malformed request from the client; answered with Status::BAD_REQUEST.
+class BadRequest : public std::runtime_error {
+   public:
+	explicit BadRequest(const std::string& msg) : std::runtime_error(msg) {}
+};
+
+// A shared resource is used up for now; answered with Status::SERVER_BUSY so the client can retry.
+class ServerBusy : public std::runtime_error {
+   public:
+	explicit ServerBusy(const std::string& msg) : std::runtime_error(msg) {}
+};
+
+using ResultSink = std::function<void(Status status, std::span<const uint8_t> result)>;
+
+// What a COMPILE frame asks for.
+struct CompileRequest {
+	std::string filename;
+	uint8_t priority = 0;
+	// The file arrives as a zlib stream.
+	bool compressed = false;
+};
+
+constexpr size_t REPLY_CHUNK_SIZE = 64 * 1024;
+// Shorter replies go out as they are; deflating them saves next to nothing.
+constexpr size_t MIN_COMPRESSED_REPLY = 512;
+
+using FrameSink = std::function<void(FrameHeader header, std::vector<uint8_t>&& payload)>;
+
+// Identifies a client connection to the compile scheduler.
+std::atomic<uint64_t> next_client_id(1);
+
+// How often a claim stuck on a full ring looks for abandoned slots whose job has ended since.
+constexpr std::chrono::milliseconds REAP_INTERVAL(500);
+
+// This process's handle on the compiler's job ring, opened on first use and kept for the life of the server.
+// free_slots counts slots nobody in this process is using.
+class CompileRing {
+   public:
+	explicit CompileRing(Logger& log)
+	    : log_(log),
+	      shm_(SHM_NAME, 0, false, log),
+	      data_(reinterpret_cast<CompilationSharedData*>(shm_.data())),
+	      arena_(ShmArena::attach(compile_arena(data_))),
+	      free_slots_(COMPILE_RING_SLOTS) {}
+
+	static CompileRing& instance(Logger& log) {
+		static CompileRing ring(log);
+		return ring;
 	}
-	void send(const std::vector<uint8_t>& data) {
-		uint32_t net_size = htonl(data.size());
-		if (::send(fd_, &net_size, sizeof(net_size), 0) != sizeof(net_size)) {
-			log_.error("send header failed: " + std::string(strerror(errno)));
-			throw TransmissionException("send header failed");
+
+	// Blocks until a slot is free and marks it FILLING. Every claimer holds a count of free_slots, so the scan finds
+	// a free slot unless the ring's states have been changed behind this process's back; that is reported rather
+	// than waited out.
+	size_t claim() {
+		reap();
+		while (!free_slots_.try_acquire_for(REAP_INTERVAL)) {
+			reap();
 		}
-		if (!data.empty()) {
-			if (::send(fd_, data.data(), data.size(), 0) != static_cast<ssize_t>(data.size())) {
-				log_.error("send payload failed: " + std::string(strerror(errno)));
-				throw TransmissionException("send payload failed");
+		for (size_t i = 0; i < COMPILE_RING_SLOTS; ++i) {
+			CompileStatus expected = CompileStatus::NONE;
+			if (data_->slots[i].status.compare_exchange_strong(expected, CompileStatus::FILLING,
+			                                                     std::memory_order_acq_rel)) {
+				return i;
 			}
 		}
+		free_slots_.release();
+		log_.error("Compile ring has no free slot although one is counted free");
+		throw IPCException("Compile ring slots and their free count disagree");
+	}
+
+	// Frees the slot and whatever regions it still names.
+	void release(size_t index) {
+		CompileSlot& job = data_->slots[index];
+		arena_.free(job.file_offset);
+		arena_.free(job.result_offset);
+		job.file_offset = ShmArena::NONE;
+		job.result_offset = ShmArena::NONE;
+		job.status.store(CompileStatus::NONE, std::memory_order_release);
+		free_slots_.release();
+	}
+
+	CompileSlot& slot(size_t index) { return data_->slots[index]; }
+	ShmArena& arena() { return arena_; }
+	size_t max_source_size() const { return data_->max_source_size; }
+
+	void submit(size_t index) {
+		CompileSlot& job = data_->slots[index];
+		job.ticket = data_->next_ticket.fetch_add(1, std::memory_order_relaxed) + 1;
+		job.status.store(CompileStatus::PENDING, std::memory_order_release);
+		data_->requests.post();
+	}
+
+	// Waits for the compiler to finish the job; false once reply_timeout_sec has passed without an answer.
+	bool wait(size_t index) {
+		if (data_->reply_timeout_sec == 0) {
+			data_->slots[index].done.wait();
+			return true;
+		}
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(data_->reply_timeout_sec);
+		return data_->slots[index].done.wait_until(deadline);
+	}
+
+	// Takes back a job the compiler has not started yet, leaving the slot FILLING.
+	bool withdraw(size_t index) {
+		CompileStatus expected = CompileStatus::PENDING;
+		return data_->slots[index].status.compare_exchange_strong(expected, CompileStatus::FILLING,
+		                                                          std::memory_order_acq_rel);
+	}
+
+	unsigned int reply_timeout_sec() const { return data_->reply_timeout_sec; }
+
+	// Takes over a slot whose waiter gave up while the compiler still had the job. It is released once the compiler
+	// posts done, or the supervisor does on failing the job.
+	void abandon(size_t index) {
+		std::lock_guard lock(abandoned_mutex_);
+		abandoned_.push_back(index);
 	}
 
    private:
-	int fd_;
+	void reap() {
+		std::lock_guard lock(abandoned_mutex_);
+		std::erase_if(abandoned_, [this](size_t index) {
+			if (!data_->slots[index].done.try_wait()) {
+				return false;
+			}
+			release(index);
+			log_.info("Compile slot " + std::to_string(index) + " reclaimed after its abandoned job ended");
+			return true;
+		});
+	}
+
 	Logger& log_;
+	SharedMemory shm_;
+	CompilationSharedData* data_;
+	ShmArena arena_;
+	std::counting_semaphore<COMPILE_RING_SLOTS> free_slots_;
+	std::mutex abandoned_mutex_;
+	std::vector<size_t> abandoned_;
 };
 
-void handle_client(int client_fd, Logger& log) {
-	log.info("Handling new client on fd: " + std::to_string(client_fd));
-	TCPClientConnection conn(client_fd, log);
+// Waits for the job's turn in the scheduler.
+CompileAdmission admit_compile(CompileScheduler& scheduler, const CompileRequest& request, uint64_t client) {
+	size_t lane = scheduler.laneFor(request.filename);
+	CompileAdmission admission = scheduler.admit(lane, client, request.priority);
+	if (!admission) {
+		throw ServerBusy("No room in the " + scheduler.laneName(lane) + " lane for " + request.filename);
+	}
+	return admission;
+}
+
+// Streams a source file into a slot of the compiler's job ring as it arrives and hands back the result. The job's
+// place in the scheduler and the slot are held from construction until destruction. The source grows in the ring's
+// shared arena as it arrives.
+class CompileUpload {
+   public:
+	CompileUpload(const CompileRequest& request, CompileAdmission admission, Logger& log)
+	    : filename_(request.filename), log_(log), ring_(CompileRing::instance(log)), admission_(std::move(admission)),
+	      index_(0), slot_(nullptr), size_(0), capacity_(0), submitted_(false) {
+		const std::string& filename = request.filename;
+		if (request.compressed) {
+			inflater_ = std::make_unique<Inflater>();
+		}
+		index_ = ring_.claim();
+		slot_ = &ring_.slot(index_);
+		log_.debug("Compile slot " + std::to_string(index_) + " claimed for " + filename_);
+		std::strncpy(slot_->file_name, filename.c_str(), MAX_FILE_NAME - 1);
+		slot_->file_name[MAX_FILE_NAME - 1] = '\0';
+		slot_->file_offset = ShmArena::NONE;
+		slot_->file_size = 0;
+		slot_->result_offset = ShmArena::NONE;
+		slot_->result_size = 0;
+	}
+
+	~CompileUpload() {
+		if (submitted_) {
+			// The compiler may still write into the slot; it is not safe to hand it out again until the job ends.
+			log_.error("Compile slot " + std::to_string(index_) + " abandoned while its job is in flight");
+			ring_.abandon(index_);
+			return;
+		}
+		ring_.release(index_);
+	}
 
+	CompileUpload(const CompileUpload&) = delete;
+	CompileUpload& operator=(const CompileUpload&) = delete;
+
+	// Makes room for more bytes of source. The region at least doubles when it has to move, so a file that
+	// arrives in many parts is copied a bounded number of times.
+	void reserve(size_t more) {
+		size_t limit = ring_.max_source_size();
+		if (more > limit - size_) {
+			throw BadRequest("File exceeds the " + std::to_string(limit) + " byte source limit");
+		}
+		size_t needed = size_ + more;
+		if (needed <= capacity_) {
+			return;
+		}
+		size_t capacity = std::min(std::max({needed, capacity_ * 2, MIN_SOURCE_REGION}), limit);
+		ShmArena& arena = ring_.arena();
+		uint64_t offset = arena.allocate(capacity);
+		if (offset == ShmArena::NONE) {
+			throw ServerBusy("Compile arena has no room for " + std::to_string(capacity) + " bytes");
+		}
+		if (size_ > 0) {
+			std::memcpy(arena.at(offset), arena.at(slot_->file_offset), size_);
+		}
+		arena.free(slot_->file_offset);
+		slot_->file_offset = offset;
+		capacity_ = capacity;
+	}
+
+	// Free part of the source region; reserve() it, fill it and call commit() to avoid an intermediate copy.
+	std::span<uint8_t> remaining() {
+		if (capacity_ == 0) {
+			return {};
+		}
+		return {ring_.arena().at(slot_->file_offset) + size_, capacity_ - size_};
+	}
+
+	void commit(size_t written) { size_ += written; }
+
+	// A compressed upload has to go through append(); reserve() and remaining() are for plain ones.
+	bool compressed() const { return inflater_ != nullptr; }
+
+	// Adds the next part of the file as received, decompressing it first when the upload is compressed.
+	void append(std::span<const uint8_t> chunk) {
+		if (inflater_) {
+			inflate(chunk);
+			return;
+		}
+		reserve(chunk.size());
+		std::memcpy(remaining().data(), chunk.data(), chunk.size());
+		size_ += chunk.size();
+	}
+
+	// The compiled binary, or the compiler's diagnostics on failure, is handed to sink while it still sits in the
+	// shared memory segment, so a blocking caller can write it to the socket without copying it first.
+	void finish(const ResultSink& sink) {
+		if (inflater_ && !inflater_->done()) {
+			throw BadRequest("Compressed upload of " + filename_ + " ends before its stream does");
+		}
+		slot_->file_size = size_;
+		log_.info("Compile request for " + filename_ + " (" + std::to_string(size_) + " bytes) in slot " +
+		          std::to_string(index_));
+		submitted_ = true;
+		ring_.submit(index_);
+		log_.debug("Waiting for compiler response for " + filename_);
+		if (!ring_.wait(index_)) {
+			std::string timeout = std::to_string(ring_.reply_timeout_sec()) + " s";
+			if (ring_.withdraw(index_)) {
+				submitted_ = false;
+				throw IPCException("Compiler did not pick up " + filename_ + " within " + timeout);
+			}
+			throw IPCException("Compiler did not finish " + filename_ + " within " + timeout);
+		}
+		submitted_ = false;
+		log_.debug("Compiler response received for " + filename_);
+
+		std::span<const uint8_t> result;
+		if (slot_->result_offset != ShmArena::NONE) {
+			result = {ring_.arena().at(slot_->result_offset), slot_->result_size};
+		}
+		if (slot_->status.load(std::memory_order_acquire) == CompileStatus::SUCCESS) {
+			log_.info("Compiled result ready for " + filename_);
+			sink(Status::OK, result);
+			return;
+		}
+		log_.error("Compilation failed for " + filename_ + ", reported by subserver.");
+		sink(Status::COMPILATION_FAILED, result);
+	}
+
+   private:
+	static constexpr size_t MIN_SOURCE_REGION = 64 * 1024;
+
+	// Decompresses straight into the source region, growing it as output comes out.
+	void inflate(std::span<const uint8_t> chunk) {
+		try {
+			while (!inflater_->done()) {
+				if (remaining().empty()) {
+					size_t room = ring_.max_source_size() - size_;
+					if (room == 0) {
+						throw BadRequest("Decompressed file exceeds the " + std::to_string(ring_.max_source_size()) +
+						                 " byte source limit");
+					}
+					reserve(std::min(std::max(chunk.size() * 4, MIN_SOURCE_REGION), room));
+				}
+				std::span<uint8_t> out = remaining();
+				CodecStep step = inflater_->inflate(chunk, out);
+				chunk = chunk.subspan(step.consumed);
+				size_ += step.produced;
+				if (chunk.empty() && step.produced < out.size()) {
+					break;
+				}
+			}
+		} catch (const CompressionException& ex) {
+			throw BadRequest("Compressed upload of " + filename_ + " is corrupt: " + ex.what());
+		}
+		if (!chunk.empty()) {
+			throw BadRequest("Data after the end of the compressed upload of " + filename_);
+		}
+	}
+
+	std::string filename_;
+	Logger& log_;
+	CompileRing& ring_;
+	// Given back only after the destructor has released the slot.
+	CompileAdmission admission_;
+	size_t index_;
+	CompileSlot* slot_;
+	size_t size_;
+	size_t capacity_;
+	bool submitted_;
+	std::unique_ptr<Inflater> inflater_;
+};
+
+// Sends result as a zlib stream cut into frames of at most REPLY_CHUNK_SIZE bytes, all but the last flagged
+// FLAG_MORE. It is deflated straight out of shared memory, one frame at a time.
+void send_compressed(FrameHeader header, std::span<const uint8_t> result, const FrameSink& send) {
+	Deflater deflater;
+	while (!deflater.done()) {
+		std::vector<uint8_t> chunk(REPLY_CHUNK_SIZE);
+		size_t produced = 0;
+		while (produced < chunk.size() && !deflater.done()) {
+			CodecStep step = deflater.deflate(result, std::span(chunk).subspan(produced), true);
+			result = result.subspan(step.consumed);
+			produced += step.produced;
+		}
+		chunk.resize(produced);
+		header.flags = FLAG_COMPRESSED | (deflater.done() ? 0 : FLAG_MORE);
+		send(header, std::move(chunk));
+	}
+}
+
+bool compress_reply(uint8_t reply_encoding, std::span<const uint8_t> result) {
+	return (reply_encoding & ENCODING_DEFLATE) && result.size() >= MIN_COMPRESSED_REPLY;
+}
+
+// Answers a HELLO with the encoding replies on the connection will use.
+uint8_t negotiate_encoding(std::span<const uint8_t> payload) {
+	if (payload.size() != sizeof(uint8_t)) {
+		throw BadRequest("HELLO payload must be one byte");
+	}
+	return payload[0] & ENCODING_DEFLATE;
+}
+
+// Splits a COMPILE payload into the request and the leading part of the file.
+std::span<const uint8_t> parse_compile_request(const FrameHeader& header, std::span<const uint8_t> payload,
+                                               CompileRequest& request) {
+	if (header.flags & FLAG_PRIORITY) {
+		if (payload.empty()) {
+			throw BadRequest("COMPILE priority missing");
+		}
+		request.priority = payload[0];
+		payload = payload.subspan(1);
+	}
+	request.compressed = header.flags & FLAG_COMPRESSED;
+	if (payload.size() < sizeof(uint16_t)) {
+		throw BadRequest("COMPILE payload too short");
+	}
+	size_t name_len = get_be16(payload.data());
+	if (payload.size() < sizeof(uint16_t) + name_len || name_len == 0) {
+		throw BadRequest("COMPILE file name is empty or truncated");
+	}
+	if (name_len >= MAX_FILE_NAME) {
+		throw BadRequest("Filename too long");
+	}
+	request.filename.assign(payload.begin() + sizeof(uint16_t), payload.begin() + sizeof(uint16_t) + name_len);
+	return payload.subspan(sizeof(uint16_t) + name_len);
+}
+
+// One file of a BATCH: its entry in the manifest and, once the upload is complete, where its bytes are among the
+// received parts.
+struct BatchFile {
+	CompileRequest job;
+	size_t size = 0;
+	std::vector<std::span<const uint8_t>> pieces;
+};
+
+// Splits the first BATCH frame into the manifest and the leading part of the files' data.
+std::span<const uint8_t> parse_batch_manifest(const FrameHeader& header, std::span<const uint8_t> payload,
+                                              std::vector<BatchFile>& files) {
+	uint8_t priority = 0;
+	if (header.flags & FLAG_PRIORITY) {
+		if (payload.empty()) {
+			throw BadRequest("BATCH priority missing");
+		}
+		priority = payload[0];
+		payload = payload.subspan(1);
+	}
+	if (payload.size() < sizeof(uint16_t)) {
+		throw BadRequest("BATCH payload too short");
+	}
+	size_t count = get_be16(payload.data());
+	payload = payload.subspan(sizeof(uint16_t));
+	if (count == 0 || count > MAX_BATCH_FILES) {
+		throw BadRequest("BATCH must name 1 to " + std::to_string(MAX_BATCH_FILES) + " files");
+	}
+	files.resize(count);
+	for (BatchFile& file : files) {
+		size_t name_len = payload.size() < sizeof(uint16_t) ? 0 : get_be16(payload.data());
+		if (name_len == 0 || payload.size() < sizeof(uint16_t) + name_len + sizeof(uint32_t)) {
+			throw BadRequest("BATCH manifest is truncated or names an empty file name");
+		}
+		if (name_len >= MAX_FILE_NAME) {
+			throw BadRequest("Filename too long");
+		}
+		file.job.filename.assign(payload.begin() + sizeof(uint16_t), payload.begin() + sizeof(uint16_t) + name_len);
+		file.job.priority = priority;
+		file.job.compressed = header.flags & FLAG_COMPRESSED;
+		file.size = get_be32(payload.data() + sizeof(uint16_t) + name_len);
+		payload = payload.subspan(sizeof(uint16_t) + name_len + sizeof(uint32_t));
+	}
+	return payload;
+}
+
+// A COMPILE, SUBMIT or BATCH whose COMPILE_DATA frames are still arriving, or a job waiting for its turn. Parts are
+// kept as received and copied into a compile slot once the job may run, so uploads that trickle in and queued jobs
+// do not hold a slot meanwhile.
+struct PendingUpload {
+	FrameHeader request;
+	CompileRequest job;
+	// BATCH only; job is unused then.
+	std::vector<BatchFile> files;
+	std::vector<PooledBuffer> parts;
+	size_t data_offset = 0;
+	size_t size = 0;
+};
+
+// Takes the first frame of an upload.
+void begin_upload(PendingUpload& upload, const FrameHeader& header, PooledBuffer&& payload) {
+	upload.request = header;
+	auto data = header.opcode == Opcode::BATCH ? parse_batch_manifest(header, payload.view(), upload.files)
+	                                           : parse_compile_request(header, payload.view(), upload.job);
+	upload.data_offset = static_cast<size_t>(data.data() - payload.data());
+	upload.size = data.size();
+	upload.parts.push_back(std::move(payload));
+}
+
+// Copies a complete upload into its slot, dropping the received parts.
+void fill(CompileUpload& slot, PendingUpload& upload) {
+	if (!slot.compressed()) {
+		slot.reserve(upload.size);
+	}
+	slot.append(upload.parts.front().view().subspan(upload.data_offset));
+	for (size_t i = 1; i < upload.parts.size(); ++i) {
+		slot.append(upload.parts[i].view());
+	}
+	upload.parts.clear();
+}
+
+// What an admitted job came to; failures come back as their Status with no output.
+struct JobOutcome {
+	Status status = Status::SERVER_ERROR;
+	std::vector<uint8_t> result;
+};
+
+// Runs body, which compiles job, and turns what it throws into the Status of the outcome.
+template <typename Fn>
+JobOutcome run_job(const CompileRequest& job, Fn&& body, Logger& log) {
+	JobOutcome outcome;
 	try {
-		auto cmd_buf = conn.receive();
-		std::string cmd(cmd_buf.begin(), cmd_buf.end());
-		log.debug("Received command: " + cmd + " from fd: " + std::to_string(client_fd));
-		long game_session_id = static_cast<long>(client_fd);
-		if (cmd == "COMPILE") {
-			auto name_buf = conn.receive();
-			std::string filename(name_buf.begin(), name_buf.end());
-			auto file_buf = conn.receive();
-
-			log.info("Compile request for '" + filename + "' (" + std::to_string(file_buf.size()) + " bytes)");
-
-			SharedMemory shm(SHM_NAME, sizeof(CompilationSharedData), false, log);
-			Semaphore sem_req(SEM_REQ_NAME, 0, log);
-			Semaphore sem_resp(SEM_RESP_NAME, 0, log);
-			auto data = reinterpret_cast<CompilationSharedData*>(shm.data());
-
-			if (file_buf.size() > MAX_FILE_SIZE) {
-				throw std::runtime_error("File too large for compilation SHM buffer");
-			}
-			if (filename.length() >= MAX_FILE_NAME) {
-				throw std::runtime_error("Filename too long");
-			}
-
-			data->status = CompileStatus::PENDING;
-			std::strncpy(data->file_name, filename.c_str(), MAX_FILE_NAME - 1);
-			data->file_name[MAX_FILE_NAME - 1] = '\0';
-			data->file_size = static_cast<uint32_t>(file_buf.size());
-			std::memcpy(data->file_data, file_buf.data(), file_buf.size());
-
-			log.info("Compile request for " + filename);
-			sem_req.post();
-			log.debug("Waiting for compiler response for " + filename);
-			sem_resp.wait();
-			log.debug("Compiler response received for " + filename);
-
-			if (data->status == CompileStatus::SUCCESS) {
-				if (data->result_size > MAX_RESULT_SIZE) {
-					log.error("Result size " + std::to_string(data->result_size) + " exceeds MAX_RESULT_SIZE for " +
-					          filename);
-					throw std::runtime_error("Compiled result too large from SHM");
+		body(outcome);
+	} catch (const BadRequest& ex) {
+		log.error("Bad request for " + job.filename + ": " + ex.what());
+		outcome.status = Status::BAD_REQUEST;
+	} catch (const ServerBusy& ex) {
+		log.warning("Busy for " + job.filename + ": " + ex.what());
+		outcome.status = Status::SERVER_BUSY;
+	} catch (const IPCException& ex) {
+		log.error("IPCException for " + job.filename + ": " + ex.what());
+		outcome.status = Status::SERVER_IPC_ERROR;
+	} catch (const std::exception& ex) {
+		log.error("Building " + job.filename + " failed: " + ex.what());
+		outcome.status = Status::SERVER_ERROR;
+	}
+	return outcome;
+}
+
+// Hands the slot's job to the compiler and keeps what comes back.
+void finish_into(CompileUpload& slot, JobOutcome& outcome) {
+	slot.finish([&outcome](Status status, std::span<const uint8_t> output) {
+		outcome.status = status;
+		outcome.result.assign(output.begin(), output.end());
+	});
+}
+
+JobOutcome build_admitted(const CompileRequest& job, CompileAdmission admission,
+                          const std::function<void(CompileUpload&)>& fill_slot, Logger& log) {
+	return run_job(
+	    job,
+	    [&](JobOutcome& outcome) {
+		    CompileUpload slot(job, std::move(admission), log);
+		    fill_slot(slot);
+		    finish_into(slot, outcome);
+	    },
+	    log);
+}
+
+// Queues a job in the scheduler without holding a thread; once it is let in, build runs on the job runners.
+// dropped is called instead when the lane is full, the job waits too long, the runners refuse it, or it is
+// withdrawn because its client has gone. A detached job stays queued after its client has gone.
+void when_admitted(CompileServices& services, const CompileRequest& job, uint64_t client, bool detached,
+                   std::function<void(CompileAdmission)> build, std::function<void()> dropped) {
+	size_t lane = services.scheduler.laneFor(job.filename);
+	auto on_admit = [&services, build = std::move(build), dropped](CompileAdmission admission) {
+		if (!admission) {
+			dropped();
+			return;
+		}
+		auto admitted = std::make_shared<CompileAdmission>(std::move(admission));
+		if (!services.runners.submit([build, admitted]() { build(std::move(*admitted)); }, dropped)) {
+			dropped();
+		}
+	};
+	if (!services.scheduler.admitAsync(lane, client, job.priority, detached, std::move(on_admit))) {
+		dropped();
+	}
+}
+
+// Bytes a reactor connection may hold in received parts of uploads still arriving and of compiles waiting for their
+// turn. Shared with the uploads charged to it, which can outlive the connection.
+class UploadBudget {
+   public:
+	explicit UploadBudget(size_t limit) : used_(0), limit_(limit) {}
+
+	// False, charging nothing, when bytes would go past the limit.
+	bool charge(size_t bytes) {
+		size_t used = used_.load(std::memory_order_relaxed);
+		do {
+			if (bytes > limit_ - used) {
+				return false;
+			}
+		} while (!used_.compare_exchange_weak(used, used + bytes, std::memory_order_relaxed));
+		return true;
+	}
+
+	void refund(size_t bytes) { used_.fetch_sub(bytes, std::memory_order_relaxed); }
+
+   private:
+	std::atomic<size_t> used_;
+	size_t limit_;
+};
+
+constexpr size_t UPLOAD_BUDGET_BYTES = 32 * 1024 * 1024;
+// Uploads one reactor connection may have arriving at once.
+constexpr size_t MAX_UPLOADS_PER_CONNECTION = 16;
+// Refused uploads whose remaining parts are still to be skipped; a client that runs past it is dropped.
+constexpr size_t MAX_REFUSED_UPLOADS = 64;
+
+// Bytes of the received parts of an upload, as charged to its budget.
+size_t parts_bytes(const PendingUpload& upload) {
+	size_t total = 0;
+	for (const PooledBuffer& part : upload.parts) {
+		total += part.size();
+	}
+	return total;
+}
+
+// A reactor COMPILE whose parts may still be arriving. Parts received while the job waits for its turn are kept,
+// charged to the connection's budget; once it holds a slot they are copied in and later parts go straight into the
+// slot as they arrive. The job is built on the job runners once its last part is in, and reply is called exactly
+// once with its outcome.
+class StreamedCompile : public std::enable_shared_from_this<StreamedCompile> {
+   public:
+	using Reply = std::function<void(Status status, std::span<const uint8_t> result)>;
+
+	StreamedCompile(const FrameHeader& request, const CompileRequest& job, std::shared_ptr<UploadBudget> budget,
+	                CompileServices& services, Reply reply, Logger& log)
+	    : budget_(std::move(budget)),
+	      services_(services),
+	      reply_(std::move(reply)),
+	      log_(log),
+	      charged_(0),
+	      complete_(false),
+	      done_(false) {
+		upload_.request = request;
+		upload_.job = job;
+	}
+
+	~StreamedCompile() { budget_->refund(charged_); }
+
+	StreamedCompile(const StreamedCompile&) = delete;
+	StreamedCompile& operator=(const StreamedCompile&) = delete;
+
+	const FrameHeader& request() const { return upload_.request; }
+
+	// Bytes of the file received so far.
+	size_t size() const {
+		std::lock_guard lock(mutex_);
+		return upload_.size;
+	}
+
+	// Queues the job in the scheduler, unless its first part has already been refused.
+	void start(uint64_t client) {
+		{
+			std::lock_guard lock(mutex_);
+			if (done_) {
+				return;
+			}
+		}
+		auto self = shared_from_this();
+		when_admitted(
+		    services_, upload_.job, client, false,
+		    [self](CompileAdmission admission) { self->admitted(std::move(admission)); },
+		    [self]() { self->fail(Status::SERVER_BUSY); });
+	}
+
+	// Takes the next part on the I/O thread, the file's bytes starting at offset; last is true for the final one.
+	// Parts of a job that has already been answered are dropped.
+	void add(PooledBuffer&& part, size_t offset, bool last) {
+		std::unique_ptr<CompileUpload> ready;
+		Status failed = Status::OK;
+		{
+			std::lock_guard lock(mutex_);
+			if (done_) {
+				return;
+			}
+			upload_.size += part.size() - offset;
+			complete_ = last;
+			if (slot_) {
+				failed = appendLocked(part.view().subspan(offset));
+				if (failed == Status::OK && last) {
+					ready = std::move(slot_);
+					done_ = true;
+				}
+			} else if (budget_->charge(part.size())) {
+				charged_ += part.size();
+				if (offset > 0) {
+					upload_.data_offset = offset;
 				}
-				std::vector<uint8_t> out(data->result_data, data->result_data + data->result_size);
-				conn.send(out);
-				log.info("Sent compiled result to client for " + filename);
+				upload_.parts.push_back(std::move(part));
 			} else {
-				std::string err_msg = "COMPILATION_FAILED";
-				conn.send(std::vector<uint8_t>(err_msg.begin(), err_msg.end()));
-				log.error("Compilation failed for " + filename + ", reported by subserver.");
-			}
-		} else if (cmd == "PLAY") {
-			log.info("Play game request from fd: " + std::to_string(client_fd));
-			ClientMessageQueue mq(log);
-
-			while (true) {
-				auto move_buf = conn.receive();
-				if (move_buf.size() != sizeof(int)) {
-					log.error("PLAY: Invalid move size from client. Expected " + std::to_string(sizeof(int)) + " got " +
-					          std::to_string(move_buf.size()));
-					throw TransmissionException("Invalid move size from client");
+				log_.warning("Upload of " + upload_.job.filename + " is over its connection's budget of " +
+				             std::to_string(UPLOAD_BUDGET_BYTES) + " bytes for uploads");
+				failed = Status::SERVER_BUSY;
+			}
+		}
+		if (failed != Status::OK) {
+			fail(failed);
+			return;
+		}
+		if (ready) {
+			auto self = shared_from_this();
+			auto slot = std::shared_ptr<CompileUpload>(std::move(ready));
+			if (!services_.runners.submit([self, slot]() { self->build(*slot); },
+			                              [self]() { self->reply_(Status::SERVER_BUSY, {}); })) {
+				reply_(Status::SERVER_BUSY, {});
+			}
+		}
+	}
+
+	// Answers the job with status unless it has been answered or handed to the compiler already.
+	void fail(Status status) {
+		std::unique_ptr<CompileUpload> slot;
+		{
+			std::lock_guard lock(mutex_);
+			if (done_) {
+				return;
+			}
+			done_ = true;
+			budget_->refund(charged_);
+			charged_ = 0;
+			upload_.parts.clear();
+			slot = std::move(slot_);
+		}
+		// Gives the slot and the lane place back before the client hears of it.
+		slot.reset();
+		reply_(status, {});
+	}
+
+   private:
+	// On a job runner: claims the slot and copies in what has arrived meanwhile. The job is built right away when
+	// its last part is in already; otherwise the slot is kept for the parts still to come.
+	void admitted(CompileAdmission admission) {
+		{
+			std::lock_guard lock(mutex_);
+			if (done_) {
+				return;
+			}
+		}
+		std::unique_ptr<CompileUpload> slot;
+		bool ready = false;
+		JobOutcome claimed = run_job(
+		    upload_.job,
+		    [&](JobOutcome& outcome) {
+			    slot = std::make_unique<CompileUpload>(upload_.job, std::move(admission), log_);
+			    ready = drain(slot);
+			    outcome.status = Status::OK;
+		    },
+		    log_);
+		if (claimed.status != Status::OK) {
+			slot.reset();
+			fail(claimed.status);
+			return;
+		}
+		if (ready) {
+			build(*slot);
+		}
+	}
+
+	// Copies the kept parts into slot until none are left. Returns true when the upload is complete and the job is
+	// now this caller's to build; otherwise slot has been handed to slot_, or dropped because the job was answered.
+	bool drain(std::unique_ptr<CompileUpload>& slot) {
+		while (true) {
+			std::vector<PooledBuffer> parts;
+			size_t offset;
+			{
+				std::lock_guard lock(mutex_);
+				if (done_) {
+					slot.reset();
+					return false;
+				}
+				if (upload_.parts.empty()) {
+					if (complete_) {
+						done_ = true;
+						return true;
+					}
+					slot_ = std::move(slot);
+					return false;
 				}
-				int client_take;
-				std::memcpy(&client_take, move_buf.data(), sizeof(int));
-				log.debug("PLAY: Client wants to take " + std::to_string(client_take) + " sticks.");
-
-				mq.send_request(game_session_id, client_take);
-				GameResponse game_resp = mq.receive_response(game_session_id);
-
-				log.debug("PLAY: Subserver response: server_took=" + std::to_string(game_resp.taken) + ", client_won=" +
-				          (game_resp.client_won ? "T" : "F") + ", server_won=" + (game_resp.server_won ? "T" : "F") +
-				          ", Sticks left: " + std::to_string(game_resp.remaining_sticks));
-
-				std::vector<uint8_t> out_buf(sizeof(int) + sizeof(uint8_t) + sizeof(uint8_t) + sizeof(int));
-				size_t offset = 0;
-				std::memcpy(out_buf.data() + offset, &game_resp.taken, sizeof(int));
-				offset += sizeof(int);
-				out_buf[offset++] = static_cast<uint8_t>(game_resp.client_won);
-				out_buf[offset++] = static_cast<uint8_t>(game_resp.server_won);
-				std::memcpy(out_buf.data() + offset, &game_resp.remaining_sticks, sizeof(int));
-
-				conn.send(out_buf);
-
-				if (game_resp.client_won || game_resp.server_won) {
-					log.info("PLAY: Game ended for session_id=" + std::to_string(game_session_id) +
-					         ". Client_won: " + std::to_string(game_resp.client_won) +
-					         ", Server_won: " + std::to_string(game_resp.server_won) +
-					         ", Sticks left: " + std::to_string(game_resp.remaining_sticks));
+				parts.swap(upload_.parts);
+				offset = upload_.data_offset;
+				upload_.data_offset = 0;
+			}
+			for (PooledBuffer& part : parts) {
+				slot->append(part.view().subspan(offset));
+				offset = 0;
+			}
+			size_t copied = 0;
+			for (const PooledBuffer& part : parts) {
+				copied += part.size();
+			}
+			std::lock_guard lock(mutex_);
+			// fail() has refunded everything once the job is answered.
+			if (!done_) {
+				charged_ -= copied;
+				budget_->refund(copied);
+			}
+		}
+	}
+
+	Status appendLocked(std::span<const uint8_t> data) {
+		try {
+			slot_->append(data);
+			return Status::OK;
+		} catch (const BadRequest& ex) {
+			log_.error("Bad request for " + upload_.job.filename + ": " + ex.what());
+			return Status::BAD_REQUEST;
+		} catch (const ServerBusy& ex) {
+			log_.warning("Busy for " + upload_.job.filename + ": " + ex.what());
+			return Status::SERVER_BUSY;
+		}
+	}
+
+	void build(CompileUpload& slot) {
+		JobOutcome outcome = run_job(upload_.job, [&slot](JobOutcome& out) { finish_into(slot, out); }, log_);
+		reply_(outcome.status, outcome.result);
+	}
+
+	mutable std::mutex mutex_;
+	PendingUpload upload_;
+	std::shared_ptr<UploadBudget> budget_;
+	CompileServices& services_;
+	Reply reply_;
+	Logger& log_;
+	// Bytes of the parts kept in upload_, charged to budget_.
+	size_t charged_;
+	// Held while the job has its slot and parts are still arriving.
+	std::unique_ptr<CompileUpload> slot_;
+	bool complete_;
+	// Answered, or taken to be built.
+	bool done_;
+};
+
+// Builds a SUBMIT job once the scheduler lets it in and leaves the outcome in the job store.
+void start_job(uint64_t id, std::shared_ptr<PendingUpload> upload, uint64_t client, CompileServices& services,
+               Logger& log) {
+	when_admitted(
+	    services, upload->job, client, true,
+	    [id, upload, &services, &log](CompileAdmission admission) {
+		    services.jobs.started(id);
+		    JobOutcome outcome = build_admitted(
+		        upload->job, std::move(admission), [&upload](CompileUpload& slot) { fill(slot, *upload); }, log);
+		    services.jobs.finish(id, outcome.status, std::move(outcome.result));
+	    },
+	    [id, &services]() { services.jobs.finish(id, Status::SERVER_BUSY, {}); });
+}
+
+// Takes a complete SUBMIT upload into the job store and starts it; returns the job id.
+uint64_t submit_job(std::shared_ptr<PendingUpload> upload, uint64_t client, CompileServices& services, Logger& log) {
+	uint64_t id = services.jobs.create(upload->size);
+	if (id == 0) {
+		throw ServerBusy("Job store is full or holds too many queued bytes for " + std::to_string(upload->size) +
+		                 " more");
+	}
+	log.info("Job " + std::to_string(id) + " submitted for " + upload->job.filename + " (" +
+	         std::to_string(upload->size) + " bytes)");
+	start_job(id, std::move(upload), client, services, log);
+	return id;
+}
+
+std::vector<uint8_t> encode_job_id(uint64_t id) {
+	std::vector<uint8_t> out(sizeof(uint64_t));
+	put_be64(out.data(), id);
+	return out;
+}
+
+// Points each file of a complete BATCH upload at its bytes among the received parts.
+void slice_batch(PendingUpload& batch) {
+	uint64_t declared = 0;
+	for (const BatchFile& file : batch.files) {
+		declared += file.size;
+	}
+	if (declared != batch.size) {
+		throw BadRequest("BATCH carries " + std::to_string(batch.size) + " bytes of files, its manifest declares " +
+		                 std::to_string(declared));
+	}
+	size_t part = 0;
+	std::span<const uint8_t> rest = batch.parts.front().view().subspan(batch.data_offset);
+	for (BatchFile& file : batch.files) {
+		size_t left = file.size;
+		while (left > 0) {
+			while (rest.empty()) {
+				rest = batch.parts[++part].view();
+			}
+			size_t take = std::min(left, rest.size());
+			file.pieces.push_back(rest.first(take));
+			rest = rest.subspan(take);
+			left -= take;
+		}
+	}
+}
+
+// Answers one file of a BATCH: every frame of its reply starts with the file's u16 index in the manifest.
+void answer_batch_file(const FrameHeader& request, uint16_t index, Status status, std::span<const uint8_t> result,
+                       uint8_t reply_encoding, const FrameSink& send) {
+	FrameSink tagged = [index, &send](FrameHeader header, std::vector<uint8_t>&& chunk) {
+		chunk.insert(chunk.begin(), sizeof(uint16_t), 0);
+		put_be16(chunk.data(), index);
+		send(header, std::move(chunk));
+	};
+	if (compress_reply(reply_encoding, result)) {
+		send_compressed(make_response(request, status), result, tagged);
+		return;
+	}
+	tagged(make_response(request, status), std::vector<uint8_t>(result.begin(), result.end()));
+}
+
+// Fans the files of a complete BATCH out to the compiler as separate jobs. Each file's outcome goes to send as soon
+// as it is ready, in whatever order they finish; answered is called once per file after its reply.
+void run_batch(std::shared_ptr<PendingUpload> batch, uint64_t client, CompileServices& services,
+               uint8_t reply_encoding, FrameSink send, std::function<void()> answered, Logger& log) {
+	slice_batch(*batch);
+	log.info("Batch request " + std::to_string(batch->request.request_id) + " of " +
+	         std::to_string(batch->files.size()) + " files (" + std::to_string(batch->size) + " bytes)");
+	for (size_t i = 0; i < batch->files.size(); ++i) {
+		auto reply = [batch, i, reply_encoding, send, answered](Status status, std::span<const uint8_t> result) {
+			answer_batch_file(batch->request, static_cast<uint16_t>(i), status, result, reply_encoding, send);
+			answered();
+		};
+		when_admitted(
+		    services, batch->files[i].job, client, false,
+		    [batch, i, reply, &log](CompileAdmission admission) {
+			    const BatchFile& file = batch->files[i];
+			    JobOutcome outcome = build_admitted(
+			        file.job, std::move(admission),
+			        [&file](CompileUpload& slot) {
+				        if (!slot.compressed()) {
+					        slot.reserve(file.size);
+				        }
+				        for (auto piece : file.pieces) {
+					        slot.append(piece);
+				        }
+			        },
+			        log);
+			    reply(outcome.status, outcome.result);
+		    },
+		    [reply]() { reply(Status::SERVER_BUSY, {}); });
+	}
+}
+
+// A STATUS or FETCH request.
+struct JobQuery {
+	uint64_t id;
+	std::chrono::milliseconds wait;
+};
+
+JobQuery parse_job_query(std::span<const uint8_t> payload) {
+	if (payload.size() != sizeof(uint64_t) + sizeof(uint32_t)) {
+		throw BadRequest("Job query payload must be a u64 job id and a u32 wait");
+	}
+	return {get_be64(payload.data()), std::chrono::milliseconds(get_be32(payload.data() + sizeof(uint64_t)))};
+}
+
+// Answers a STATUS or FETCH with what the job store knows about the job.
+void answer_job_query(const FrameHeader& request, const JobView& view, uint8_t reply_encoding, const FrameSink& send) {
+	if (!view.found) {
+		send(make_response(request, Status::JOB_NOT_FOUND), {});
+		return;
+	}
+	if (request.opcode == Opcode::STATUS) {
+		std::vector<uint8_t> out(2 * sizeof(uint8_t) + sizeof(uint32_t));
+		out[0] = static_cast<uint8_t>(view.state);
+		out[1] = static_cast<uint8_t>(view.status);
+		put_be32(out.data() + 2, view.result ? static_cast<uint32_t>(view.result->size()) : 0);
+		send(make_response(request, Status::OK), std::move(out));
+		return;
+	}
+	if (view.state != JobState::FINISHED) {
+		send(make_response(request, Status::JOB_PENDING), {});
+		return;
+	}
+	std::span<const uint8_t> result(*view.result);
+	if (compress_reply(reply_encoding, result)) {
+		send_compressed(make_response(request, view.status), result, send);
+		return;
+	}
+	send(make_response(request, view.status), std::vector<uint8_t>(result.begin(), result.end()));
+}
+
+void expect_upload_part(const FrameHeader& request, const FrameHeader& part) {
+	if (part.opcode != Opcode::COMPILE_DATA || part.request_id != request.request_id) {
+		throw BadRequest("Expected COMPILE_DATA for request " + std::to_string(request.request_id));
+	}
+}
+
+// Blocking COMPILE: every COMPILE_DATA payload is received straight into the shared memory slot, or decompressed
+// into it from the frame buffer. The job's lane place is taken before the upload, so a slow sender holds it while
+// the rest arrives.
+void serve_compile(TCPClientConnection& conn, const FrameHeader& request, uint64_t client, CompileServices& services,
+                   uint8_t reply_encoding, Logger& log) {
+	CompileRequest job;
+	auto first = parse_compile_request(request, conn.receive_payload(request), job);
+	const std::string& filename = job.filename;
+	log.info("Compile upload for '" + filename + "' (request " + std::to_string(request.request_id) + ")");
+
+	CompileUpload upload(job, admit_compile(services.scheduler, job, client), log);
+	upload.append(first);
+	bool more = request.flags & FLAG_MORE;
+	while (more) {
+		auto part = conn.receive_header();
+		if (!part) {
+			throw TransmissionException("Client disconnected during upload.");
+		}
+		expect_upload_part(request, *part);
+		if (upload.compressed()) {
+			upload.append(conn.receive_payload(*part));
+		} else {
+			upload.reserve(part->payload_len);
+			conn.receive_payload_into(*part, upload.remaining());
+			upload.commit(part->payload_len);
+		}
+		more = part->flags & FLAG_MORE;
+	}
+	upload.finish([&conn, &request, reply_encoding](Status status, std::span<const uint8_t> result) {
+		if (compress_reply(reply_encoding, result)) {
+			send_compressed(make_response(request, status), result,
+			                [&conn](FrameHeader header, std::vector<uint8_t>&& chunk) { conn.send(header, chunk); });
+			return;
+		}
+		conn.send(make_response(request, status), result);
+	});
+	log.info("Sent compile response to client for " + filename);
+}
+
+// Receives a whole SUBMIT or BATCH upload into memory.
+std::shared_ptr<PendingUpload> receive_upload(TCPClientConnection& conn, const FrameHeader& request, Logger& log) {
+	auto upload = std::make_shared<PendingUpload>();
+	begin_upload(*upload, request, conn.receive_buffer(request));
+	size_t limit = CompileRing::instance(log).max_source_size();
+	bool more = request.flags & FLAG_MORE;
+	while (more) {
+		auto part = conn.receive_header();
+		if (!part) {
+			throw TransmissionException("Client disconnected during upload.");
+		}
+		expect_upload_part(request, *part);
+		if (part->payload_len > limit - upload->size) {
+			throw BadRequest("Upload exceeds the " + std::to_string(limit) + " byte source limit");
+		}
+		upload->size += part->payload_len;
+		upload->parts.push_back(conn.receive_buffer(*part));
+		more = part->flags & FLAG_MORE;
+	}
+	return upload;
+}
+
+// Blocking SUBMIT: the upload is kept in memory until the job's turn comes; the id goes back once it is complete.
+void serve_submit(TCPClientConnection& conn, const FrameHeader& request, uint64_t client, CompileServices& services,
+                  Logger& log) {
+	uint64_t id = submit_job(receive_upload(conn, request, log), client, services, log);
+	conn.send(make_response(request, Status::OK), encode_job_id(id));
+}
+
+// Blocking BATCH: the files build in parallel on the job runners while this thread waits for the last of them;
+// the runners send each reply as its file finishes.
+void serve_batch(TCPClientConnection& conn, const FrameHeader& request, uint64_t client, CompileServices& services,
+                 uint8_t reply_encoding, Logger& log) {
+	auto batch = receive_upload(conn, request, log);
+	std::mutex send_mutex;
+	std::latch done(static_cast<std::ptrdiff_t>(batch->files.size()));
+	run_batch(
+	    batch, client, services, reply_encoding,
+	    [&conn, &send_mutex, &log](FrameHeader header, std::vector<uint8_t>&& chunk) {
+		    std::lock_guard lock(send_mutex);
+		    try {
+			    conn.send(header, chunk);
+		    } catch (const std::exception& ex) {
+			    log.warning("Failed to send a batch reply: " + std::string(ex.what()));
+		    }
+	    },
+	    [&done]() { done.count_down(); }, log);
+	done.wait();
+}
+
+// Lets answers that come after the fact, from job watchers, reach a reactor connection; they are dropped once the
+// connection has closed.
+class ReplyLink {
+   public:
+	explicit ReplyLink(FrameConnection& conn) : conn_(&conn) {}
+
+	void send(FrameHeader header, std::vector<uint8_t>&& payload) {
+		std::lock_guard lock(mutex_);
+		if (conn_) {
+			conn_->send(header, std::move(payload));
+		}
+	}
+
+	// Replies the connection stays open for; see FrameConnection::expectReplies.
+	void expect(size_t count = 1) {
+		std::lock_guard lock(mutex_);
+		if (conn_) {
+			conn_->expectReplies(count);
+		}
+	}
+
+	void settle(size_t count = 1) {
+		std::lock_guard lock(mutex_);
+		if (conn_) {
+			conn_->settleReplies(count);
+		}
+	}
+
+	void detach() {
+		std::lock_guard lock(mutex_);
+		conn_ = nullptr;
+	}
+
+   private:
+	std::mutex mutex_;
+	FrameConnection* conn_;
+};
+
+// Forwards one move to the sticks-game subserver and encodes its reply. Returns true when the game is over.
+bool play_turn(ClientMessageQueue& mq, long game_session_id, std::span<const uint8_t> move_buf,
+               std::vector<uint8_t>& out_buf, Logger& log) {
+	if (move_buf.size() != sizeof(int32_t)) {
+		log.error("PLAY: Invalid move size from client. Expected " + std::to_string(sizeof(int32_t)) + " got " +
+		          std::to_string(move_buf.size()));
+		throw BadRequest("Invalid move size from client");
+	}
+	int client_take = static_cast<int32_t>(get_be32(move_buf.data()));
+	log.debug("PLAY: Client wants to take " + std::to_string(client_take) + " sticks.");
+
+	mq.send_request(game_session_id, client_take);
+	GameResponse game_resp = mq.receive_response(game_session_id);
+
+	log.debug("PLAY: Subserver response: server_took=" + std::to_string(game_resp.taken) +
+	          ", client_won=" + (game_resp.client_won ? "T" : "F") + ", server_won=" +
+	          (game_resp.server_won ? "T" : "F") + ", Sticks left: " + std::to_string(game_resp.remaining_sticks));
+
+	out_buf.assign(sizeof(int32_t) + sizeof(uint8_t) + sizeof(uint8_t) + sizeof(int32_t), 0);
+	size_t offset = 0;
+	put_be32(out_buf.data() + offset, static_cast<uint32_t>(game_resp.taken));
+	offset += sizeof(int32_t);
+	out_buf[offset++] = static_cast<uint8_t>(game_resp.client_won);
+	out_buf[offset++] = static_cast<uint8_t>(game_resp.server_won);
+	put_be32(out_buf.data() + offset, static_cast<uint32_t>(game_resp.remaining_sticks));
+
+	if (game_resp.client_won || game_resp.server_won) {
+		log.info("PLAY: Game ended for session_id=" + std::to_string(game_session_id) +
+		         ". Client_won: " + std::to_string(game_resp.client_won) +
+		         ", Server_won: " + std::to_string(game_resp.server_won) +
+		         ", Sticks left: " + std::to_string(game_resp.remaining_sticks));
+		return true;
+	}
+	log.info("PLAY: Turn ended for session_id=" + std::to_string(game_session_id) +
+	         ". Server took: " + std::to_string(game_resp.taken) +
+	         ", Sticks left: " + std::to_string(game_resp.remaining_sticks));
+	return false;
+}
+
+
+// Reactor-side counterpart of handle_client. Frames arrive on the I/O thread; game moves and job queries are
+// handed to the worker pool, compiles wait for the scheduler and run on the job runners. Compiles run concurrently
+// and are answered as they finish, tagged with their request id; game moves are served one at a time and in order.
+// The connection stays open until the client closes it.
+class ClientSession final : public FrameSession {
+   public:
+	ClientSession(int fd, CompileServices& services, Logger& log)
+	    : fd_(fd),
+	      client_(next_client_id++),
+	      services_(services),
+	      log_(log),
+	      closing_(false),
+	      reply_encoding_(0),
+	      budget_(std::make_shared<UploadBudget>(UPLOAD_BUDGET_BYTES)) {}
+
+	void on_frame(FrameConnection& conn, const FrameHeader& header, PooledBuffer&& payload) override {
+		if (!link_) {
+			link_ = std::make_shared<ReplyLink>(conn);
+		}
+		if (closing_) {
+			log_.warning("Unexpected frame from fd: " + std::to_string(fd_) + " after the connection was closed");
+			return;
+		}
+		if (header.version != PROTOCOL_VERSION) {
+			log_.warning("Unsupported protocol version " + std::to_string(header.version) +
+			             " from fd: " + std::to_string(fd_));
+			reject(conn, header, Status::UNSUPPORTED_VERSION);
+			return;
+		}
+		switch (header.opcode) {
+			case Opcode::COMPILE:
+			case Opcode::SUBMIT:
+			case Opcode::BATCH:
+				start_upload(conn, header, std::move(payload));
+				break;
+			case Opcode::STATUS:
+			case Opcode::FETCH:
+				query(conn, header, std::move(payload));
+				break;
+			case Opcode::COMPILE_DATA:
+				continue_upload(conn, header, std::move(payload));
+				break;
+			case Opcode::HELLO:
+				try {
+					reply_encoding_ = negotiate_encoding(payload.view());
+				} catch (const BadRequest& ex) {
+					log_.error("Bad HELLO from fd=" + std::to_string(fd_) + ": " + ex.what());
+					conn.send(make_response(header, Status::BAD_REQUEST), {});
 					break;
-				} else {
-					log.info("PLAY: Turn ended for session_id=" + std::to_string(game_session_id) +
-					         ". Server took: " + std::to_string(game_resp.taken) +
-					         ", Sticks left: " + std::to_string(game_resp.remaining_sticks));
 				}
+				conn.send(make_response(header, Status::OK), {reply_encoding_});
+				break;
+			case Opcode::PLAY_MOVE:
+				// Moves of one game must reach the subserver in order, so they pause dispatch.
+				guarded(conn, header, true,
+				        [this, &conn, header, move_buf = std::make_shared<PooledBuffer>(std::move(payload))]() {
+					        if (!mq_) {
+						        log_.info("Play game request from fd: " + std::to_string(fd_));
+						        mq_ = std::make_unique<ClientMessageQueue>(log_);
+					        }
+					        std::vector<uint8_t> out_buf;
+					        bool game_over = play_turn(*mq_, static_cast<long>(fd_), move_buf->view(), out_buf, log_);
+					        conn.send(make_response(header, Status::OK), std::move(out_buf));
+					        if (game_over) {
+						        mq_.reset();
+					        }
+				        });
+				break;
+			default:
+				log_.warning("Unknown opcode " + std::to_string(static_cast<int>(header.opcode)) +
+				             " from fd: " + std::to_string(fd_));
+				conn.send(make_response(header, Status::UNKNOWN_OPCODE), {});
+				break;
+		}
+	}
+
+	// Compiles still waiting for their lane are answered with SERVER_BUSY rather than built for nobody, and those
+	// whose upload was cut short with BAD_REQUEST.
+	void on_hangup() override {
+		drop_streams(Status::BAD_REQUEST);
+		services_.scheduler.cancel(client_);
+	}
+
+	void on_close() override {
+		if (link_) {
+			link_->detach();
+		}
+		drop_streams(Status::BAD_REQUEST);
+		services_.scheduler.cancel(client_);
+		log_.info("Finished handling client on fd: " + std::to_string(fd_));
+	}
+
+   private:
+	void start_upload(FrameConnection& conn, const FrameHeader& header, PooledBuffer&& payload) {
+		if (uploads_.contains(header.request_id) || streams_.contains(header.request_id) ||
+		    refused_.contains(header.request_id)) {
+			log_.error("Duplicate upload id " + std::to_string(header.request_id) + " from fd: " + std::to_string(fd_));
+			reject(conn, header, Status::BAD_REQUEST);
+			return;
+		}
+		if (uploads_.size() + streams_.size() >= MAX_UPLOADS_PER_CONNECTION) {
+			log_.warning("fd: " + std::to_string(fd_) + " already has " + std::to_string(MAX_UPLOADS_PER_CONNECTION) +
+			             " uploads arriving, refusing request " + std::to_string(header.request_id));
+			refuse(conn, header, header.flags & FLAG_MORE);
+			return;
+		}
+		if (header.opcode == Opcode::COMPILE) {
+			start_compile(conn, header, std::move(payload));
+			return;
+		}
+		PendingUpload upload;
+		try {
+			begin_upload(upload, header, std::move(payload));
+		} catch (const BadRequest& ex) {
+			log_.error("Bad upload request from fd=" + std::to_string(fd_) + ": " + ex.what());
+			conn.send(make_response(header, Status::BAD_REQUEST), {});
+			return;
+		}
+		log_.info("Compile upload for " + std::to_string(upload.files.size()) + " files (request " +
+		          std::to_string(header.request_id) + ") from fd: " + std::to_string(fd_));
+		if (header.flags & FLAG_MORE) {
+			if (!budget_->charge(parts_bytes(upload))) {
+				log_.warning("Upload of request " + std::to_string(header.request_id) + " from fd: " +
+				             std::to_string(fd_) + " is over the connection's upload budget");
+				refuse(conn, header, true);
+				return;
+			}
+			uploads_.emplace(header.request_id, std::move(upload));
+			return;
+		}
+		complete_upload(conn, std::move(upload));
+	}
+
+	// Answers an upload with SERVER_BUSY. Its remaining parts, when more is set, are skipped as they come.
+	void refuse(FrameConnection& conn, const FrameHeader& request, bool more) {
+		if (more) {
+			if (refused_.size() >= MAX_REFUSED_UPLOADS) {
+				log_.error("fd: " + std::to_string(fd_) + " keeps sending refused uploads, dropping the connection");
+				reject(conn, request, Status::SERVER_BUSY);
+				return;
+			}
+			refused_.insert(request.request_id);
+		}
+		conn.send(make_response(request, Status::SERVER_BUSY), {});
+	}
+
+	// Queues the job at once, so it can take its turn while the rest of the file is still arriving; the reply goes
+	// out through the link once it is ready.
+	void start_compile(FrameConnection& conn, const FrameHeader& header, PooledBuffer&& payload) {
+		CompileRequest job;
+		size_t offset;
+		try {
+			offset = static_cast<size_t>(parse_compile_request(header, payload.view(), job).data() - payload.data());
+		} catch (const BadRequest& ex) {
+			log_.error("Bad upload request from fd=" + std::to_string(fd_) + ": " + ex.what());
+			conn.send(make_response(header, Status::BAD_REQUEST), {});
+			return;
+		}
+		log_.info("Compile upload for '" + job.filename + "' (request " + std::to_string(header.request_id) +
+		          ") from fd: " + std::to_string(fd_));
+		auto reply = [request = header, link = link_, reply_encoding = reply_encoding_](
+		                 Status status, std::span<const uint8_t> result) {
+			FrameSink send = [&link](FrameHeader reply_header, std::vector<uint8_t>&& chunk) {
+				link->send(reply_header, std::move(chunk));
+			};
+			if (compress_reply(reply_encoding, result)) {
+				send_compressed(make_response(request, status), result, send);
+			} else {
+				send(make_response(request, status), std::vector<uint8_t>(result.begin(), result.end()));
+			}
+			link->settle();
+		};
+		link_->expect();
+		auto stream = std::make_shared<StreamedCompile>(header, job, budget_, services_, std::move(reply), log_);
+		bool more = header.flags & FLAG_MORE;
+		stream->add(std::move(payload), offset, !more);
+		if (more) {
+			streams_.emplace(header.request_id, stream);
+		}
+		stream->start(client_);
+	}
+
+	void continue_upload(FrameConnection& conn, const FrameHeader& header, PooledBuffer&& payload) {
+		if (refused_.contains(header.request_id)) {
+			if (!(header.flags & FLAG_MORE)) {
+				refused_.erase(header.request_id);
+			}
+			return;
+		}
+		size_t limit = CompileRing::instance(log_).max_source_size();
+		auto stream = streams_.find(header.request_id);
+		if (stream != streams_.end()) {
+			if (payload.size() > limit - stream->second->size()) {
+				log_.error("Upload for request " + std::to_string(header.request_id) + " from fd: " +
+				           std::to_string(fd_) + " exceeds the source size limit");
+				reject(conn, stream->second->request(), Status::BAD_REQUEST);
+				return;
+			}
+			bool last = !(header.flags & FLAG_MORE);
+			stream->second->add(std::move(payload), 0, last);
+			if (last) {
+				streams_.erase(stream);
+			}
+			return;
+		}
+		auto it = uploads_.find(header.request_id);
+		if (it == uploads_.end()) {
+			log_.error("COMPILE_DATA for unknown request " + std::to_string(header.request_id) +
+			           " from fd: " + std::to_string(fd_));
+			reject(conn, header, Status::BAD_REQUEST);
+			return;
+		}
+		PendingUpload& upload = it->second;
+		if (payload.size() > limit - upload.size) {
+			log_.error("Upload for request " + std::to_string(header.request_id) + " from fd: " +
+			           std::to_string(fd_) + " exceeds the source size limit");
+			// reject() drops every pending upload, this one included.
+			reject(conn, upload.request, Status::BAD_REQUEST);
+			return;
+		}
+		if (!budget_->charge(payload.size())) {
+			log_.warning("Upload of request " + std::to_string(header.request_id) + " from fd: " +
+			             std::to_string(fd_) + " is over the connection's upload budget");
+			FrameHeader request = upload.request;
+			drop_upload(it);
+			refuse(conn, request, header.flags & FLAG_MORE);
+			return;
+		}
+		upload.size += payload.size();
+		upload.parts.push_back(std::move(payload));
+		if (header.flags & FLAG_MORE) {
+			return;
+		}
+		// A complete upload belongs to its jobs from here on.
+		budget_->refund(parts_bytes(upload));
+		PendingUpload complete = std::move(upload);
+		uploads_.erase(it);
+		complete_upload(conn, std::move(complete));
+	}
+
+	void complete_upload(FrameConnection& conn, PendingUpload&& upload) {
+		auto shared = std::make_shared<PendingUpload>(std::move(upload));
+		if (shared->request.opcode == Opcode::BATCH) {
+			link_->expect(shared->files.size());
+			try {
+				run_batch(
+				    shared, client_, services_, reply_encoding_,
+				    [link = link_](FrameHeader header, std::vector<uint8_t>&& chunk) {
+					    link->send(header, std::move(chunk));
+				    },
+				    [link = link_] { link->settle(); }, log_);
+			} catch (const BadRequest& ex) {
+				link_->settle(shared->files.size());
+				log_.error("Bad BATCH from fd=" + std::to_string(fd_) + ": " + ex.what());
+				conn.send(make_response(shared->request, Status::BAD_REQUEST), {});
+			}
+			return;
+		}
+		try {
+			uint64_t id = submit_job(shared, client_, services_, log_);
+			conn.send(make_response(shared->request, Status::OK), encode_job_id(id));
+		} catch (const ServerBusy& ex) {
+			log_.warning("Busy for fd=" + std::to_string(fd_) + ": " + ex.what());
+			conn.send(make_response(shared->request, Status::SERVER_BUSY), {});
+		}
+	}
+
+	// Forgets an upload that is still arriving and refunds what it holds.
+	void drop_upload(std::unordered_map<uint32_t, PendingUpload>::iterator it) {
+		budget_->refund(parts_bytes(it->second));
+		uploads_.erase(it);
+	}
+
+	// Compiles cut short by the connection going away are answered, so the replies owed for them are settled.
+	void drop_streams(Status status) {
+		for (auto& [request_id, stream] : streams_) {
+			stream->fail(status);
+		}
+		streams_.clear();
+	}
+
+	// The job store answers once the job has finished or the wait is over; the worker only registers the wait.
+	void query(FrameConnection& conn, const FrameHeader& header, PooledBuffer&& payload) {
+		JobQuery job_query;
+		try {
+			job_query = parse_job_query(payload.view());
+		} catch (const BadRequest& ex) {
+			log_.error("Bad job query from fd=" + std::to_string(fd_) + ": " + ex.what());
+			conn.send(make_response(header, Status::BAD_REQUEST), {});
+			return;
+		}
+		guarded(conn, header, false, [this, header, job_query, link = link_, reply_encoding = reply_encoding_]() {
+			link->expect();
+			services_.jobs.watch(job_query.id, job_query.wait, [header, link, reply_encoding](const JobView& view) {
+				answer_job_query(header, view, reply_encoding,
+				                 [&link](FrameHeader reply, std::vector<uint8_t>&& chunk) {
+					                 link->send(reply, std::move(chunk));
+				                 });
+				link->settle();
+			});
+		});
+	}
+
+	// Protocol violations leave the stream in an unknown state: answer and drop the connection.
+	void reject(FrameConnection& conn, const FrameHeader& request, Status status) {
+		conn.send(make_response(request, status), {});
+		closing_ = true;
+		while (!uploads_.empty()) {
+			drop_upload(uploads_.begin());
+		}
+		refused_.clear();
+		drop_streams(Status::BAD_REQUEST);
+		conn.close();
+	}
+
+	// Runs IPC-bound work off the I/O thread with the same error replies as handle_client. Failures are
+	// reported for the request alone, other requests on the connection carry on. ordered work pauses frame
+	// dispatch until it is done; SERVER_BUSY goes out when the worker pool refuses the job.
+	template <typename Fn>
+	void guarded(FrameConnection& conn, const FrameHeader& request, bool ordered, Fn&& fn) {
+		auto task = [this, &conn, request, fn = std::forward<Fn>(fn)]() mutable {
+			Status status;
+			try {
+				fn();
+				return;
+			} catch (const TransmissionException& ex) {
+				log_.warning("TransmissionException for fd=" + std::to_string(fd_) + ": " + ex.what());
+				conn.close();
+				return;
+			} catch (const BadRequest& ex) {
+				log_.error("Bad request from fd=" + std::to_string(fd_) + ": " + ex.what());
+				status = Status::BAD_REQUEST;
+			} catch (const ServerBusy& ex) {
+				log_.warning("Busy for fd=" + std::to_string(fd_) + ": " + ex.what());
+				status = Status::SERVER_BUSY;
+			} catch (const IPCException& ex) {
+				log_.error("IPCException for fd=" + std::to_string(fd_) + ": " + ex.what());
+				status = Status::SERVER_IPC_ERROR;
+			} catch (const std::exception& ex) {
+				log_.error("Client handler generic exception for fd=" + std::to_string(fd_) + ": " +
+				           std::string(ex.what()));
+				status = Status::SERVER_ERROR;
 			}
+			conn.send(make_response(request, status), {});
+		};
+		auto rejected = [&conn, request]() { conn.send(make_response(request, Status::SERVER_BUSY), {}); };
+		if (ordered) {
+			conn.defer(std::move(task), std::move(rejected));
 		} else {
-			log.warning("Unknown command: '" + cmd + "' from fd: " + std::to_string(client_fd));
-			std::string err_msg = "UNKNOWN_COMMAND";
-			conn.send(std::vector<uint8_t>(err_msg.begin(), err_msg.end()));
+			conn.spawn(std::move(task), std::move(rejected));
+		}
+	}
+
+	int fd_;
+	uint64_t client_;
+	CompileServices& services_;
+	Logger& log_;
+	bool closing_;
+	// Agreed by HELLO on the I/O thread; compile tasks take a copy when they are handed out.
+	uint8_t reply_encoding_;
+	// SUBMIT and BATCH uploads whose parts are still arriving.
+	std::unordered_map<uint32_t, PendingUpload> uploads_;
+	// COMPILE uploads whose parts are still arriving.
+	std::unordered_map<uint32_t, std::shared_ptr<StreamedCompile>> streams_;
+	// Refused uploads whose remaining parts are to be skipped.
+	std::unordered_set<uint32_t> refused_;
+	// Charged with the parts of uploads_ and of streams_ that have no slot yet.
+	std::shared_ptr<UploadBudget> budget_;
+	std::shared_ptr<ReplyLink> link_;
+	// Only touched by ordered tasks, which never overlap.
+	std::unique_ptr<ClientMessageQueue> mq_;
+};
+
+}  // namespace
+
+void handle_client(int client_fd, CompileServices& services, Logger& log) {
+	log.info("Handling new client on fd: " + std::to_string(client_fd));
+	TCPClientConnection conn(client_fd, log);
+	uint64_t client = next_client_id++;
+	uint8_t reply_encoding = 0;
+	long game_session_id = static_cast<long>(client_fd);
+	std::unique_ptr<ClientMessageQueue> mq;
+	FrameHeader request;
+
+	// Replies to the request being served; the connection is dropped afterwards.
+	auto reply_error = [&](Status status) {
+		try {
+			conn.send(make_response(request, status), {});
+		} catch (const std::exception& send_ex) {
+			log.error("Failed to send " + std::string(status_name(status)) +
+			          " to client: " + std::string(send_ex.what()));
+		}
+	};
+
+	try {
+		while (auto header = conn.receive_header()) {
+			request = *header;
+			if (request.version != PROTOCOL_VERSION) {
+				log.warning("Unsupported protocol version " + std::to_string(request.version) +
+				            " from fd: " + std::to_string(client_fd));
+				reply_error(Status::UNSUPPORTED_VERSION);
+				break;
+			}
+			if (request.opcode == Opcode::COMPILE) {
+				serve_compile(conn, request, client, services, reply_encoding, log);
+			} else if (request.opcode == Opcode::SUBMIT) {
+				serve_submit(conn, request, client, services, log);
+			} else if (request.opcode == Opcode::BATCH) {
+				serve_batch(conn, request, client, services, reply_encoding, log);
+			} else if (request.opcode == Opcode::STATUS || request.opcode == Opcode::FETCH) {
+				JobQuery job_query = parse_job_query(conn.receive_payload(request));
+				std::promise<JobView> answer;
+				services.jobs.watch(job_query.id, job_query.wait,
+				                    [&answer](const JobView& view) { answer.set_value(view); });
+				answer_job_query(request, answer.get_future().get(), reply_encoding,
+				                 [&conn](FrameHeader reply, std::vector<uint8_t>&& chunk) { conn.send(reply, chunk); });
+			} else if (request.opcode == Opcode::HELLO) {
+				reply_encoding = negotiate_encoding(conn.receive_payload(request));
+				conn.send(make_response(request, Status::OK), {&reply_encoding, 1});
+			} else if (request.opcode == Opcode::PLAY_MOVE) {
+				auto move_buf = conn.receive_payload(request);
+				if (!mq) {
+					log.info("Play game request from fd: " + std::to_string(client_fd));
+					mq = std::make_unique<ClientMessageQueue>(log);
+				}
+				std::vector<uint8_t> out_buf;
+				bool game_over = play_turn(*mq, game_session_id, move_buf, out_buf, log);
+				conn.send(make_response(request, Status::OK), out_buf);
+				if (game_over) {
+					mq.reset();
+				}
+			} else if (request.opcode == Opcode::COMPILE_DATA) {
+				throw BadRequest("COMPILE_DATA outside of an upload");
+			} else {
+				log.warning("Unknown opcode " + std::to_string(static_cast<int>(request.opcode)) +
+				            " from fd: " + std::to_string(client_fd));
+				conn.receive_payload(request);
+				conn.send(make_response(request, Status::UNKNOWN_OPCODE), {});
+			}
 		}
 	} catch (const TransmissionException& ex) {
 		log.warning("TransmissionException for fd=" + std::to_string(client_fd) + ": " + ex.what());
+	} catch (const BadRequest& ex) {
+		log.error("Bad request from fd=" + std::to_string(client_fd) + ": " + ex.what());
+		reply_error(Status::BAD_REQUEST);
+	} catch (const ServerBusy& ex) {
+		log.warning("Busy for fd=" + std::to_string(client_fd) + ": " + ex.what());
+		reply_error(Status::SERVER_BUSY);
 	} catch (const IPCException& ex) {
 		log.error("IPCException for fd=" + std::to_string(client_fd) + ": " + ex.what());
-		try {
-			std::string err_msg = "SERVER_IPC_ERROR";
-			conn.send(std::vector<uint8_t>(err_msg.begin(), err_msg.end()));
-		} catch (const std::exception& send_ex) {
-			log.error("Failed to send IPC_ERROR to client: " + std::string(send_ex.what()));
-		}
+		reply_error(Status::SERVER_IPC_ERROR);
 	} catch (const std::exception& ex) {
 		log.error("Client handler generic exception for fd=" + std::to_string(client_fd) + ": " +
 		          std::string(ex.what()));
-		try {
-			std::string err_msg = "SERVER_ERROR";
-			conn.send(std::vector<uint8_t>(err_msg.begin(), err_msg.end()));
-		} catch (const std::exception& send_ex) {
-			log.error("Failed to send SERVER_ERROR to client: " + std::string(send_ex.what()));
-		}
+		reply_error(Status::SERVER_ERROR);
 	}
 
 	log.info("Finished handling client on fd: " + std::to_string(client_fd));
-}
\ No newline at end of file
+}
+
+std::unique_ptr<FrameSession> make_client_session(int client_fd, CompileServices& services, Logger& logger) {
+	logger.info("Handling new client on fd: " + std::to_string(client_fd));
+	return std::make_unique<ClientSession>(client_fd, services, logger);
+}
@@ -0,0 +1,215 @@
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "compile_scheduler.hpp"
+
+namespace {
+
+using namespace std::chrono_literals;
+
+int failures = 0;
+
+void check(bool ok, const std::string& what) {
+	if (!ok) {
+		std::cerr << "FAILED: " << what << std::endl;
+		++failures;
+	}
+}
+
+Logger quiet_logger() { return Logger::Builder().set_log_level(LogLevel::ERROR).build(); }
+
+SchedulerConfig one_lane(size_t max_jobs) {
+	SchedulerConfig config;
+	config.lanes = {{"only", {".cpp"}, max_jobs}};
+	config.queue_timeout_sec = 0;
+	return config;
+}
+
+// Collects what admitAsync() jobs are told, keeping their places until the test lets them go.
+class Recorder {
+   public:
+	std::function<void(CompileAdmission)> job(const std::string& name) {
+		return [this, name](CompileAdmission admission) {
+			std::lock_guard lock(mutex_);
+			order_.push_back(admission ? name : "-" + name);
+			if (admission) {
+				held_.push_back(std::move(admission));
+			}
+		};
+	}
+
+	// Gives up the oldest place held, which admits the next job.
+	void releaseOne() {
+		CompileAdmission admission;
+		{
+			std::lock_guard lock(mutex_);
+			admission = std::move(held_.front());
+			held_.erase(held_.begin());
+		}
+	}
+
+	std::vector<std::string> order() {
+		std::lock_guard lock(mutex_);
+		return order_;
+	}
+
+   private:
+	std::mutex mutex_;
+	std::vector<std::string> order_;
+	std::vector<CompileAdmission> held_;
+};
+
+size_t waiting(const CompileScheduler& scheduler, size_t lane = 0) { return scheduler.stats()[lane].waiting; }
+
+void test_lanes() {
+	Logger logger = quiet_logger();
+	CompileScheduler scheduler(SchedulerConfig(), logger);
+	check(scheduler.laneFor("a.cpp") == 0 && scheduler.laneName(0) == "quick", "cpp goes to the quick lane");
+	check(scheduler.laneFor("paper.tex") == 1 && scheduler.laneName(1) == "heavy", "tex goes to the heavy lane");
+	check(scheduler.laneFor("notes.txt") == 0, "unknown extensions go to the first lane");
+	check(scheduler.capacity() == 28, "capacity adds up the lanes");
+}
+
+void test_fair_turns() {
+	Logger logger = quiet_logger();
+	CompileScheduler scheduler(one_lane(1), logger);
+	Recorder recorder;
+	CompileAdmission blocker = scheduler.admit(0, 99, 0);
+	check(static_cast<bool>(blocker), "free lane admits at once");
+	scheduler.admitAsync(0, 1, 0, false, recorder.job("a1"));
+	scheduler.admitAsync(0, 1, 0, false, recorder.job("a2"));
+	scheduler.admitAsync(0, 1, 0, false, recorder.job("a3"));
+	scheduler.admitAsync(0, 2, 0, false, recorder.job("b1"));
+	check(recorder.order().empty() && waiting(scheduler) == 4, "full lane queues jobs");
+	blocker = CompileAdmission();
+	for (int i = 0; i < 3; ++i) {
+		recorder.releaseOne();
+	}
+	check(recorder.order() == std::vector<std::string>{"a1", "b1", "a2", "a3"}, "clients take turns");
+}
+
+void test_priority() {
+	Logger logger = quiet_logger();
+	CompileScheduler scheduler(one_lane(1), logger);
+	Recorder recorder;
+	CompileAdmission blocker = scheduler.admit(0, 99, 0);
+	scheduler.admitAsync(0, 1, 1, false, recorder.job("low"));
+	scheduler.admitAsync(0, 1, 5, false, recorder.job("high"));
+	scheduler.admitAsync(0, 1, 3, false, recorder.job("mid"));
+	scheduler.admitAsync(0, 1, 5, false, recorder.job("high2"));
+	blocker = CompileAdmission();
+	for (int i = 0; i < 3; ++i) {
+		recorder.releaseOne();
+	}
+	check(recorder.order() == std::vector<std::string>{"high", "high2", "mid", "low"},
+	      "a client's jobs go by priority, then arrival");
+}
+
+void test_lane_limit() {
+	Logger logger = quiet_logger();
+	SchedulerConfig config = one_lane(2);
+	config.lanes.push_back({"other", {".tex"}, 1});
+	CompileScheduler scheduler(config, logger);
+	Recorder recorder;
+	CompileAdmission first = scheduler.admit(0, 1, 0);
+	CompileAdmission second = scheduler.admit(0, 2, 0);
+	scheduler.admitAsync(0, 3, 0, false, recorder.job("third"));
+	check(scheduler.stats()[0].active == 2 && waiting(scheduler) == 1, "lane stops at its limit");
+	CompileAdmission other = scheduler.admit(1, 3, 0);
+	check(static_cast<bool>(other), "a full lane does not hold back another");
+	first = CompileAdmission();
+	check(recorder.order() == std::vector<std::string>{"third"}, "a freed place goes to the waiting job");
+	check(scheduler.stats()[0].admitted == 3, "admissions are counted");
+}
+
+void test_max_waiting() {
+	Logger logger = quiet_logger();
+	SchedulerConfig config = one_lane(1);
+	config.max_waiting = 2;
+	CompileScheduler scheduler(config, logger);
+	Recorder recorder;
+	CompileAdmission blocker = scheduler.admit(0, 99, 0);
+	check(scheduler.admitAsync(0, 1, 0, false, recorder.job("a")), "first waiter fits");
+	check(scheduler.admitAsync(0, 2, 0, false, recorder.job("b")), "second waiter fits");
+	check(!scheduler.admitAsync(0, 3, 0, false, recorder.job("c")), "lane refuses past max_waiting");
+	check(!scheduler.admit(0, 4, 0), "blocking admit is refused too");
+	check(scheduler.stats()[0].refused == 2 && waiting(scheduler) == 2, "refusals are counted");
+	check(recorder.order().empty(), "refused jobs are not told anything");
+}
+
+void test_cancel() {
+	Logger logger = quiet_logger();
+	CompileScheduler scheduler(one_lane(1), logger);
+	Recorder recorder;
+	CompileAdmission blocker = scheduler.admit(0, 99, 0);
+	scheduler.admitAsync(0, 1, 0, false, recorder.job("attached"));
+	scheduler.admitAsync(0, 1, 0, true, recorder.job("detached"));
+	scheduler.admitAsync(0, 2, 0, false, recorder.job("other"));
+	scheduler.cancel(1);
+	check(recorder.order() == std::vector<std::string>{"-attached"}, "cancel withdraws attached jobs only");
+	check(waiting(scheduler) == 2, "withdrawn job leaves the queue");
+	blocker = CompileAdmission();
+	recorder.releaseOne();
+	check(recorder.order() == std::vector<std::string>{"-attached", "detached", "other"},
+	      "detached job outlives its client");
+}
+
+void test_timeout() {
+	Logger logger = quiet_logger();
+	SchedulerConfig config = one_lane(1);
+	config.queue_timeout_sec = 1;
+	CompileScheduler scheduler(config, logger);
+	Recorder recorder;
+	CompileAdmission blocker = scheduler.admit(0, 99, 0);
+	scheduler.admitAsync(0, 1, 0, false, recorder.job("late"));
+	auto start = std::chrono::steady_clock::now();
+	check(!scheduler.admit(0, 2, 0), "blocking admit gives up");
+	check(std::chrono::steady_clock::now() - start >= 1s, "blocking admit waits out the timeout");
+	for (int i = 0; i < 40 && recorder.order().empty(); ++i) {
+		std::this_thread::sleep_for(100ms);
+	}
+	check(recorder.order() == std::vector<std::string>{"-late"}, "overdue async job is withdrawn");
+	check(scheduler.stats()[0].timed_out == 2 && waiting(scheduler) == 0, "timeouts are counted");
+}
+
+void test_deep_queue() {
+	constexpr size_t JOBS = 100000;
+	Logger logger = quiet_logger();
+	SchedulerConfig config = one_lane(1);
+	config.max_waiting = JOBS;
+	CompileScheduler scheduler(config, logger);
+	size_t told = 0;
+	CompileAdmission blocker = scheduler.admit(0, 0, 0);
+	// Each job gives its place straight back, admitting the next one from inside its callback.
+	for (size_t i = 1; i <= JOBS; ++i) {
+		scheduler.admitAsync(0, i, 0, false, [&told](CompileAdmission admission) { told += admission ? 1 : 0; });
+	}
+	blocker = CompileAdmission();
+	check(told == JOBS, "every job of a deep queue is admitted without recursing");
+	check(scheduler.stats()[0].active == 0 && waiting(scheduler) == 0, "lane drains");
+}
+
+}  // namespace
+
+int main() {
+	test_lanes();
+	test_fair_turns();
+	test_priority();
+	test_lane_limit();
+	test_max_waiting();
+	test_cancel();
+	test_timeout();
+	test_deep_queue();
+	if (failures > 0) {
+		std::cerr << failures << " check(s) failed" << std::endl;
+		return EXIT_FAILURE;
+	}
+	std::cout << "compile_scheduler_test passed" << std::endl;
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,180 @@
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "job_store.hpp"
+
+namespace {
+
+using namespace std::chrono_literals;
+
+int failures = 0;
+
+void check(bool ok, const std::string& what) {
+	if (!ok) {
+		std::cerr << "FAILED: " << what << std::endl;
+		++failures;
+	}
+}
+
+Logger quiet_logger() { return Logger::Builder().set_log_level(LogLevel::ERROR).build(); }
+
+// Takes the answer of one watch, which may come from the store's timer thread.
+class Answer {
+   public:
+	JobStore::Watcher watcher() {
+		return [this](const JobView& view) {
+			std::lock_guard lock(mutex_);
+			view_ = view;
+			cv_.notify_all();
+		};
+	}
+
+	bool answered() {
+		std::lock_guard lock(mutex_);
+		return view_.has_value();
+	}
+
+	std::optional<JobView> await(std::chrono::milliseconds limit) {
+		std::unique_lock lock(mutex_);
+		cv_.wait_for(lock, limit, [this] { return view_.has_value(); });
+		return view_;
+	}
+
+   private:
+	std::mutex mutex_;
+	std::condition_variable cv_;
+	std::optional<JobView> view_;
+};
+
+JobView look(JobStore& jobs, uint64_t id) {
+	Answer answer;
+	jobs.watch(id, 0ms, answer.watcher());
+	return *answer.await(0ms);
+}
+
+void test_lifecycle() {
+	Logger logger = quiet_logger();
+	JobStore jobs(JobStoreConfig(), logger);
+	uint64_t id = jobs.create(10);
+	check(id != 0, "job is created");
+	JobView view = look(jobs, id);
+	check(view.found && view.state == JobState::QUEUED, "new job is queued");
+	jobs.started(id);
+	check(look(jobs, id).state == JobState::RUNNING, "started job is running");
+	jobs.finish(id, Status::OK, {1, 2, 3});
+	view = look(jobs, id);
+	check(view.state == JobState::FINISHED && view.status == Status::OK && view.result && view.result->size() == 3,
+	      "finished job keeps its result");
+	check(!look(jobs, id + 1).found, "unknown id is not found");
+	JobStoreStats stats = jobs.stats();
+	check(stats.finished == 1 && stats.submitted == 1 && stats.result_bytes == 3, "stats follow the job");
+}
+
+void test_watchers() {
+	Logger logger = quiet_logger();
+	JobStoreConfig config;
+	config.max_wait_sec = 1;
+	JobStore jobs(config, logger);
+	uint64_t id = jobs.create(0);
+	Answer on_finish;
+	jobs.watch(id, 10s, on_finish.watcher());
+	check(!on_finish.answered(), "watcher waits for an unfinished job");
+	jobs.finish(id, Status::COMPILATION_FAILED, {});
+	auto view = on_finish.await(0ms);
+	check(view && view->state == JobState::FINISHED && view->status == Status::COMPILATION_FAILED,
+	      "finish answers the watcher");
+
+	uint64_t slow = jobs.create(0);
+	jobs.started(slow);
+	Answer short_wait;
+	jobs.watch(slow, 100ms, short_wait.watcher());
+	view = short_wait.await(2s);
+	check(view && view->state == JobState::RUNNING, "watcher is answered when its wait runs out");
+
+	// Asked to wait a minute, but the store caps it at max_wait_sec.
+	Answer capped;
+	auto start = std::chrono::steady_clock::now();
+	jobs.watch(slow, 60s, capped.watcher());
+	check(capped.await(5s).has_value() && std::chrono::steady_clock::now() - start < 5s, "wait is capped");
+
+	Answer on_stop;
+	jobs.watch(slow, 10s, on_stop.watcher());
+	jobs.stop();
+	check(on_stop.answered(), "stop answers outstanding watchers");
+}
+
+void test_expiry() {
+	Logger logger = quiet_logger();
+	JobStoreConfig config;
+	config.result_ttl_sec = 1;
+	JobStore jobs(config, logger);
+	uint64_t id = jobs.create(0);
+	jobs.finish(id, Status::OK, {1});
+	check(look(jobs, id).found, "result is kept within its ttl");
+	std::this_thread::sleep_for(2500ms);
+	check(!look(jobs, id).found, "result expires after its ttl");
+	check(jobs.stats().expired == 1 && jobs.stats().result_bytes == 0, "expiry is counted");
+}
+
+void test_capacity() {
+	Logger logger = quiet_logger();
+	JobStoreConfig config;
+	config.max_jobs = 2;
+	config.max_result_bytes = 100;
+	JobStore jobs(config, logger);
+	uint64_t first = jobs.create(0);
+	uint64_t second = jobs.create(0);
+	check(jobs.create(0) == 0, "full store of unfinished jobs refuses");
+	jobs.finish(first, Status::OK, std::vector<uint8_t>(60));
+	uint64_t third = jobs.create(0);
+	check(third != 0 && !look(jobs, first).found, "oldest finished job makes room");
+	jobs.finish(second, Status::OK, std::vector<uint8_t>(60));
+	jobs.finish(third, Status::OK, std::vector<uint8_t>(60));
+	check(!look(jobs, second).found && look(jobs, third).found, "results stay within max_result_bytes");
+	uint64_t huge = jobs.create(0);
+	jobs.finish(huge, Status::OK, std::vector<uint8_t>(200));
+	JobView view = look(jobs, huge);
+	check(view.status == Status::SERVER_BUSY && view.result->empty(), "result larger than the store is dropped");
+	JobStoreStats stats = jobs.stats();
+	check(stats.refused == 1 && stats.evicted == 2, "refusals and evictions are counted");
+}
+
+void test_queued_bytes() {
+	Logger logger = quiet_logger();
+	JobStoreConfig config;
+	config.max_queued_bytes = 100;
+	JobStore jobs(config, logger);
+	uint64_t first = jobs.create(60);
+	check(first != 0, "upload within the budget is queued");
+	check(jobs.create(50) == 0, "upload past the budget is refused");
+	jobs.started(first);
+	uint64_t second = jobs.create(50);
+	check(second != 0 && jobs.stats().queued_bytes == 50, "started job gives its bytes back");
+	jobs.finish(second, Status::OK, {});
+	check(jobs.stats().queued_bytes == 0, "job finished before starting gives its bytes back");
+	jobs.finish(first, Status::OK, {});
+	check(jobs.stats().queued_bytes == 0, "bytes are given back once");
+}
+
+}  // namespace
+
+int main() {
+	test_lifecycle();
+	test_watchers();
+	test_expiry();
+	test_capacity();
+	test_queued_bytes();
+	if (failures > 0) {
+		std::cerr << failures << " check(s) failed" << std::endl;
+		return EXIT_FAILURE;
+	}
+	std::cout << "job_store_test passed" << std::endl;
+	return EXIT_SUCCESS;
+}
@@ -1,12 +1,38 @@
 #pragma once
 
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
 #include <string>
 #include <vector>
 
 #include "../../shared_memory/include/compilation_shared_data.hpp"
 #include "logger.hpp"
-#include "semaphore.hpp"
+#include "result_cache.hpp"
 #include "shared_memory.hpp"
 
-void run_compiler(const std::string& shm_name, const std::string& sem_req_name, const std::string& sem_resp_name,
-                  Logger& logger, std::atomic<bool>& running_flag);
\ No newline at end of file
+struct CompilerConfig {
+	// Jobs built in parallel; 0 means one per CPU. Capped at COMPILE_RING_SLOTS.
+	size_t workers = 0;
+	// Builds running longer are killed and reported as failed; 0 disables the limit.
+	unsigned int job_timeout_sec = 60;
+	// Build outputs are kept here, keyed by source and toolchain; a budget of 0 turns the cache off.
+	std::filesystem::path cache_dir = std::filesystem::temp_directory_path() / "compile_cache";
+	uint64_t cache_max_bytes = 512ull * 1024 * 1024;
+	// Sources and outputs of running jobs live under here; empty picks /dev/shm when present so staging stays in
+	// memory.
+	std::filesystem::path staging_dir;
+	// Object files of C++ jobs, keyed by their source and toolchain; kept under cache_dir/objects. 0 disables.
+	uint64_t object_cache_max_bytes = 256ull * 1024 * 1024;
+	// Standard headers precompiled once at startup, in this order, and force-included into submissions that include
+	// only headers from this list. Empty disables the prelude.
+	std::vector<std::string> prelude_headers = {"algorithm",     "array",         "cmath",   "cstdint", "cstdio",
+	                                            "cstdlib",       "cstring",       "functional", "iomanip", "iostream",
+	                                            "map",           "memory",        "numeric", "queue",   "set",
+	                                            "sstream",       "string",        "unordered_map", "unordered_set",
+	                                            "utility",       "vector"};
+};
+
+void run_compiler(const std::string& shm_name, const CompilerConfig& config, Logger& logger,
+                  std::atomic<bool>& running_flag);
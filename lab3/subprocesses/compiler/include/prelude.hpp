@@ -0,0 +1,15 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Returns the headers named by the #include <...> lines that open source, or nullopt when the file has any other
+// #include, since the prelude would then be seen out of order.
+std::optional<std::vector<std::string>> include_prologue(std::string_view source);
+
+// Whether the precompiled prelude of prelude_headers may be force-included into source: it opens with at least one
+// #include <...>, includes nothing else, and every header it names is in the prelude. The prelude's other headers
+// become visible to it too, which standard headers tolerate.
+bool prelude_covers(const std::vector<std::string>& prelude_headers, std::string_view source);
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <list>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <unordered_map>
+
+#include "../../shared_memory/include/compilation_shared_data.hpp"
+#include "logger.hpp"
+#include "sha256.hpp"
+
+// Hands out a buffer for an output of the given size; an empty span when there is no room.
+using OutputAllocator = std::function<std::span<uint8_t>(size_t size)>;
+
+// Content-addressed store of build outputs on disk. An entry is keyed by the SHA-256 of the source, its extension
+// and the digest of the toolchain script that builds it, so editing a script invalidates everything it produced.
+// Least recently used entries are evicted once the total size exceeds the budget. Thread-safe.
+class ResultCache {
+   public:
+	// toolchains maps a source extension (".cpp") to the script that builds it. Entries already in dir are picked
+	// up, oldest modification time first in line for eviction.
+	ResultCache(const std::filesystem::path& dir, uint64_t max_bytes,
+	            const std::map<std::string, std::filesystem::path>& toolchains, CompileCacheStats& stats,
+	            Logger& logger);
+
+	std::string key(std::span<const uint8_t> source, const std::string& extension) const;
+
+	// Reads the cached output for key into the buffer allocate returns for its size; nullopt on a miss or when
+	// allocate comes back with less room than asked for.
+	std::optional<size_t> lookup(const std::string& key, const OutputAllocator& allocate);
+
+	// Copies the cached output for key to dest; false on a miss.
+	bool fetch(const std::string& key, const std::filesystem::path& dest);
+
+	// Copies a freshly built output into the cache.
+	void store(const std::string& key, const std::filesystem::path& output);
+
+   private:
+	struct Entry {
+		uint64_t size;
+		std::list<std::string>::iterator lru_pos;
+	};
+
+	Sha256 keyed(const std::string& extension) const;
+	// Marks key as just used; false (counted as a miss) when it is not cached or larger than max_size.
+	bool touch(const std::string& key, uint64_t max_size, uint64_t& size);
+	void dropBroken(const std::string& key);
+
+	void evictLocked();
+	void forgetLocked(const std::string& key);
+	void publishLocked();
+
+	std::filesystem::path dir_;
+	uint64_t max_bytes_;
+	std::map<std::string, std::string> toolchain_digests_;
+	CompileCacheStats& stats_;
+	Logger& logger_;
+
+	std::mutex mutex_;
+	// Most recently used at the front.
+	std::list<std::string> lru_;
+	std::unordered_map<std::string, Entry> entries_;
+	uint64_t bytes_;
+};
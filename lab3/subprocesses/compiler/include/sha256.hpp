@@ -0,0 +1,31 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+
+// Incremental SHA-256 (FIPS 180-4).
+class Sha256 {
+   public:
+	using Digest = std::array<uint8_t, 32>;
+
+	Sha256();
+
+	void update(std::span<const uint8_t> data);
+	void update(const std::string& data);
+
+	// Finalises the hash; the object must not be updated afterwards.
+	Digest finish();
+
+	static std::string hex(const Digest& digest);
+
+   private:
+	void transform(const uint8_t* block);
+
+	std::array<uint32_t, 8> state_;
+	std::array<uint8_t, 64> buffer_;
+	size_t buffered_;
+	uint64_t total_bytes_;
+};
@@ -1,15 +1,37 @@
 #!/bin/bash
 
+# compile_cpp.sh SOURCE OUTPUT [PRELUDE]        source -> executable
+# compile_cpp.sh -c SOURCE OUTPUT [PRELUDE]     source -> object file
+# compile_cpp.sh -l OBJECT OUTPUT               object file -> executable
+# compile_cpp.sh -h HEADER OUTPUT               header -> precompiled header
+# PRELUDE is force-included first; g++ picks up PRELUDE.gch next to it when present. A precompiled header is only
+# used with the flags it was built with, so every mode shares CXXFLAGS.
 
-if [ ! $# -eq 2 ];then
+CXX=g++
+CXXFLAGS=()
+
+mode=""
+case "$1" in
+    -c|-l|-h) mode="$1"; shift ;;
+esac
+
+if [ $# -lt 2 ] || [ $# -gt 3 ]; then
     exit 1
 fi
 
 filename="$1"
+prelude=()
+if [ $# -eq 3 ]; then
+    prelude=(-include "$3")
+fi
 
 if [ -f "$filename" ]; then
-#  g++ main.cpp -o main
-    g++ "$filename" "-o" "$2"
+    case "$mode" in
+        "") exec $CXX "${CXXFLAGS[@]}" "${prelude[@]}" "$filename" "-o" "$2" ;;
+        -c) exec $CXX "${CXXFLAGS[@]}" -c "${prelude[@]}" "$filename" "-o" "$2" ;;
+        -l) exec $CXX "$filename" "-o" "$2" ;;
+        -h) exec $CXX "${CXXFLAGS[@]}" -x c++-header "$filename" "-o" "$2" ;;
+    esac
 else
   exit 1
 fi
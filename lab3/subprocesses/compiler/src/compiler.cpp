@@ -1,191 +1,718 @@
 #include "compiler.hpp"
 
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
 #include <chrono>
 #include <cstdlib>
 #include <cstring>
 #include <filesystem>
-#include <fstream>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <optional>
+#include <span>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <system_error>
 #include <thread>
 #include <vector>
 
+#include "prelude.hpp"
+
 namespace fs = std::filesystem;
 
-void run_compiler(const std::string &shm_name, const std::string &sem_req_name, const std::string &sem_resp_name,
-                  Logger &logger, std::atomic<bool> &running_flag) {
-    SharedMemory shm(shm_name, sizeof(CompilationSharedData), false, logger);
-    Semaphore sem_req(sem_req_name, 0, logger);
-    Semaphore sem_resp(sem_resp_name, 0, logger);
+namespace {
 
-    auto data = reinterpret_cast<CompilationSharedData *>(shm.data());
+constexpr int COMMAND_FAILED = -1;
+constexpr int COMMAND_TIMED_OUT = -2;
+constexpr unsigned int PRELUDE_BUILD_TIMEOUT_SEC = 300;
+constexpr long HEARTBEAT_INTERVAL_MS = 500;
+// Object cache entries built with the prelude force-included are kept apart from those built without it, under the
+// same toolchain script.
+constexpr auto CPP_WITH_PRELUDE = ".cpp+prelude";
 
-    logger.info("Compilation subserver started and connected to IPC.");
-    logger.info("Waiting for compilation requests...");
+// Waits for pid to exit for at most timeout_ms (negative: no limit). Returns false on timeout.
+bool wait_for_exit(pid_t pid, int timeout_ms, int &wait_status) {
+    int pidfd = static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+    if (pidfd >= 0) {
+        pollfd pfd{pidfd, POLLIN, 0};
+        int ready;
+        do {
+            ready = poll(&pfd, 1, timeout_ms);
+        } while (ready < 0 && errno == EINTR);
+        ::close(pidfd);
+        if (ready == 0) {
+            return false;
+        }
+        return waitpid(pid, &wait_status, 0) == pid;
+    }
+    // Kernels without pidfd_open: poll the child instead.
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    while (true) {
+        pid_t done = waitpid(pid, &wait_status, WNOHANG);
+        if (done == pid) {
+            return true;
+        }
+        if (done < 0 && errno != EINTR) {
+            return true;
+        }
+        if (timeout_ms >= 0 && std::chrono::steady_clock::now() >= deadline) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+}
 
-    std::string cpp_script_path = "./compile_cpp.sh";
-    std::string tex_script_path = "./compile_tex.sh";
+int remaining_ms(const std::optional<std::chrono::steady_clock::time_point> &deadline) {
+    if (!deadline) {
+        return -1;
+    }
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(*deadline - std::chrono::steady_clock::now());
+    return static_cast<int>(std::max<int64_t>(left.count(), 0));
+}
 
-    if (!fs::exists(cpp_script_path)) {
-        logger.warning("compile_cpp.sh not found at " + cpp_script_path);
+// Time budget shared by every toolchain step of one job.
+struct Deadline {
+    explicit Deadline(unsigned int timeout_sec, std::atomic<int32_t> *group = nullptr)
+        : seconds(timeout_sec), running_group(group) {
+        if (timeout_sec > 0) {
+            at = std::chrono::steady_clock::now() + std::chrono::seconds(timeout_sec);
+        }
     }
-    if (!fs::exists(tex_script_path)) {
-        logger.warning("compile_tex.sh not found at " + tex_script_path);
+
+    std::optional<std::chrono::steady_clock::time_point> at;
+    unsigned int seconds;
+    // Where the process group of the running step is published, so the server's supervisor can clean up after a
+    // compiler that died mid-build.
+    std::atomic<int32_t> *running_group;
+};
+
+struct CommandResult {
+    // Exit status of the script, or COMMAND_FAILED / COMMAND_TIMED_OUT.
+    int exit_code = COMMAND_FAILED;
+    // What the toolchain printed on stdout and stderr, truncated to MAX_DIAGNOSTICS_SIZE.
+    std::string output;
+};
+
+// Launches script with args via posix_spawn (no shell in between) in its own process group, collecting its output
+// through a pipe. When the build outlives the deadline, the whole group is killed.
+CommandResult run_toolchain(const std::string &script, const std::vector<std::string> &args,
+                            const Deadline &deadline, Logger &logger) {
+    CommandResult result;
+    int out_pipe[2];
+    if (pipe2(out_pipe, O_CLOEXEC) < 0) {
+        logger.error("Compiler: pipe2() failed: " + std::string(strerror(errno)));
+        result.output = "internal error: cannot create output pipe";
+        return result;
     }
 
-    while (running_flag.load()) {
-        logger.debug("Compiler: Waiting for request semaphore (sem_req)...");
-        try {
-            sem_req.wait();
-        } catch (const SemaphoreException &e) {
-            if (!running_flag.load()) {
-                logger.info("Compiler: sem_req.wait() interrupted by shutdown signal.");
-                break;
-            }
-            logger.error("Compiler: SemaphoreException on sem_req.wait(): " + std::string(e.what()));
-            std::this_thread::sleep_for(std::chrono::seconds(1));
+    // dup2 clears close-on-exec on the targets, so only stdout/stderr reach the child.
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_adddup2(&actions, out_pipe[1], STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, out_pipe[1], STDERR_FILENO);
+
+    // Worker threads block the shutdown signals; the build must not inherit that.
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    sigset_t no_signals;
+    sigemptyset(&no_signals);
+    posix_spawnattr_setsigmask(&attr, &no_signals);
+    posix_spawnattr_setpgroup(&attr, 0);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK);
+
+    std::vector<char *> argv;
+    argv.push_back(const_cast<char *>(script.c_str()));
+    for (const auto &arg : args) {
+        argv.push_back(const_cast<char *>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+
+    pid_t pid;
+    int spawn_error = posix_spawn(&pid, script.c_str(), &actions, &attr, argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    ::close(out_pipe[1]);
+    if (spawn_error != 0) {
+        ::close(out_pipe[0]);
+        logger.error("Compiler: posix_spawn(" + script + ") failed: " + std::string(strerror(spawn_error)));
+        result.output = "cannot launch " + script + ": " + strerror(spawn_error);
+        return result;
+    }
+
+    if (deadline.running_group) {
+        deadline.running_group->store(pid);
+    }
+
+    // The pipe reaches EOF once the script and everything it started have exited or closed their output.
+    bool timed_out = false;
+    char buf[4096];
+    while (true) {
+        pollfd pfd{out_pipe[0], POLLIN, 0};
+        int ready = poll(&pfd, 1, remaining_ms(deadline.at));
+        if (ready < 0 && errno == EINTR) {
             continue;
         }
-
-        if (!running_flag.load()) {
-            logger.info("Compiler: Shutdown signal received after sem_req.wait().");
+        if (ready == 0) {
+            timed_out = true;
+            break;
+        }
+        ssize_t got = ::read(out_pipe[0], buf, sizeof(buf));
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
             break;
         }
+        size_t keep = std::min(static_cast<size_t>(got), MAX_DIAGNOSTICS_SIZE - result.output.size());
+        result.output.append(buf, keep);
+    }
+    ::close(out_pipe[0]);
 
-        logger.debug("Compiler: Request semaphore acquired. Processing request.");
+    int wait_status = 0;
+    if (timed_out || !wait_for_exit(pid, remaining_ms(deadline.at), wait_status)) {
+        logger.error("Compiler: Job exceeded " + std::to_string(deadline.seconds) + " s, killing process group " +
+                     std::to_string(pid));
+        kill(-pid, SIGKILL);
+        waitpid(pid, &wait_status, 0);
+        if (deadline.running_group) {
+            deadline.running_group->store(0);
+        }
+        result.exit_code = COMMAND_TIMED_OUT;
+        result.output += "\nbuild timed out after " + std::to_string(deadline.seconds) + " s";
+        return result;
+    }
+    if (deadline.running_group) {
+        deadline.running_group->store(0);
+    }
+    if (WIFEXITED(wait_status)) {
+        result.exit_code = WEXITSTATUS(wait_status);
+        return result;
+    }
+    int signal_number = WIFSIGNALED(wait_status) ? WTERMSIG(wait_status) : 0;
+    logger.warning("Compiler: Toolchain terminated by signal " + std::to_string(signal_number));
+    result.output += "\nbuild killed by signal " + std::to_string(signal_number);
+    return result;
+}
+
+// What a job came to, kept apart from its slot until it is published there.
+struct JobResult {
+    CompileStatus status = CompileStatus::FAILURE;
+    uint64_t offset = ShmArena::NONE;
+    uint64_t size = 0;
+};
+
+// Marks the job failed and leaves a message for the client in the result region. Without room in the arena the
+// client only learns that the build failed.
+void fail(JobResult &result, ShmArena &arena, const std::string &diagnostics) {
+    size_t size = std::min(diagnostics.size(), MAX_DIAGNOSTICS_SIZE);
+    arena.free(result.offset);
+    result.offset = arena.allocate(size);
+    result.size = result.offset == ShmArena::NONE ? 0 : size;
+    if (result.size > 0) {
+        std::memcpy(arena.at(result.offset), diagnostics.data(), size);
+    }
+    result.status = CompileStatus::FAILURE;
+}
+
+// Hands the result to the server and posts done, unless the server's supervisor has failed the job meanwhile; its
+// result region is freed then. Returns whether the result was published.
+bool publish(CompileSlot &slot, uint64_t ticket, JobResult &result, ShmArena &arena) {
+    if (!slot.running_ticket.compare_exchange_strong(ticket, 0, std::memory_order_acq_rel)) {
+        arena.free(result.offset);
+        return false;
+    }
+    slot.result_offset = result.offset;
+    slot.result_size = result.size;
+    slot.status.store(result.status, std::memory_order_release);
+    slot.done.post();
+    return true;
+}
+
+// Claims the oldest queued job, or returns COMPILE_RING_SLOTS when there is none.
+size_t claim_next_job(CompilationSharedData &ring) {
+    while (true) {
+        size_t oldest = COMPILE_RING_SLOTS;
+        for (size_t i = 0; i < COMPILE_RING_SLOTS; ++i) {
+            if (ring.slots[i].status.load(std::memory_order_acquire) == CompileStatus::PENDING &&
+                (oldest == COMPILE_RING_SLOTS || ring.slots[i].ticket < ring.slots[oldest].ticket)) {
+                oldest = i;
+            }
+        }
+        if (oldest == COMPILE_RING_SLOTS) {
+            return oldest;
+        }
+        CompileStatus expected = CompileStatus::PENDING;
+        if (ring.slots[oldest].status.compare_exchange_strong(expected, CompileStatus::RUNNING,
+                                                              std::memory_order_acq_rel)) {
+            return oldest;
+        }
+    }
+}
 
-        if (data->status != CompileStatus::PENDING) {
-            logger.warning("Compiler: Received request with non-PENDING status (" +
-                           std::to_string(static_cast<int>(data->status)) + ")");
-            sem_resp.post();
+// Writes the whole buffer to a new file; returns false on any error.
+bool write_file(const fs::path &path, const uint8_t *data, size_t size) {
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return false;
+    }
+    while (size > 0) {
+        ssize_t written = ::write(fd, data, size);
+        if (written < 0 && errno == EINTR) {
             continue;
         }
+        if (written <= 0) {
+            ::close(fd);
+            return false;
+        }
+        data += written;
+        size -= static_cast<size_t>(written);
+    }
+    return ::close(fd) == 0;
+}
 
-        std::string filename_from_shm(data->file_name);
-        size_t file_size = data->file_size;
-        if (file_size > MAX_FILE_SIZE) {
-            logger.error("Compiler: Input file '" + filename_from_shm + "' is too large (" + std::to_string(file_size) +
-                         " bytes). Max allowed: " + std::to_string(MAX_FILE_SIZE) + " bytes.");
-            data->status = CompileStatus::FAILURE;
-            sem_resp.post();
+// Reads a build output straight into the region allocate hands out for it. Returns its size, or nullopt when it is
+// missing, unreadable or allocate has no room (no_room is set then).
+std::optional<size_t> read_output(const fs::path &path, const OutputAllocator &allocate, bool &no_room) {
+    no_room = false;
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return std::nullopt;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        ::close(fd);
+        return std::nullopt;
+    }
+    size_t size = static_cast<size_t>(st.st_size);
+    std::span<uint8_t> out = allocate(size);
+    if (out.size() < size) {
+        no_room = true;
+        ::close(fd);
+        return std::nullopt;
+    }
+    size_t done = 0;
+    while (done < size) {
+        ssize_t got = ::read(fd, out.data() + done, size - done);
+        if (got < 0 && errno == EINTR) {
             continue;
         }
-        std::vector<uint8_t> file_buffer(data->file_data, data->file_data + file_size);
+        if (got <= 0) {
+            ::close(fd);
+            return std::nullopt;
+        }
+        done += static_cast<size_t>(got);
+    }
+    ::close(fd);
+    return size;
+}
 
-        logger.info(
-            "Compiler: Processing file: '" + filename_from_shm + "', size: " + std::to_string(file_size) + " bytes.");
+// A precompiled prelude of commonly used standard headers. It is built in the background at startup; until it is
+// ready jobs compile without it.
+struct PrecompiledPrelude {
+    // In the order the prelude includes them.
+    std::vector<std::string> headers;
+    fs::path header;
+    std::atomic<bool> ready{false};
+};
 
-        fs::path source_file_original_path(filename_from_shm);
+// Jobs compile without the prelude until it has been built.
+bool prelude_fits(const PrecompiledPrelude &prelude, std::string_view source) {
+    return prelude.ready.load(std::memory_order_acquire) && prelude_covers(prelude.headers, source);
+}
 
-        std::string temp_input_filename = "compiler_input_" + source_file_original_path.filename().string();
-        fs::path temp_input_full_path = fs::temp_directory_path() / temp_input_filename;
+void build_prelude(PrecompiledPrelude &prelude, const std::string &script, Logger &logger) {
+    std::string text;
+    for (const auto &header : prelude.headers) {
+        text += "#include <" + header + ">\n";
+    }
+    fs::path staged = prelude.header.string() + ".gch.tmp";
+    std::error_code ec;
+    fs::create_directories(prelude.header.parent_path(), ec);
+    if (ec || !write_file(prelude.header, reinterpret_cast<const uint8_t *>(text.data()), text.size())) {
+        logger.warning("Compiler: Cannot write precompiled prelude " + prelude.header.string());
+        return;
+    }
 
-        std::ofstream temp_ofs(temp_input_full_path, std::ios::binary | std::ios::trunc);
-        if (!temp_ofs) {
-            logger.error("Compiler: Failed to create/open temporary input file: " + temp_input_full_path.string());
-            data->status = CompileStatus::FAILURE;
-            sem_resp.post();
-            continue;
+    auto started = std::chrono::steady_clock::now();
+    CommandResult built =
+        run_toolchain(script, {"-h", prelude.header.string(), staged.string()}, Deadline(PRELUDE_BUILD_TIMEOUT_SEC),
+                      logger);
+    if (built.exit_code != 0) {
+        logger.warning("Compiler: Precompiling the prelude failed, building without it:\n" + built.output);
+        fs::remove(staged, ec);
+        return;
+    }
+    fs::rename(staged, prelude.header.string() + ".gch", ec);
+    if (ec) {
+        logger.warning("Compiler: Cannot install precompiled prelude: " + ec.message());
+        return;
+    }
+    prelude.ready.store(true, std::memory_order_release);
+    auto took = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started);
+    logger.info("Compiler: Precompiled prelude of " + std::to_string(prelude.headers.size()) + " headers ready in " +
+                std::to_string(took.count()) + " ms.");
+}
+
+// What every job needs besides its slot.
+struct JobEnv {
+    std::string cpp_script_path;
+    std::string tex_script_path;
+    unsigned int timeout_sec;
+    ResultCache *cache;
+    ShmArena *arena;
+    // Both optional: the shared prelude for .cpp jobs and the cache of their object files.
+    PrecompiledPrelude *prelude;
+    ResultCache *objects;
+    // Per-job directories are created here, preferably on tmpfs.
+    fs::path staging_dir;
+};
+
+// Builds source into output. With an object cache the object file is looked up by the source text, the toolchain
+// script, which holds the flags, and whether the prelude was force-included, and reused when there is one, so only
+// the link step is left.
+//
+// Keying on the preprocessed source also caught sources that differ only in comments or layout, but its extra -E
+// pass cost 35-55 ms on every job, hit or miss, against 0.35-0.65 s for the compile a hit saves.
+CommandResult build_cpp(const fs::path &source, std::string_view source_text, const fs::path &output,
+                        const JobEnv &env, const Deadline &deadline, Logger &logger) {
+    std::vector<std::string> prelude;
+    if (env.prelude && prelude_fits(*env.prelude, source_text)) {
+        prelude.push_back(env.prelude->header.string());
+        logger.debug("Compiler: Using the precompiled prelude for " + source.filename().string());
+    }
+    auto with_prelude = [&](std::vector<std::string> args) {
+        args.insert(args.end(), prelude.begin(), prelude.end());
+        return args;
+    };
+    if (!env.objects) {
+        return run_toolchain(env.cpp_script_path, with_prelude({source.string(), output.string()}), deadline, logger);
+    }
+
+    std::string key = env.objects->key({reinterpret_cast<const uint8_t *>(source_text.data()), source_text.size()},
+                                       prelude.empty() ? ".cpp" : CPP_WITH_PRELUDE);
+    fs::path object = output.parent_path() / "source.o";
+    if (env.objects->fetch(key, object)) {
+        logger.debug("Compiler: Object cache hit for " + source.filename().string());
+    } else {
+        CommandResult compiled = run_toolchain(
+            env.cpp_script_path, with_prelude({"-c", source.string(), object.string()}), deadline, logger);
+        if (compiled.exit_code != 0) {
+            return compiled;
+        }
+        env.objects->store(key, object);
+    }
+    return run_toolchain(env.cpp_script_path, {"-l", object.string(), output.string()}, deadline, logger);
+}
+
+// Builds the source held in slot into result. The source is written once from its arena region into a private
+// staging directory and the output is read straight back into a result region sized to fit, with no intermediate
+// buffers.
+void compile_job(CompileSlot &slot, size_t index, const JobEnv &env, JobResult &result, Logger &logger) {
+    ShmArena &arena = *env.arena;
+    std::string filename_from_shm(slot.file_name);
+    size_t file_size = slot.file_size;
+    const uint8_t *source = file_size > 0 ? arena.at(slot.file_offset) : nullptr;
+    auto allocate_result = [&](size_t size) -> std::span<uint8_t> {
+        arena.free(result.offset);
+        result.offset = arena.allocate(size);
+        if (result.offset == ShmArena::NONE) {
+            return {};
         }
-        temp_ofs.write(reinterpret_cast<const char *>(file_buffer.data()), file_size);
-        temp_ofs.close();
+        return {arena.at(result.offset), size};
+    };
 
+    logger.info(
+        "Compiler: Processing file: '" + filename_from_shm + "', size: " + std::to_string(file_size) + " bytes.");
 
-        std::string output_filename_stem = "compiled_" + source_file_original_path.stem().string();
+    fs::path source_name = fs::path(filename_from_shm).filename();
+    if (source_name.empty() || source_name == "." || source_name == "..") {
+        logger.error("Compiler: Invalid file name '" + filename_from_shm + "'.");
+        fail(result, arena, "invalid file name");
+        return;
+    }
+    std::string extension = source_name.extension().string();
+    if (extension != ".cpp" && extension != ".tex") {
+        logger.error("Compiler: Unsupported file extension: '" + extension + "' for file '" + filename_from_shm +
+                     "'.");
+        fail(result, arena, "unsupported file extension '" + extension + "'");
+        return;
+    }
 
-        fs::path final_output_path_to_check;
-        std::string command_to_execute;
+    std::string cache_key;
+    if (env.cache) {
+        cache_key = env.cache->key({source, file_size}, extension);
+        if (auto cached_size = env.cache->lookup(cache_key, allocate_result)) {
+            result.size = *cached_size;
+            result.status = CompileStatus::SUCCESS;
+            logger.info("Compiler: Cache hit for '" + filename_from_shm + "'. Result size: " +
+                        std::to_string(result.size) + " bytes.");
+            return;
+        }
+    }
 
-        if (source_file_original_path.extension() == ".cpp") {
-            final_output_path_to_check = fs::temp_directory_path() / output_filename_stem;
+    // Tickets are unique for the life of the ring, so concurrent jobs never share a directory and the source keeps
+    // its own name in the toolchain's messages.
+    fs::path job_dir = env.staging_dir / ("job-" + std::to_string(slot.ticket) + "-" + std::to_string(index));
+    std::error_code ec;
+    fs::create_directory(job_dir, ec);
+    fs::path input_path = job_dir / source_name;
+    if (ec || !write_file(input_path, source, file_size)) {
+        logger.error("Compiler: Failed to stage input file: " + input_path.string());
+        fail(result, arena, "internal error: cannot stage input file");
+        fs::remove_all(job_dir, ec);
+        return;
+    }
 
-            command_to_execute =
-                    cpp_script_path + " \"" + temp_input_full_path.string() + "\" \"" + final_output_path_to_check.
-                    string() + "\"";
-        } else if (source_file_original_path.extension() == ".tex") {
-            fs::path tex_output_base_path = fs::temp_directory_path() / output_filename_stem;
-            final_output_path_to_check = tex_output_base_path.string() + ".pdf";
+    fs::path output_base = job_dir / source_name.stem();
+    fs::path output_path;
+    CommandResult build;
+    Deadline deadline(env.timeout_sec, &slot.toolchain_group);
+    if (extension == ".cpp") {
+        output_path = output_base;
+        logger.debug("Compiler: Building C++ source '" + filename_from_shm + "'");
+        build = build_cpp(input_path, {reinterpret_cast<const char *>(source), file_size}, output_path, env,
+                          deadline, logger);
+    } else {
+        output_path = output_base.string() + ".pdf";
+        logger.debug("Compiler: Running " + env.tex_script_path + " for '" + filename_from_shm + "'");
+        build = run_toolchain(env.tex_script_path, {input_path.string(), output_base.string()}, deadline, logger);
+    }
 
-            command_to_execute =
-                    tex_script_path + " \"" + temp_input_full_path.string() + "\" \"" + tex_output_base_path.string() +
-                    "\"";
-        } else {
-            logger.error("Compiler: Unsupported file extension: '" + source_file_original_path.extension().string() +
-                         "' for file '" + filename_from_shm + "'.");
-            data->status = CompileStatus::FAILURE;
-            sem_resp.post();
-            if (fs::exists(temp_input_full_path)) {
-                fs::remove(temp_input_full_path);
-            }
+    bool no_room = false;
+    std::optional<size_t> result_size;
+    if (build.exit_code == 0) {
+        result_size = read_output(output_path, allocate_result, no_room);
+    }
+    if (result_size) {
+        result.size = *result_size;
+        result.status = CompileStatus::SUCCESS;
+        logger.info("Compiler: Compilation successful for '" + filename_from_shm +
+                    "'. Result size: " + std::to_string(result.size) + " bytes.");
+        if (env.cache) {
+            env.cache->store(cache_key, output_path);
+        }
+    } else if (no_room) {
+        logger.error("Compiler: Compiled result file '" + output_path.string() +
+                     "' does not fit in the free part of the compile arena.");
+        fail(result, arena, "build output too large for the server's compile arena");
+    } else {
+        logger.error("Compiler: Compilation command failed for '" + filename_from_shm + "'. Exit code: " +
+                     std::to_string(build.exit_code) + ". Expected output: '" + output_path.string());
+        fail(result, arena, build.output.empty() ? "build failed without output" : build.output);
+    }
+
+    fs::remove_all(job_dir, ec);
+    if (ec) {
+        logger.warning("Compiler: Failed to remove staging directory " + job_dir.string() + ": " + ec.message());
+    }
+}
+
+size_t resolve_workers(const CompilerConfig &config) {
+    size_t workers = config.workers;
+    if (workers == 0) {
+        workers = std::max(1u, std::thread::hardware_concurrency());
+    }
+    // Every running job occupies a ring slot, so more workers than slots would only sit idle.
+    return std::min(workers, COMPILE_RING_SLOTS);
+}
+
+// Staging directories are named after the compiler's pid; those of compilers that died are removed.
+void remove_stale_staging(const fs::path &base, Logger &logger) {
+    const std::string prefix = "compiler-staging-";
+    std::error_code ec;
+    for (const auto &entry : fs::directory_iterator(base, ec)) {
+        std::string name = entry.path().filename().string();
+        if (!name.starts_with(prefix)) {
             continue;
         }
+        pid_t owner = static_cast<pid_t>(std::strtol(name.c_str() + prefix.size(), nullptr, 10));
+        if (owner > 0 && kill(owner, 0) < 0 && errno == ESRCH) {
+            logger.info("Compiler: Removing staging directory of dead compiler " + std::to_string(owner));
+            fs::remove_all(entry.path(), ec);
+        }
+    }
+}
+
+fs::path resolve_staging_dir(const CompilerConfig &config) {
+    if (!config.staging_dir.empty()) {
+        return config.staging_dir;
+    }
+    std::error_code ec;
+    if (fs::is_directory("/dev/shm", ec)) {
+        return "/dev/shm";
+    }
+    return fs::temp_directory_path();
+}
+
+}  // namespace
 
-        logger.debug("Compiler: Executing command: " + command_to_execute);
-        int system_ret_code = system(command_to_execute.c_str());
-
-
-        if (system_ret_code == 0 && fs::exists(final_output_path_to_check)) {
-            logger.info("Compiler: Command executed successfully for '" + filename_from_shm +
-                        "'. Output file: " + final_output_path_to_check.string());
-
-            std::uintmax_t result_fs_size_uintmax = fs::file_size(final_output_path_to_check);
-            if (result_fs_size_uintmax > MAX_RESULT_SIZE) {
-                logger.error(
-                    "Compiler: Compiled result file '" + final_output_path_to_check.string() + "' is too large (" +
-                    std::to_string(result_fs_size_uintmax) +
-                    " bytes). Max allowed: " + std::to_string(MAX_RESULT_SIZE) + " bytes.");
-                data->status = CompileStatus::FAILURE;
-            } else {
-                size_t result_file_size = static_cast<size_t>(result_fs_size_uintmax);
-                std::ifstream result_ifs(final_output_path_to_check, std::ios::binary);
-                if (!result_ifs) {
-                    logger.error(
-                        "Compiler: Failed to open compiled result file '" + final_output_path_to_check.string());
-                    data->status = CompileStatus::FAILURE;
-                } else {
-                    std::vector<uint8_t> result_buffer(result_file_size);
-                    if (!result_ifs.read(reinterpret_cast<char *>(result_buffer.data()), result_file_size)) {
-                        logger.error("Compiler: Failed to read content from compiled result file '" +
-                                     final_output_path_to_check.string() + "'.");
-                        data->status = CompileStatus::FAILURE;
-                    } else {
-                        data->result_size = static_cast<uint32_t>(result_buffer.size());
-                        std::memcpy(data->result_data, result_buffer.data(), result_buffer.size());
-                        data->status = CompileStatus::SUCCESS;
-                        logger.info("Compiler: Compilation successful for '" + filename_from_shm +
-                                    "'. Result size: " + std::to_string(data->result_size) + " bytes.");
-                    }
-                    result_ifs.close();
+void run_compiler(const std::string &shm_name, const CompilerConfig &config, Logger &logger,
+                  std::atomic<bool> &running_flag) {
+    SharedMemory shm(shm_name, 0, false, logger);
+    auto ring = reinterpret_cast<CompilationSharedData *>(shm.data());
+    ShmArena arena = ShmArena::attach(compile_arena(ring));
+    size_t workers = resolve_workers(config);
+
+    logger.info("Compilation subserver started and connected to IPC (" + std::to_string(COMPILE_RING_SLOTS) +
+                " slots, " + std::to_string(workers) + " workers, job timeout " +
+                std::to_string(config.job_timeout_sec) + " s).");
+    logger.info("Waiting for compilation requests...");
+
+    fs::path staging_base = resolve_staging_dir(config);
+    remove_stale_staging(staging_base, logger);
+    JobEnv env{"./compile_cpp.sh", "./compile_tex.sh", config.job_timeout_sec, nullptr, &arena, nullptr, nullptr,
+               staging_base / ("compiler-staging-" + std::to_string(getpid()))};
+    std::error_code staging_ec;
+    fs::create_directories(env.staging_dir, staging_ec);
+    if (staging_ec) {
+        throw std::runtime_error("cannot create staging directory " + env.staging_dir.string() + ": " +
+                                 staging_ec.message());
+    }
+    logger.info("Compiler: Staging jobs in " + env.staging_dir.string());
+
+    if (!fs::exists(env.cpp_script_path)) {
+        logger.warning("compile_cpp.sh not found at " + env.cpp_script_path);
+    }
+    if (!fs::exists(env.tex_script_path)) {
+        logger.warning("compile_tex.sh not found at " + env.tex_script_path);
+    }
+
+    std::unique_ptr<ResultCache> cache;
+    if (config.cache_max_bytes > 0) {
+        cache = std::make_unique<ResultCache>(
+                config.cache_dir, config.cache_max_bytes,
+                std::map<std::string, fs::path>{{".cpp", env.cpp_script_path}, {".tex", env.tex_script_path}},
+                ring->cache, logger);
+        env.cache = cache.get();
+    }
+    std::unique_ptr<ResultCache> objects;
+    if (config.object_cache_max_bytes > 0) {
+        std::map<std::string, fs::path> toolchains{{".cpp", env.cpp_script_path},
+                                                   {CPP_WITH_PRELUDE, env.cpp_script_path}};
+        objects = std::make_unique<ResultCache>(config.cache_dir / "objects", config.object_cache_max_bytes,
+                                                toolchains, ring->objects, logger);
+        env.objects = objects.get();
+    }
+
+    PrecompiledPrelude prelude;
+    for (const auto &header : config.prelude_headers) {
+        if (std::find(prelude.headers.begin(), prelude.headers.end(), header) == prelude.headers.end()) {
+            prelude.headers.push_back(header);
+        }
+    }
+    prelude.header = env.staging_dir / "prelude" / "prelude.hpp";
+    if (!prelude.headers.empty()) {
+        env.prelude = &prelude;
+    }
+
+    auto worker_loop = [&](size_t worker_id) {
+        std::string tag = "Compiler worker " + std::to_string(worker_id);
+        while (running_flag.load()) {
+            try {
+                ring->requests.wait();
+            } catch (const SemaphoreException &e) {
+                if (!running_flag.load()) {
+                    break;
                 }
+                logger.error(tag + ": SemaphoreException on requests.wait(): " + std::string(e.what()));
+                std::this_thread::sleep_for(std::chrono::seconds(1));
+                continue;
             }
-        } else {
-            logger.error("Compiler: Compilation command failed for '" + filename_from_shm + "'. System return code: " +
-                         std::to_string(system_ret_code) + ". Expected output: '" + final_output_path_to_check.string());
-            data->status = CompileStatus::FAILURE;
-        }
 
-        logger.debug("Compiler: Posting response semaphore (sem_resp).");
-        sem_resp.post();
+            if (!running_flag.load()) {
+                logger.debug(tag + ": Shutdown signal received after requests.wait().");
+                break;
+            }
+
+            size_t index = claim_next_job(*ring);
+            if (index == COMPILE_RING_SLOTS) {
+                logger.warning(tag + ": Request semaphore posted but no slot is PENDING.");
+                continue;
+            }
+            CompileSlot &slot = ring->slots[index];
+            uint64_t ticket = slot.ticket;
+            slot.started_ms.store(heartbeat_clock_ms(), std::memory_order_relaxed);
+            slot.running_ticket.store(ticket, std::memory_order_release);
+            logger.debug(tag + ": Processing job in slot " + std::to_string(index) + ".");
+
+            JobResult result;
+            compile_job(slot, index, env, result, logger);
 
-        logger.debug("Compiler: Cleaning up temporary files...");
-        if (fs::exists(temp_input_full_path)) {
-            std::error_code ec;
-            fs::remove(temp_input_full_path, ec);
-            if (ec)
-                logger.warning("Compiler: Failed to remove temp input file " + temp_input_full_path.string() + ": " +
-                               ec.message());
+            logger.debug(tag + ": Posting completion semaphore for slot " + std::to_string(index) + ".");
+            if (!publish(slot, ticket, result, arena)) {
+                logger.warning(tag + ": Job " + std::to_string(ticket) + " in slot " + std::to_string(index) +
+                               " was failed by the server while it ran; its result is dropped.");
+            }
         }
-        if (fs::exists(final_output_path_to_check)) {
-            std::error_code ec;
-            fs::remove(final_output_path_to_check, ec);
-            if (ec)
-                logger.warning(
-                    "Compiler: Failed to remove final output file " + final_output_path_to_check.string() + ": " +
-                    ec.message());
+    };
+
+    // Shutdown signals are left to this thread: workers inherit the blocked mask, and the loop below takes
+    // SIGINT/SIGTERM synchronously while it keeps the heartbeat going for the server's supervisor.
+    sigset_t shutdown_signals;
+    sigset_t previous_mask;
+    sigemptyset(&shutdown_signals);
+    sigaddset(&shutdown_signals, SIGINT);
+    sigaddset(&shutdown_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &shutdown_signals, &previous_mask);
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < workers; ++i) {
+        threads.emplace_back(worker_loop, i);
+    }
+    std::thread prelude_builder;
+    if (env.prelude) {
+        prelude_builder = std::thread(build_prelude, std::ref(prelude), env.cpp_script_path, std::ref(logger));
+    }
+    CompilerHeartbeat &heartbeat = ring->heartbeat;
+    heartbeat.job_timeout_sec.store(config.job_timeout_sec);
+    heartbeat.beat_ms.store(heartbeat_clock_ms());
+    heartbeat.pid.store(getpid());
+    const timespec beat_interval{0, HEARTBEAT_INTERVAL_MS * 1000000};
+    while (running_flag.load()) {
+        heartbeat.beat_ms.store(heartbeat_clock_ms(), std::memory_order_relaxed);
+        if (sigtimedwait(&shutdown_signals, nullptr, &beat_interval) > 0) {
+            running_flag = false;
         }
-        logger.debug("Compiler: Temporary files cleaned up. Waiting for next request.");
+    }
+    pthread_sigmask(SIG_SETMASK, &previous_mask, nullptr);
+
+    logger.info("Compiler: Shutdown requested, waiting for " + std::to_string(threads.size()) + " workers.");
+    // Idle workers sit in requests.wait(); one post per worker lets each of them see the flag. Posts nobody takes
+    // only cost the next compiler a spurious wake-up.
+    for (size_t i = 0; i < threads.size(); ++i) {
+        ring->requests.post();
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    if (prelude_builder.joinable()) {
+        prelude_builder.join();
     }
 
+    if (cache) {
+        logger.info("Compiler: Result cache hits=" + std::to_string(ring->cache.hits.load()) +
+                    " misses=" + std::to_string(ring->cache.misses.load()) +
+                    " evictions=" + std::to_string(ring->cache.evictions.load()));
+    }
+    if (objects) {
+        logger.info("Compiler: Object cache hits=" + std::to_string(ring->objects.hits.load()) +
+                    " misses=" + std::to_string(ring->objects.misses.load()) +
+                    " evictions=" + std::to_string(ring->objects.evictions.load()));
+    }
+    int32_t self = getpid();
+    heartbeat.pid.compare_exchange_strong(self, 0);
+    fs::remove_all(env.staging_dir, staging_ec);
     logger.info("Compilation subserver processing loop finished. Shutting down.");
 }
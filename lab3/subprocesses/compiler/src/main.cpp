@@ -1,7 +1,11 @@
 #include <signal.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <atomic>
+#include <cstdlib>
+#include <string>
+#include <vector>
 
 #include "compiler.hpp"
 #include "logger.hpp"
@@ -16,7 +20,54 @@ void compiler_signal_handler(int signum) {
 	compiler_running_flag = false;
 }
 
-int main() {
+// "a,b,c" -> {"a", "b", "c"}; empty items are dropped.
+static std::vector<std::string> split_list(const std::string& list) {
+	std::vector<std::string> items;
+	size_t start = 0;
+	while (start <= list.size()) {
+		size_t end = std::min(list.find(',', start), list.size());
+		if (end > start) {
+			items.push_back(list.substr(start, end - start));
+		}
+		start = end + 1;
+	}
+	return items;
+}
+
+static bool parse_config(int argc, char* argv[], CompilerConfig& config) {
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		bool has_value = i + 1 < argc;
+		if (arg == "--workers" && has_value) {
+			config.workers = std::strtoul(argv[++i], nullptr, 10);
+		} else if (arg == "--job-timeout" && has_value) {
+			config.job_timeout_sec = static_cast<unsigned int>(std::strtoul(argv[++i], nullptr, 10));
+		} else if (arg == "--cache-dir" && has_value) {
+			config.cache_dir = argv[++i];
+		} else if (arg == "--cache-size-mb" && has_value) {
+			config.cache_max_bytes = std::strtoull(argv[++i], nullptr, 10) * 1024 * 1024;
+		} else if (arg == "--staging-dir" && has_value) {
+			config.staging_dir = argv[++i];
+		} else if (arg == "--object-cache-size-mb" && has_value) {
+			config.object_cache_max_bytes = std::strtoull(argv[++i], nullptr, 10) * 1024 * 1024;
+		} else if (arg == "--prelude-headers" && has_value) {
+			config.prelude_headers = split_list(argv[++i]);
+		} else {
+			app_logger.error("Unknown or incomplete argument: " + arg);
+			return false;
+		}
+	}
+	return true;
+}
+
+int main(int argc, char* argv[]) {
+	CompilerConfig config;
+	if (!parse_config(argc, argv, config)) {
+		app_logger.error("Usage: compiler [--workers N] [--job-timeout SEC] [--cache-dir DIR] [--cache-size-mb MB] "
+		                 "[--staging-dir DIR] [--object-cache-size-mb MB] [--prelude-headers H1,H2,...]");
+		return 1;
+	}
+
 	struct sigaction sa;
 	sa.sa_handler = compiler_signal_handler;
 	sigemptyset(&sa.sa_mask);
@@ -31,12 +82,10 @@ int main() {
 	}
 
 	const std::string shm_name = "/compile_shm";
-	const std::string sem_req_name = "/sem_req";
-	const std::string sem_resp_name = "/sem_resp";
 
 	app_logger.info("Compiler subserver starting.");
 	try {
-		run_compiler(shm_name, sem_req_name, sem_resp_name, app_logger, compiler_running_flag);
+		run_compiler(shm_name, config, app_logger, compiler_running_flag);
 	} catch (const IPCException& e) {
 		app_logger.error("Compiler subserver failed to initialize IPC: " + std::string(e.what()));
 		app_logger.error("Main server is running and has created the IPC objects.");
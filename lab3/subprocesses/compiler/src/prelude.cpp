@@ -0,0 +1,67 @@
+#include "prelude.hpp"
+
+#include <algorithm>
+
+std::optional<std::vector<std::string>> include_prologue(std::string_view source) {
+	std::vector<std::string> headers;
+	bool in_prologue = true;
+	bool in_comment = false;
+	while (!source.empty()) {
+		size_t end = source.find('\n');
+		std::string_view line = source.substr(0, end);
+		source = end == std::string_view::npos ? std::string_view() : source.substr(end + 1);
+
+		if (in_comment) {
+			size_t close = line.find("*/");
+			if (close == std::string_view::npos) {
+				continue;
+			}
+			line.remove_prefix(close + 2);
+			in_comment = false;
+		}
+		line.remove_prefix(std::min(line.find_first_not_of(" \t\r"), line.size()));
+		if (line.empty() || line.starts_with("//")) {
+			continue;
+		}
+		if (line.starts_with("/*")) {
+			size_t close = line.find("*/", 2);
+			if (close == std::string_view::npos) {
+				in_comment = true;
+				continue;
+			}
+			line.remove_prefix(close + 2);
+			line.remove_prefix(std::min(line.find_first_not_of(" \t\r"), line.size()));
+			if (line.empty()) {
+				continue;
+			}
+		}
+		if (!line.starts_with('#')) {
+			in_prologue = false;
+			continue;
+		}
+		line.remove_prefix(1);
+		line.remove_prefix(std::min(line.find_first_not_of(" \t"), line.size()));
+		if (!line.starts_with("include")) {
+			in_prologue = false;
+			continue;
+		}
+		line.remove_prefix(7);
+		line.remove_prefix(std::min(line.find_first_not_of(" \t"), line.size()));
+		size_t close = line.find('>');
+		if (!in_prologue || !line.starts_with('<') || close == std::string_view::npos) {
+			return std::nullopt;
+		}
+		headers.emplace_back(line.substr(1, close - 1));
+	}
+	return headers;
+}
+
+bool prelude_covers(const std::vector<std::string>& prelude_headers, std::string_view source) {
+	auto headers = include_prologue(source);
+	if (!headers || headers->empty()) {
+		return false;
+	}
+	return std::all_of(headers->begin(), headers->end(), [&prelude_headers](const std::string& header) {
+		return std::find(prelude_headers.begin(), prelude_headers.end(), header) != prelude_headers.end();
+	});
+}
@@ -0,0 +1,214 @@
+#include "result_cache.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr size_t KEY_LENGTH = 64;
+
+bool hash_file(const fs::path& path, Sha256& hash) {
+	std::ifstream in(path, std::ios::binary);
+	if (!in) {
+		return false;
+	}
+	char buf[8192];
+	while (in.read(buf, sizeof(buf)) || in.gcount() > 0) {
+		hash.update({reinterpret_cast<const uint8_t*>(buf), static_cast<size_t>(in.gcount())});
+	}
+	return !in.bad();
+}
+
+std::string file_digest(const fs::path& path) {
+	Sha256 hash;
+	return hash_file(path, hash) ? Sha256::hex(hash.finish()) : "";
+}
+
+}  // namespace
+
+ResultCache::ResultCache(const fs::path& dir, uint64_t max_bytes, const std::map<std::string, fs::path>& toolchains,
+                         CompileCacheStats& stats, Logger& logger)
+    : dir_(dir), max_bytes_(max_bytes), stats_(stats), logger_(logger), bytes_(0) {
+	for (const auto& [extension, script] : toolchains) {
+		toolchain_digests_[extension] = file_digest(script);
+	}
+
+	std::error_code ec;
+	fs::create_directories(dir_, ec);
+	if (ec) {
+		logger_.error("ResultCache: Cannot create " + dir_.string() + ": " + ec.message());
+	}
+
+	std::vector<std::pair<fs::file_time_type, fs::directory_entry>> found;
+	for (const auto& entry : fs::directory_iterator(dir_, ec)) {
+		std::string name = entry.path().filename().string();
+		if (!entry.is_regular_file()) {
+			continue;
+		}
+		if (name.size() != KEY_LENGTH) {
+			// Left behind by a store() that did not finish.
+			fs::remove(entry.path(), ec);
+			continue;
+		}
+		found.emplace_back(entry.last_write_time(ec), entry);
+	}
+	std::sort(found.begin(), found.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+
+	std::lock_guard lock(mutex_);
+	for (const auto& [mtime, entry] : found) {
+		std::string name = entry.path().filename().string();
+		uint64_t size = entry.file_size(ec);
+		lru_.push_back(name);
+		entries_[name] = {size, std::prev(lru_.end())};
+		bytes_ += size;
+	}
+	evictLocked();
+	publishLocked();
+	logger_.info("ResultCache: " + std::to_string(entries_.size()) + " entries (" + std::to_string(bytes_) +
+	             " bytes) in " + dir_.string() + ", budget " + std::to_string(max_bytes_) + " bytes");
+}
+
+Sha256 ResultCache::keyed(const std::string& extension) const {
+	Sha256 hash;
+	auto toolchain = toolchain_digests_.find(extension);
+	hash.update(extension);
+	hash.update(std::string(1, '\0'));
+	hash.update(toolchain == toolchain_digests_.end() ? std::string() : toolchain->second);
+	hash.update(std::string(1, '\0'));
+	return hash;
+}
+
+std::string ResultCache::key(std::span<const uint8_t> source, const std::string& extension) const {
+	Sha256 hash = keyed(extension);
+	hash.update(source);
+	return Sha256::hex(hash.finish());
+}
+
+bool ResultCache::touch(const std::string& key, uint64_t max_size, uint64_t& size) {
+	std::lock_guard lock(mutex_);
+	auto it = entries_.find(key);
+	if (it == entries_.end() || it->second.size > max_size) {
+		stats_.misses.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+	size = it->second.size;
+	lru_.splice(lru_.begin(), lru_, it->second.lru_pos);
+	return true;
+}
+
+void ResultCache::dropBroken(const std::string& key) {
+	logger_.warning("ResultCache: Entry " + key + " vanished or is truncated, dropping it");
+	std::lock_guard lock(mutex_);
+	forgetLocked(key);
+	stats_.misses.fetch_add(1, std::memory_order_relaxed);
+	publishLocked();
+}
+
+std::optional<size_t> ResultCache::lookup(const std::string& key, const OutputAllocator& allocate) {
+	uint64_t size;
+	if (!touch(key, max_bytes_, size)) {
+		return std::nullopt;
+	}
+	std::span<uint8_t> out = allocate(size);
+	if (out.size() < size) {
+		stats_.misses.fetch_add(1, std::memory_order_relaxed);
+		return std::nullopt;
+	}
+
+	// Read outside the lock: an eviction racing with us unlinks the file, which the open descriptor survives.
+	fs::path path = dir_ / key;
+	std::ifstream in(path, std::ios::binary);
+	if (!in || !in.read(reinterpret_cast<char*>(out.data()), static_cast<std::streamsize>(size))) {
+		dropBroken(key);
+		return std::nullopt;
+	}
+	std::error_code ec;
+	fs::last_write_time(path, fs::file_time_type::clock::now(), ec);
+	stats_.hits.fetch_add(1, std::memory_order_relaxed);
+	return size;
+}
+
+bool ResultCache::fetch(const std::string& key, const fs::path& dest) {
+	uint64_t size;
+	if (!touch(key, max_bytes_, size)) {
+		return false;
+	}
+
+	fs::path path = dir_ / key;
+	std::error_code ec;
+	fs::copy_file(path, dest, fs::copy_options::overwrite_existing, ec);
+	if (ec || fs::file_size(dest, ec) != size) {
+		dropBroken(key);
+		return false;
+	}
+	fs::last_write_time(path, fs::file_time_type::clock::now(), ec);
+	stats_.hits.fetch_add(1, std::memory_order_relaxed);
+	return true;
+}
+
+void ResultCache::store(const std::string& key, const fs::path& output) {
+	std::error_code ec;
+	uint64_t size = fs::file_size(output, ec);
+	if (ec || size > max_bytes_) {
+		return;
+	}
+	{
+		std::lock_guard lock(mutex_);
+		if (entries_.contains(key)) {
+			return;
+		}
+	}
+
+	// Copy under a private name and rename, so a concurrent lookup never sees a partial file.
+	std::hash<std::thread::id> thread_hash;
+	fs::path staging = dir_ / (key + ".tmp" + std::to_string(thread_hash(std::this_thread::get_id())));
+	fs::copy_file(output, staging, fs::copy_options::overwrite_existing, ec);
+	if (!ec) {
+		fs::rename(staging, dir_ / key, ec);
+	}
+	if (ec) {
+		logger_.warning("ResultCache: Failed to store " + key + ": " + ec.message());
+		fs::remove(staging, ec);
+		return;
+	}
+
+	std::lock_guard lock(mutex_);
+	if (!entries_.contains(key)) {
+		lru_.push_front(key);
+		entries_[key] = {size, lru_.begin()};
+		bytes_ += size;
+		evictLocked();
+	}
+	publishLocked();
+}
+
+void ResultCache::evictLocked() {
+	while (bytes_ > max_bytes_ && !lru_.empty()) {
+		std::string victim = lru_.back();
+		std::error_code ec;
+		fs::remove(dir_ / victim, ec);
+		forgetLocked(victim);
+		stats_.evictions.fetch_add(1, std::memory_order_relaxed);
+		logger_.debug("ResultCache: Evicted " + victim);
+	}
+}
+
+void ResultCache::forgetLocked(const std::string& key) {
+	auto it = entries_.find(key);
+	if (it == entries_.end()) {
+		return;
+	}
+	bytes_ -= it->second.size;
+	lru_.erase(it->second.lru_pos);
+	entries_.erase(it);
+}
+
+void ResultCache::publishLocked() {
+	stats_.bytes.store(bytes_, std::memory_order_relaxed);
+	stats_.entries.store(entries_.size(), std::memory_order_relaxed);
+}
@@ -0,0 +1,59 @@
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "compiler.hpp"
+#include "prelude.hpp"
+
+namespace {
+
+int failures = 0;
+
+void check(bool ok, const std::string& what) {
+	if (!ok) {
+		std::cerr << "FAILED: " << what << std::endl;
+		++failures;
+	}
+}
+
+void test_prologue() {
+	auto headers = include_prologue(
+	    "// hello\n"
+	    "/* a\n   comment */\n"
+	    "#include <vector>\n"
+	    "  #  include   <iostream>\r\n"
+	    "int main() { return 0; }\n");
+	check(headers && *headers == std::vector<std::string>{"vector", "iostream"}, "prologue after comments");
+	check(!include_prologue("#include \"local.h\"\nint x;\n"), "quoted include is not a prologue");
+	check(!include_prologue("#include <vector>\nint x;\n#include <map>\n"), "late include is refused");
+	check(!include_prologue("#define N 3\n#include <vector>\n"), "include after a define is refused");
+	check(include_prologue("int main() {}\n") == std::vector<std::string>{}, "no includes at all");
+}
+
+void test_covers() {
+	std::vector<std::string> prelude = CompilerConfig().prelude_headers;
+	// Typical submissions include a few standard headers in whatever order; they all get the prelude.
+	check(prelude_covers(prelude, "#include <iostream>\nint main() {}\n"), "single header");
+	check(prelude_covers(prelude, "#include <vector>\n#include <algorithm>\n#include <iostream>\nint main() {}\n"),
+	      "subset out of order");
+	check(prelude_covers(prelude, "#include <iostream>\n#include <iostream>\nint main() {}\n"), "repeated header");
+	check(!prelude_covers(prelude, "#include <iostream>\n#include <regex>\nint main() {}\n"),
+	      "header outside the prelude");
+	check(!prelude_covers(prelude, "#include <iostream>\n#include \"mine.h\"\nint main() {}\n"), "local header");
+	check(!prelude_covers(prelude, "int main() {}\n"), "no includes");
+	check(!prelude_covers({}, "#include <iostream>\n"), "empty prelude");
+}
+
+}  // namespace
+
+int main() {
+	test_prologue();
+	test_covers();
+	if (failures > 0) {
+		std::cerr << failures << " check(s) failed" << std::endl;
+		return EXIT_FAILURE;
+	}
+	std::cout << "prelude_test passed" << std::endl;
+	return EXIT_SUCCESS;
+}
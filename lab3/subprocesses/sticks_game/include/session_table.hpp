@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// Sticks left per game session, in one flat open-addressing table with linear probing. Entries are removed by
+// shifting the rest of their probe run back, so there are no tombstones and lookups stay short however many games
+// come and go. Not thread-safe: every game worker owns the table of its shard.
+class SessionTable {
+   public:
+	explicit SessionTable(size_t capacity = 64);
+
+	// The session's remaining sticks, nullptr when it has no game running.
+	int* find(long session_id);
+
+	// The session's remaining sticks, set to sticks first when it has no game running.
+	int& findOrInsert(long session_id, int sticks);
+
+	void erase(long session_id);
+
+	size_t size() const { return size_; }
+
+   private:
+	struct Slot {
+		long session_id;
+		int sticks;
+		bool used;
+	};
+
+	size_t home(long session_id) const;
+	void grow();
+
+	std::vector<Slot> slots_;
+	size_t mask_;
+	size_t size_;
+};
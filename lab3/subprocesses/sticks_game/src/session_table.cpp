@@ -0,0 +1,80 @@
+#include "session_table.hpp"
+
+#include <bit>
+#include <cstdint>
+
+SessionTable::SessionTable(size_t capacity) : size_(0) {
+	slots_.resize(std::bit_ceil(capacity < 8 ? size_t{8} : capacity));
+	mask_ = slots_.size() - 1;
+}
+
+int* SessionTable::find(long session_id) {
+	for (size_t i = home(session_id);; i = (i + 1) & mask_) {
+		Slot& slot = slots_[i];
+		if (!slot.used) {
+			return nullptr;
+		}
+		if (slot.session_id == session_id) {
+			return &slot.sticks;
+		}
+	}
+}
+
+int& SessionTable::findOrInsert(long session_id, int sticks) {
+	// Kept at most half full, so probe runs stay short.
+	if ((size_ + 1) * 2 > slots_.size()) {
+		grow();
+	}
+	size_t i = home(session_id);
+	for (; slots_[i].used; i = (i + 1) & mask_) {
+		if (slots_[i].session_id == session_id) {
+			return slots_[i].sticks;
+		}
+	}
+	slots_[i] = {session_id, sticks, true};
+	++size_;
+	return slots_[i].sticks;
+}
+
+void SessionTable::erase(long session_id) {
+	size_t hole = home(session_id);
+	for (; slots_[hole].used; hole = (hole + 1) & mask_) {
+		if (slots_[hole].session_id == session_id) {
+			break;
+		}
+	}
+	if (!slots_[hole].used) {
+		return;
+	}
+	// Moves back every later entry of the run that may sit in the hole without ending up before its home slot.
+	for (size_t next = (hole + 1) & mask_; slots_[next].used; next = (next + 1) & mask_) {
+		size_t wanted = home(slots_[next].session_id);
+		if (((next - wanted) & mask_) >= ((next - hole) & mask_)) {
+			slots_[hole] = slots_[next];
+			hole = next;
+		}
+	}
+	slots_[hole].used = false;
+	--size_;
+}
+
+size_t SessionTable::home(long session_id) const {
+	// Session ids are small and, within a shard, evenly spaced; mixing spreads them over the table.
+	uint64_t x = static_cast<uint64_t>(session_id);
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	return static_cast<size_t>(x) & mask_;
+}
+
+void SessionTable::grow() {
+	std::vector<Slot> old = std::move(slots_);
+	slots_.assign(old.size() * 2, Slot{});
+	mask_ = slots_.size() - 1;
+	size_ = 0;
+	for (const Slot& slot : old) {
+		if (slot.used) {
+			findOrInsert(slot.session_id, slot.sticks);
+		}
+	}
+}
@@ -1,25 +1,115 @@
 
 #include "../include/sticks_game.hpp"
 
+#include <pthread.h>
+#include <signal.h>
+
 #include <algorithm>
-#include <map>
+#include <exception>
+#include <mutex>
 #include <random>
 #include <string>
 #include <thread>
-void run_sticks_game(Logger& logger, std::atomic<bool>& running_flag, ServerMessageQueue& mq) {
-	std::map<long, int> game_sessions_state;
+#include <vector>
+
+#include "session_table.hpp"
+
+namespace {
+
+constexpr int START_STICKS = 21;
+constexpr int MAX_PLAYER_TAKE = 3;
+
+// Plays one move of the request's session and answers it.
+void play_move(const GameRequest& req, SessionTable& game_sessions_state, std::mt19937& gen, Logger& logger,
+               ServerMessageQueue& mq) {
+	long current_session_id = req.session_id;
+	int client_take = req.take;
+	logger.debug("Game request from session_id=" + std::to_string(current_session_id) + ", client takes " +
+	             std::to_string(client_take) + " sticks.");
+
+	if (!game_sessions_state.find(current_session_id)) {
+		logger.info("New game started for session_id=" + std::to_string(current_session_id) +
+		            ". Initial sticks: " + std::to_string(START_STICKS));
+	}
+
+	int& remaining_sticks = game_sessions_state.findOrInsert(current_session_id, START_STICKS);
+
+	if (client_take < 1 || client_take > MAX_PLAYER_TAKE) {
+		logger.warning("Session_id=" + std::to_string(current_session_id) +
+		               " tried to take invalid number of sticks: " + std::to_string(client_take) +
+		               ". Server takes 0, game continues.");
+		GameResponse error_resp{};
+		error_resp.mtype = response_tag(current_session_id);
+		error_resp.taken = 0;
+		error_resp.client_won = false;
+		error_resp.server_won = false;
+		error_resp.remaining_sticks = remaining_sticks;
+		mq.send_response(error_resp);
+		return;
+	}
+
+	if (client_take > remaining_sticks) {
+		logger.warning("Session_id=" + std::to_string(current_session_id) + " tried to take " +
+		               std::to_string(client_take) + " but only " + std::to_string(remaining_sticks) +
+		               " remaining. Client takes all " + std::to_string(remaining_sticks) + ".");
+		client_take = remaining_sticks;
+	}
+
+	remaining_sticks -= client_take;
+	logger.debug("Session_id=" + std::to_string(current_session_id) + " took " + std::to_string(client_take) +
+	             " sticks. Remaining: " + std::to_string(remaining_sticks));
+
+	GameResponse resp{};
+	resp.mtype = response_tag(current_session_id);
+
+	if (remaining_sticks <= 0) {
+		resp.taken = 0;
+		resp.client_won = true;
+		resp.server_won = false;
+		resp.remaining_sticks = 0;
+		game_sessions_state.erase(current_session_id);
+		logger.info("Session_id=" + std::to_string(current_session_id) + " wins! Game state cleared.");
+	} else {
+		std::uniform_int_distribution<> dist(1, std::min(MAX_PLAYER_TAKE, remaining_sticks));
+		int server_take = dist(gen);
+		remaining_sticks -= server_take;
+		resp.taken = server_take;
+
+		logger.debug("Server takes " + std::to_string(server_take) + " sticks for session_id=" +
+		             std::to_string(current_session_id) + ". Remaining: " + std::to_string(remaining_sticks));
+
+		if (remaining_sticks <= 0) {
+			resp.client_won = false;
+			resp.server_won = true;
+
+			resp.remaining_sticks = remaining_sticks;
+			game_sessions_state.erase(current_session_id);
+			logger.info("Server wins against session_id=" + std::to_string(current_session_id) +
+			            "! Game state cleared.");
+		} else {
+			resp.client_won = false;
+			resp.server_won = false;
+
+			resp.remaining_sticks = remaining_sticks;
+		}
+	}
+	mq.send_response(resp);
+	logger.debug("Sent game response to session_id=" + std::to_string(current_session_id));
+}
+
+// Plays the games of one shard of sessions, which no other worker touches. A move that cannot be played or answered
+// costs only that move; the shard keeps serving the rest.
+void run_shard(long shard, Logger& logger, const std::atomic<bool>& running_flag, ServerMessageQueue& mq) {
+	SessionTable game_sessions_state;
 	std::random_device rd;
 	std::mt19937 gen(rd());
 
-	const int START_STICKS = 21;
-	const int MAX_PLAYER_TAKE = 3;
-
-	logger.info("Sticks game logic loop started. Waiting for requests...");
+	logger.info("Sticks game shard " + std::to_string(shard) + " started. Waiting for requests...");
 
 	while (running_flag.load()) {
 		GameRequest req;
 		try {
-			req = mq.receive_request();
+			req = mq.receive_request(shard);
 		} catch (const MessageQueueException& e) {
 			if (!running_flag.load()) {
 				logger.info("Sticks game: receive_request() interrupted by shutdown signal.");
@@ -30,84 +120,73 @@ void run_sticks_game(Logger& logger, std::atomic<bool>& running_flag, ServerMess
 			continue;
 		}
 
+		// Wakes, including ones left in the queue by an earlier shutdown, belong to no session and get no answer.
+		if (req.session_id == WAKE_SESSION) {
+			continue;
+		}
 		if (!running_flag.load()) {
 			break;
 		}
 
-		long current_session_id = req.session_id;
-		int client_take = req.take;
-		logger.debug("Game request from session_id=" + std::to_string(current_session_id) + ", client takes " +
-		             std::to_string(client_take) + " sticks.");
-
-		if (game_sessions_state.find(current_session_id) == game_sessions_state.end()) {
-			logger.info("New game started for session_id=" + std::to_string(current_session_id) +
-			            ". Initial sticks: " + std::to_string(START_STICKS));
-			game_sessions_state[current_session_id] = START_STICKS;
-		}
-
-		int& remaining_sticks = game_sessions_state[current_session_id];
-
-		if (client_take < 1 || client_take > MAX_PLAYER_TAKE) {
-			logger.warning("Session_id=" + std::to_string(current_session_id) +
-			               " tried to take invalid number of sticks: " + std::to_string(client_take) +
-			               ". Server takes 0, game continues.");
-			GameResponse error_resp{};
-			error_resp.mtype = current_session_id;
-			error_resp.taken = 0;
-			error_resp.client_won = false;
-			error_resp.server_won = false;
-			error_resp.remaining_sticks = remaining_sticks;
-			mq.send_response(error_resp);
-			continue;
-		}
-
-		if (client_take > remaining_sticks) {
-			logger.warning("Session_id=" + std::to_string(current_session_id) + " tried to take " +
-			               std::to_string(client_take) + " but only " + std::to_string(remaining_sticks) +
-			               " remaining. Client takes all " + std::to_string(remaining_sticks) + ".");
-			client_take = remaining_sticks;
+		try {
+			play_move(req, game_sessions_state, gen, logger, mq);
+		} catch (const std::exception& e) {
+			logger.error("Sticks game shard " + std::to_string(shard) + ": move of session_id=" +
+			             std::to_string(req.session_id) + " failed: " + std::string(e.what()));
 		}
+	}
+	logger.info("Sticks game shard " + std::to_string(shard) + " finished.");
+}
 
-		remaining_sticks -= client_take;
-		logger.debug("Session_id=" + std::to_string(current_session_id) + " took " + std::to_string(client_take) +
-		             " sticks. Remaining: " + std::to_string(remaining_sticks));
-
-		GameResponse resp{};
-		resp.mtype = current_session_id;
+}  // namespace
 
-		if (remaining_sticks <= 0) {
-			resp.taken = 0;
-			resp.client_won = true;
-			resp.server_won = false;
-			resp.remaining_sticks = 0;
-			game_sessions_state.erase(current_session_id);
-			logger.info("Session_id=" + std::to_string(current_session_id) + " wins! Game state cleared.");
-		} else {
-			std::uniform_int_distribution<> dist(1, std::min(MAX_PLAYER_TAKE, remaining_sticks));
-			int server_take = dist(gen);
-			remaining_sticks -= server_take;
-			resp.taken = server_take;
-
-			logger.debug("Server takes " + std::to_string(server_take) + " sticks for session_id=" +
-			             std::to_string(current_session_id) + ". Remaining: " + std::to_string(remaining_sticks));
-
-			if (remaining_sticks <= 0) {
-				resp.client_won = false;
-				resp.server_won = true;
-
-				resp.remaining_sticks = remaining_sticks;
-				game_sessions_state.erase(current_session_id);
-				logger.info("Server wins against session_id=" + std::to_string(current_session_id) +
-				            "! Game state cleared.");
-			} else {
-				resp.client_won = false;
-				resp.server_won = false;
-
-				resp.remaining_sticks = remaining_sticks;
+void run_sticks_game(Logger& logger, std::atomic<bool>& running_flag, ServerMessageQueue& mq) {
+	// Shutdown signals are left to this thread, whose receive they interrupt; it then wakes the other workers.
+	sigset_t stop_signals;
+	sigset_t previous;
+	sigemptyset(&stop_signals);
+	sigaddset(&stop_signals, SIGINT);
+	sigaddset(&stop_signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &stop_signals, &previous);
+	std::atomic<bool> workers_running(true);
+	std::mutex failure_mutex;
+	std::exception_ptr failure;
+	std::vector<std::thread> workers;
+	for (long shard = 1; shard < GAME_SHARDS; ++shard) {
+		workers.emplace_back([shard, &logger, &running_flag, &workers_running, &mq, &failure_mutex, &failure]() {
+			try {
+				run_shard(shard, logger, workers_running, mq);
+			} catch (const std::exception& e) {
+				logger.error("Sticks game shard " + std::to_string(shard) + " failed: " + std::string(e.what()));
+				{
+					std::lock_guard lock(failure_mutex);
+					if (!failure) {
+						failure = std::current_exception();
+					}
+				}
+				// Its sessions would wait forever; the whole subserver stops instead.
+				running_flag.store(false);
+				mq.wake(0);
 			}
-		}
-		mq.send_response(resp);
-		logger.debug("Sent game response to session_id=" + std::to_string(current_session_id));
+		});
+	}
+	pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+
+	try {
+		run_shard(0, logger, running_flag, mq);
+	} catch (...) {
+		std::lock_guard lock(failure_mutex);
+		failure = std::current_exception();
+	}
+	workers_running.store(false);
+	for (long shard = 1; shard < GAME_SHARDS; ++shard) {
+		mq.wake(shard);
+	}
+	for (auto& worker : workers) {
+		worker.join();
 	}
 	logger.info("Sticks game logic loop finished.");
+	if (failure) {
+		std::rethrow_exception(failure);
+	}
 }
\ No newline at end of file
@@ -0,0 +1,126 @@
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "session_table.hpp"
+
+namespace {
+
+int failures = 0;
+
+void check(bool ok, const std::string& what) {
+	if (!ok) {
+		std::cerr << "FAILED: " << what << std::endl;
+		++failures;
+	}
+}
+
+// Same mixing as SessionTable::home, so a test can pick ids that collide in a table of a given size.
+size_t home(long session_id, size_t slots) {
+	uint64_t x = static_cast<uint64_t>(session_id);
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	return static_cast<size_t>(x) & (slots - 1);
+}
+
+// Ids whose home is the given slot of a table with slots entries.
+std::vector<long> ids_at(size_t slot, size_t slots, size_t count) {
+	std::vector<long> ids;
+	for (long id = 1; ids.size() < count; ++id) {
+		if (home(id, slots) == slot) {
+			ids.push_back(id);
+		}
+	}
+	return ids;
+}
+
+void test_basics() {
+	SessionTable table;
+	check(table.find(5) == nullptr && table.size() == 0, "empty table finds nothing");
+	table.findOrInsert(5, 15) -= 3;
+	check(table.find(5) && *table.find(5) == 12 && table.size() == 1, "inserted session keeps its sticks");
+	check(table.findOrInsert(5, 15) == 12, "existing session is not reset");
+	table.erase(5);
+	check(table.find(5) == nullptr && table.size() == 0, "erased session is gone");
+	table.erase(5);
+	check(table.size() == 0, "erasing a missing session is harmless");
+}
+
+void test_probe_runs() {
+	// Eight slots take four sessions before growing; all of these share the last slot and wrap to the front.
+	SessionTable table(8);
+	std::vector<long> ids = ids_at(7, 8, 4);
+	for (size_t i = 0; i < ids.size(); ++i) {
+		table.findOrInsert(ids[i], static_cast<int>(i));
+	}
+	table.erase(ids[0]);
+	check(table.find(ids[0]) == nullptr, "erased head of a wrapped run is gone");
+	bool all_found = true;
+	for (size_t i = 1; i < ids.size(); ++i) {
+		all_found = all_found && table.find(ids[i]) && *table.find(ids[i]) == static_cast<int>(i);
+	}
+	check(all_found, "rest of a wrapped run is found after the head is erased");
+
+	// A run holding sessions with different homes: erasing from its middle must not move one before its home.
+	SessionTable mixed(8);
+	std::vector<long> at_six = ids_at(6, 8, 2);
+	long at_zero = ids_at(0, 8, 1)[0];
+	mixed.findOrInsert(at_six[0], 1);
+	mixed.findOrInsert(at_six[1], 2);
+	mixed.findOrInsert(at_zero, 3);
+	mixed.erase(at_six[0]);
+	check(mixed.find(at_six[1]) && *mixed.find(at_six[1]) == 2, "shifted entry is found");
+	check(mixed.find(at_zero) && *mixed.find(at_zero) == 3, "entry at its home stays found");
+	check(mixed.size() == 2, "size follows erase");
+}
+
+void test_against_map() {
+	SessionTable table(8);
+	std::unordered_map<long, int> expected;
+	std::mt19937 gen(42);
+	std::uniform_int_distribution<long> ids(1, 300);
+	std::uniform_int_distribution<int> action(0, 2);
+	bool same = true;
+	for (int step = 0; step < 200000 && same; ++step) {
+		long id = ids(gen);
+		switch (action(gen)) {
+			case 0:
+				table.findOrInsert(id, step) = step;
+				expected[id] = step;
+				break;
+			case 1:
+				table.erase(id);
+				expected.erase(id);
+				break;
+			default: {
+				int* sticks = table.find(id);
+				auto it = expected.find(id);
+				same = (sticks == nullptr) == (it == expected.end()) && (!sticks || *sticks == it->second);
+			}
+		}
+		same = same && table.size() == expected.size();
+	}
+	for (const auto& [id, sticks] : expected) {
+		same = same && table.find(id) && *table.find(id) == sticks;
+	}
+	check(same, "table agrees with std::unordered_map through inserts, erases and growth");
+}
+
+}  // namespace
+
+int main() {
+	test_basics();
+	test_probe_runs();
+	test_against_map();
+	if (failures > 0) {
+		std::cerr << failures << " check(s) failed" << std::endl;
+		return EXIT_FAILURE;
+	}
+	std::cout << "session_table_test passed" << std::endl;
+	return EXIT_SUCCESS;
+}
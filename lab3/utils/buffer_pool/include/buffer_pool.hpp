@@ -0,0 +1,91 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <span>
+#include <vector>
+
+class BufferPool;
+
+// Move-only lease of a pooled byte block; the block goes back to its pool when the lease is destroyed.
+class PooledBuffer {
+   public:
+	PooledBuffer() = default;
+	PooledBuffer(PooledBuffer&& other) noexcept;
+	PooledBuffer& operator=(PooledBuffer&& other) noexcept;
+	PooledBuffer(const PooledBuffer&) = delete;
+	PooledBuffer& operator=(const PooledBuffer&) = delete;
+	~PooledBuffer();
+
+	uint8_t* data() { return data_; }
+	const uint8_t* data() const { return data_; }
+	size_t size() const { return size_; }
+	size_t capacity() const { return capacity_; }
+	bool empty() const { return size_ == 0; }
+
+	const uint8_t* begin() const { return data_; }
+	const uint8_t* end() const { return data_ + size_; }
+	const uint8_t& operator[](size_t i) const { return data_[i]; }
+
+	std::span<const uint8_t> view() const { return {data_, size_}; }
+
+	// Reuses the current block when it is large enough, otherwise swaps it for a bigger one. Contents are not
+	// preserved across a swap.
+	void reset(size_t size);
+
+	void release();
+
+   private:
+	friend class BufferPool;
+
+	PooledBuffer(BufferPool* pool, uint8_t* data, size_t size, size_t capacity)
+	    : pool_(pool), data_(data), size_(size), capacity_(capacity) {}
+
+	BufferPool* pool_ = nullptr;
+	uint8_t* data_ = nullptr;
+	size_t size_ = 0;
+	size_t capacity_ = 0;
+};
+
+struct BufferPoolStats {
+	uint64_t hits = 0;
+	uint64_t misses = 0;
+	uint64_t oversized = 0;
+	size_t cached_bytes = 0;
+};
+
+// Power-of-two size classes from 256 B up to the largest frame; each class keeps a bounded free list so steady
+// traffic stops hitting the allocator. Thread-safe.
+class BufferPool {
+   public:
+	static constexpr size_t MIN_CLASS_SIZE = 256;
+	static constexpr size_t NUM_CLASSES = 18;  // 256 B .. 32 MiB
+
+	explicit BufferPool(size_t max_cached_per_class = 8, size_t max_cached_bytes = 64 * 1024 * 1024);
+	~BufferPool();
+
+	BufferPool(const BufferPool&) = delete;
+	BufferPool& operator=(const BufferPool&) = delete;
+
+	// Blocks above the largest class are allocated exactly and freed on release.
+	PooledBuffer acquire(size_t size);
+
+	BufferPoolStats stats() const;
+
+	// Process-wide pool used by the TCP framing code.
+	static BufferPool& shared();
+
+   private:
+	friend class PooledBuffer;
+
+	static size_t classIndex(size_t size);
+	void release(uint8_t* data, size_t capacity);
+
+	size_t max_cached_per_class_;
+	size_t max_cached_bytes_;
+	mutable std::mutex mutex_;
+	std::array<std::vector<uint8_t*>, NUM_CLASSES> free_;
+	BufferPoolStats stats_;
+};
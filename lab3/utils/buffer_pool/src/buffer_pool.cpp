@@ -0,0 +1,108 @@
+#include "../include/buffer_pool.hpp"
+
+#include <bit>
+#include <utility>
+
+PooledBuffer::PooledBuffer(PooledBuffer&& other) noexcept
+    : pool_(std::exchange(other.pool_, nullptr)),
+      data_(std::exchange(other.data_, nullptr)),
+      size_(std::exchange(other.size_, 0)),
+      capacity_(std::exchange(other.capacity_, 0)) {}
+
+PooledBuffer& PooledBuffer::operator=(PooledBuffer&& other) noexcept {
+	if (this != &other) {
+		release();
+		pool_ = std::exchange(other.pool_, nullptr);
+		data_ = std::exchange(other.data_, nullptr);
+		size_ = std::exchange(other.size_, 0);
+		capacity_ = std::exchange(other.capacity_, 0);
+	}
+	return *this;
+}
+
+PooledBuffer::~PooledBuffer() { release(); }
+
+void PooledBuffer::reset(size_t size) {
+	if (data_ != nullptr && size <= capacity_) {
+		size_ = size;
+		return;
+	}
+	BufferPool* pool = pool_ != nullptr ? pool_ : &BufferPool::shared();
+	*this = pool->acquire(size);
+}
+
+void PooledBuffer::release() {
+	if (data_ != nullptr) {
+		pool_->release(data_, capacity_);
+	}
+	data_ = nullptr;
+	size_ = 0;
+	capacity_ = 0;
+}
+
+BufferPool::BufferPool(size_t max_cached_per_class, size_t max_cached_bytes)
+    : max_cached_per_class_(max_cached_per_class), max_cached_bytes_(max_cached_bytes) {}
+
+BufferPool::~BufferPool() {
+	for (auto& blocks : free_) {
+		for (uint8_t* block : blocks) {
+			delete[] block;
+		}
+	}
+}
+
+size_t BufferPool::classIndex(size_t size) {
+	if (size <= MIN_CLASS_SIZE) {
+		return 0;
+	}
+	return static_cast<size_t>(std::bit_width(size - 1)) - std::bit_width(MIN_CLASS_SIZE - 1);
+}
+
+PooledBuffer BufferPool::acquire(size_t size) {
+	size_t index = classIndex(size);
+	if (index >= NUM_CLASSES) {
+		{
+			std::lock_guard lock(mutex_);
+			++stats_.oversized;
+		}
+		return PooledBuffer(this, new uint8_t[size], size, size);
+	}
+	size_t capacity = MIN_CLASS_SIZE << index;
+	{
+		std::lock_guard lock(mutex_);
+		auto& blocks = free_[index];
+		if (!blocks.empty()) {
+			uint8_t* block = blocks.back();
+			blocks.pop_back();
+			stats_.cached_bytes -= capacity;
+			++stats_.hits;
+			return PooledBuffer(this, block, size, capacity);
+		}
+		++stats_.misses;
+	}
+	return PooledBuffer(this, new uint8_t[capacity], size, capacity);
+}
+
+void BufferPool::release(uint8_t* data, size_t capacity) {
+	size_t index = classIndex(capacity);
+	if (index < NUM_CLASSES && (MIN_CLASS_SIZE << index) == capacity) {
+		std::lock_guard lock(mutex_);
+		auto& blocks = free_[index];
+		if (blocks.size() < max_cached_per_class_ && stats_.cached_bytes + capacity <= max_cached_bytes_) {
+			blocks.push_back(data);
+			stats_.cached_bytes += capacity;
+			return;
+		}
+	}
+	delete[] data;
+}
+
+BufferPoolStats BufferPool::stats() const {
+	std::lock_guard lock(mutex_);
+	return stats_;
+}
+
+BufferPool& BufferPool::shared() {
+	static BufferPool pool;
+	return pool;
+}
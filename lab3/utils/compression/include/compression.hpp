@@ -0,0 +1,56 @@
+#pragma once
+
+#include <zlib.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+// How far one call got: input bytes taken and output bytes written.
+struct CodecStep {
+	size_t consumed;
+	size_t produced;
+};
+
+// Streaming zlib (deflate) compressor. Input goes in piece by piece and output comes out into caller buffers, so
+// neither side has to hold the whole stream.
+class Deflater {
+   public:
+	explicit Deflater(int level = Z_DEFAULT_COMPRESSION);
+	~Deflater();
+
+	Deflater(const Deflater&) = delete;
+	Deflater& operator=(const Deflater&) = delete;
+
+	// Compresses as much of input into output as fits. Pass finish once input holds the last of the data and keep
+	// calling until done(); output may be full before all of input is taken.
+	CodecStep deflate(std::span<const uint8_t> input, std::span<uint8_t> output, bool finish);
+
+	// The end of the stream has been written.
+	bool done() const { return done_; }
+
+   private:
+	z_stream stream_;
+	bool done_;
+};
+
+// Streaming counterpart of Deflater. Throws CompressionException on a corrupt stream.
+class Inflater {
+   public:
+	Inflater();
+	~Inflater();
+
+	Inflater(const Inflater&) = delete;
+	Inflater& operator=(const Inflater&) = delete;
+
+	// Decompresses as much of input into output as fits. Once output comes back full there may be more to take out
+	// even with no input left.
+	CodecStep inflate(std::span<const uint8_t> input, std::span<uint8_t> output);
+
+	// The end of the stream has been read; input past it is not taken.
+	bool done() const { return done_; }
+
+   private:
+	z_stream stream_;
+	bool done_;
+};
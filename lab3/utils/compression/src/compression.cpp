@@ -0,0 +1,75 @@
+#include "compression.hpp"
+
+#include <algorithm>
+#include <string>
+
+#include "custom_exceptions.hpp"
+
+namespace {
+
+// zlib counts in uInt; larger spans are handed over in several calls.
+constexpr size_t MAX_STEP = 1u << 30;
+
+void point(z_stream& stream, std::span<const uint8_t> input, std::span<uint8_t> output) {
+	stream.next_in = const_cast<Bytef*>(input.data());
+	stream.avail_in = static_cast<uInt>(std::min(input.size(), MAX_STEP));
+	stream.next_out = output.data();
+	stream.avail_out = static_cast<uInt>(std::min(output.size(), MAX_STEP));
+}
+
+CodecStep taken(const z_stream& stream, std::span<const uint8_t> input, std::span<uint8_t> output) {
+	return {static_cast<size_t>(stream.next_in - input.data()), static_cast<size_t>(stream.next_out - output.data())};
+}
+
+std::string describe(const z_stream& stream, int rc) {
+	return stream.msg ? std::string(stream.msg) : "zlib error " + std::to_string(rc);
+}
+
+}  // namespace
+
+Deflater::Deflater(int level) : stream_{}, done_(false) {
+	int rc = deflateInit(&stream_, level);
+	if (rc != Z_OK) {
+		throw CompressionException("deflateInit failed: " + describe(stream_, rc));
+	}
+}
+
+Deflater::~Deflater() { deflateEnd(&stream_); }
+
+CodecStep Deflater::deflate(std::span<const uint8_t> input, std::span<uint8_t> output, bool finish) {
+	if (done_ || output.empty()) {
+		return {0, 0};
+	}
+	point(stream_, input, output);
+	bool last = finish && stream_.avail_in == input.size();
+	int rc = ::deflate(&stream_, last ? Z_FINISH : Z_NO_FLUSH);
+	if (rc == Z_STREAM_END) {
+		done_ = true;
+	} else if (rc != Z_OK && rc != Z_BUF_ERROR) {
+		throw CompressionException("deflate failed: " + describe(stream_, rc));
+	}
+	return taken(stream_, input, output);
+}
+
+Inflater::Inflater() : stream_{}, done_(false) {
+	int rc = inflateInit(&stream_);
+	if (rc != Z_OK) {
+		throw CompressionException("inflateInit failed: " + describe(stream_, rc));
+	}
+}
+
+Inflater::~Inflater() { inflateEnd(&stream_); }
+
+CodecStep Inflater::inflate(std::span<const uint8_t> input, std::span<uint8_t> output) {
+	if (done_ || output.empty()) {
+		return {0, 0};
+	}
+	point(stream_, input, output);
+	int rc = ::inflate(&stream_, Z_NO_FLUSH);
+	if (rc == Z_STREAM_END) {
+		done_ = true;
+	} else if (rc != Z_OK && rc != Z_BUF_ERROR) {
+		throw CompressionException("inflate failed: " + describe(stream_, rc));
+	}
+	return taken(stream_, input, output);
+}
@@ -28,6 +28,11 @@ class TransmissionException : public SystemException {
 	explicit TransmissionException(const std::string& msg) : SystemException("TransmissionException: " + msg) {}
 };
 
+class CompressionException : public SystemException {
+   public:
+	explicit CompressionException(const std::string& msg) : SystemException("CompressionException: " + msg) {}
+};
+
 class IPCException : public SystemException {
    public:
 	explicit IPCException(const std::string& msg) : SystemException("IPCException: " + msg) {}
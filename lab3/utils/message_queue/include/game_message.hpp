@@ -6,6 +6,19 @@ constexpr key_t GAME_MSG_KEY = 0x1234;
 
 constexpr long REQUEST_TAG = 1L;
 
+// Sessions are split by id across this many game workers. A request goes out under its shard's tag so that only
+// the worker owning the session picks it up; responses use tags past the shard tags.
+constexpr long GAME_SHARDS = 8;
+
+constexpr long game_shard(long session_id) { return session_id % GAME_SHARDS; }
+
+constexpr long request_tag(long shard) { return REQUEST_TAG + shard; }
+
+constexpr long response_tag(long session_id) { return REQUEST_TAG + GAME_SHARDS + session_id; }
+
+// Session id of the requests ServerMessageQueue::wake sends. No session has it, so workers drop them unanswered.
+constexpr long WAKE_SESSION = -1;
+
 struct GameRequest {
 	long mtype;
 	long session_id;
@@ -9,10 +9,14 @@ class ServerMessageQueue {
 	explicit ServerMessageQueue(Logger& logger);
 	~ServerMessageQueue();
 
-	GameRequest receive_request();
+	// Waits for the next request of the given shard.
+	GameRequest receive_request(long shard);
 
 	void send_response(const GameResponse& resp);
 
+	// Sends the shard's worker a WAKE_SESSION request without blocking, so that it looks at its running flag again.
+	void wake(long shard);
+
 	void remove_queue();
 
    private:
@@ -20,7 +20,7 @@ ClientMessageQueue::~ClientMessageQueue() {}
 
 void ClientMessageQueue::send_request(long session_id, int take) {
 	GameRequest req;
-	req.mtype = REQUEST_TAG;
+	req.mtype = request_tag(game_shard(session_id));
 	req.session_id = session_id;
 	req.take = take;
 
@@ -36,12 +36,12 @@ void ClientMessageQueue::send_request(long session_id, int take) {
 GameResponse ClientMessageQueue::receive_response(long session_id) {
 	GameResponse resp;
 
-	if (msgrcv(msqid_, &resp, sizeof(GameResponse) - sizeof(long), session_id, 0) < 0) {
+	if (msgrcv(msqid_, &resp, sizeof(GameResponse) - sizeof(long), response_tag(session_id), 0) < 0) {
 		logger_.error("ClientMessageQueue: msgrcv() failed to receive response for session " +
 		              std::to_string(session_id) + ": " + std::string(strerror(errno)));
 		throw MessageQueueException("ClientMessageQueue: msgrcv() failed to receive response");
 	}
-	logger_.debug("ClientMessageQueue: Received GameResponse for session_id=" + std::to_string(resp.mtype) +
+	logger_.debug("ClientMessageQueue: Received GameResponse for session_id=" + std::to_string(session_id) +
 	              ": server_took=" + std::to_string(resp.taken) + ", client_won=" +
 	              (resp.client_won ? "true" : "false") + ", server_won=" + (resp.server_won ? "true" : "false"));
 	return resp;
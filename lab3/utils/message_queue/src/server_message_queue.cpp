@@ -27,10 +27,10 @@ ServerMessageQueue::ServerMessageQueue(Logger& logger) : logger_(logger) {
 
 ServerMessageQueue::~ServerMessageQueue() {}
 
-GameRequest ServerMessageQueue::receive_request() {
+GameRequest ServerMessageQueue::receive_request(long shard) {
 	GameRequest req;
 
-	if (msgrcv(msqid_, &req, sizeof(GameRequest) - sizeof(long), REQUEST_TAG, 0) < 0) {
+	if (msgrcv(msqid_, &req, sizeof(GameRequest) - sizeof(long), request_tag(shard), 0) < 0) {
 		logger_.error("ServerMessageQueue: msgrcv() failed to receive request: " + std::string(strerror(errno)));
 		throw MessageQueueException("ServerMessageQueue: msgrcv() failed to receive request");
 	}
@@ -41,14 +41,24 @@ GameRequest ServerMessageQueue::receive_request() {
 
 void ServerMessageQueue::send_response(const GameResponse& resp) {
 	if (msgsnd(msqid_, &resp, sizeof(GameResponse) - sizeof(long), 0) < 0) {
-		logger_.error("ServerMessageQueue: msgsnd() failed to send response to session_id=" +
+		logger_.error("ServerMessageQueue: msgsnd() failed to send response with mtype=" +
 		              std::to_string(resp.mtype) + ": " + std::string(strerror(errno)));
 		throw MessageQueueException("ServerMessageQueue: msgsnd() failed to send response");
 	}
-	logger_.debug("ServerMessageQueue: Sent GameResponse to session_id=" + std::to_string(resp.mtype) +
+	logger_.debug("ServerMessageQueue: Sent GameResponse with mtype=" + std::to_string(resp.mtype) +
 	              ", server_took=" + std::to_string(resp.taken));
 }
 
+void ServerMessageQueue::wake(long shard) {
+	GameRequest req{};
+	req.mtype = request_tag(shard);
+	req.session_id = WAKE_SESSION;
+	if (msgsnd(msqid_, &req, sizeof(GameRequest) - sizeof(long), IPC_NOWAIT) < 0) {
+		logger_.warning("ServerMessageQueue: msgsnd() failed to wake shard " + std::to_string(shard) + ": " +
+		                std::string(strerror(errno)));
+	}
+}
+
 void ServerMessageQueue::remove_queue() {
 	if (msqid_ >= 0) {
 		if (msgctl(msqid_, IPC_RMID, nullptr) < 0) {
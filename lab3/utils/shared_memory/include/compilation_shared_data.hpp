@@ -1,19 +1,92 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
 #include <cstddef>
 #include <cstdint>
 
+#include "shm_arena.hpp"
+#include "shm_semaphore.hpp"
+
 constexpr size_t MAX_FILE_NAME = 256;
-constexpr size_t MAX_FILE_SIZE = 10 * 1024 * 1024;
-constexpr size_t MAX_RESULT_SIZE = 10 * 1024 * 1024;
+constexpr size_t MAX_DIAGNOSTICS_SIZE = 64 * 1024;
+constexpr size_t COMPILE_RING_SLOTS = 32;
 
-enum class CompileStatus : int32_t { NONE, PENDING, SUCCESS, FAILURE };
+// Life cycle of a slot: NONE (free) -> FILLING (server copies the source in) -> PENDING (queued for the
+// compiler) -> RUNNING -> SUCCESS/FAILURE -> NONE once the server has taken the result.
+enum class CompileStatus : int32_t { NONE, FILLING, PENDING, RUNNING, SUCCESS, FAILURE };
 
-struct CompilationSharedData {
-	CompileStatus status;
+static_assert(std::atomic<CompileStatus>::is_always_lock_free, "slot status must be usable across processes");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "job tickets must be usable across processes");
+
+// Sources and results live in the segment's arena (see compile_arena); a slot only names their regions. The server
+// allocates the source region and frees both once it has answered; the compiler allocates the result region.
+struct CompileSlot {
+	std::atomic<CompileStatus> status;
+	// Submission order, starting at 1; the compiler takes the PENDING slot with the lowest ticket first.
+	uint64_t ticket;
 	char file_name[MAX_FILE_NAME];
-	uint32_t file_size;
-	uint8_t file_data[MAX_FILE_SIZE];
-	uint32_t result_size;
-	uint8_t result_data[MAX_RESULT_SIZE];
+	uint64_t file_offset;
+	uint64_t file_size;
+	// The build output on SUCCESS; toolchain output or the reason on FAILURE. ShmArena::NONE when there is none.
+	uint64_t result_offset;
+	uint64_t result_size;
+	// Posted by the compiler once the job has reached SUCCESS or FAILURE.
+	ShmSemaphore done;
+	// When the compiler took the job (heartbeat_clock_ms), so an overdue build can be spotted.
+	std::atomic<uint64_t> started_ms;
+	// Process group of the toolchain step the job is running, 0 between steps.
+	std::atomic<int32_t> toolchain_group;
+	// The job's ticket while the compiler runs it, 0 otherwise. Whoever swaps it back to 0 answers the job: the
+	// compiler once it is built, or the server's supervisor when it gives up on the job.
+	std::atomic<uint64_t> running_ticket;
+};
+
+// Published by the compiler's caches so the server can report them.
+struct CompileCacheStats {
+	std::atomic<uint64_t> hits;
+	std::atomic<uint64_t> misses;
+	std::atomic<uint64_t> evictions;
+	std::atomic<uint64_t> bytes;
+	std::atomic<uint64_t> entries;
+};
+
+// Kept up to date by the attached compiler so the server's supervisor can tell a dead or hung compiler apart.
+struct CompilerHeartbeat {
+	// 0 while no compiler is attached.
+	std::atomic<int32_t> pid;
+	// heartbeat_clock_ms() of the compiler's last sign of life.
+	std::atomic<uint64_t> beat_ms;
+	// The compiler's per-job build limit; a RUNNING job well past it means a stuck worker. 0 means no limit.
+	std::atomic<uint32_t> job_timeout_sec;
 };
+
+// Monotonic and system-wide, so both processes read the same clock.
+inline uint64_t heartbeat_clock_ms() {
+	return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+	                                 std::chrono::steady_clock::now().time_since_epoch())
+	                                 .count());
+}
+
+// Job ring shared by the server and the compiler subserver. The requests semaphore counts queued jobs; each slot
+// has its own completion semaphore so a client waits only for its own job. The segment is created zero-filled,
+// which leaves every slot free; the data arena follows the ring and takes up the rest of the segment, so its size
+// is picked by whoever creates it.
+struct CompilationSharedData {
+	// Set by the server when it creates the segment: the largest source it accepts, and how long it waits for the
+	// compiler to finish a job before giving up on it.
+	uint64_t max_source_size;
+	uint32_t reply_timeout_sec;
+	std::atomic<uint64_t> next_ticket;
+	ShmSemaphore requests;
+	CompilerHeartbeat heartbeat;
+	CompileCacheStats cache;
+	CompileCacheStats objects;
+	CompileSlot slots[COMPILE_RING_SLOTS];
+};
+
+constexpr size_t COMPILE_ARENA_OFFSET = (sizeof(CompilationSharedData) + 4095) & ~size_t(4095);
+
+inline void* compile_arena(CompilationSharedData* ring) {
+	return reinterpret_cast<uint8_t*>(ring) + COMPILE_ARENA_OFFSET;
+}
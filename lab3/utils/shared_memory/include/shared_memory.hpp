@@ -12,12 +12,15 @@
 
 class SharedMemory {
 public:
+    // Opening an existing segment with size 0 maps all of it.
     SharedMemory(const std::string &name, size_t size, bool create, Logger &logger);
 
     ~SharedMemory();
 
     void *data() const { return ptr_; }
 
+    size_t size() const { return size_; }
+
     void close();
 
     void unlink();
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <pthread.h>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "custom_exceptions.hpp"
+
+// Variable-sized regions carved out of one shared mapping. Regions are named by their offset from the arena base, so
+// every process resolves them the same way whatever address it mapped the segment at. The arena's bookkeeping lives
+// at the start of the memory it manages and is guarded by a robust process-shared mutex; the free list is kept in
+// address order and neighbours are merged on free, so a long-running arena does not fragment into small pieces.
+// Pages of a shm mapping are only backed once touched, so a large arena costs nothing until it is used.
+class ShmArena {
+   public:
+	// Offsets are never 0, which callers can use as "no region".
+	static constexpr uint64_t NONE = 0;
+
+	// Lays out an empty arena over [base, base + size). Exactly one process does this, before anyone attaches.
+	static ShmArena create(void* base, size_t size);
+	// Uses an arena that create() has already laid out at base.
+	static ShmArena attach(void* base);
+
+	// Returns the offset of a region of at least size bytes, or NONE when no free region is large enough.
+	uint64_t allocate(size_t size);
+	void free(uint64_t offset);
+
+	uint8_t* at(uint64_t offset) const { return reinterpret_cast<uint8_t*>(header_) + offset; }
+
+	size_t capacity() const;
+	size_t used() const;
+
+   private:
+	struct Header;
+	// Where the first block starts, past the arena's own bookkeeping.
+	static const uint64_t FIRST_BLOCK;
+
+	explicit ShmArena(Header* header) : header_(header) {}
+
+	Header* header_;
+};
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+
+// Counting semaphore that lives inside a shared memory segment and blocks on a futex, so signalling costs one atomic
+// operation plus a wake-up only when somebody is actually asleep. All-zero memory is a valid semaphore with a count
+// of zero, which lets a freshly created segment be used as is, and nothing has to be unlinked when a process dies.
+class ShmSemaphore {
+   public:
+	void post();
+
+	void wait();
+	// Gives up at deadline; returns whether a unit was taken.
+	bool wait_until(std::chrono::steady_clock::time_point deadline);
+	bool try_wait();
+
+   private:
+	bool acquire(const std::optional<std::chrono::steady_clock::time_point>& deadline);
+
+	std::atomic<uint32_t> value_;
+	std::atomic<uint32_t> waiters_;
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free && sizeof(std::atomic<uint32_t>) == sizeof(uint32_t),
+              "ShmSemaphore needs a plain 32-bit futex word");
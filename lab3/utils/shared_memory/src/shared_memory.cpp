@@ -16,6 +16,13 @@ SharedMemory::SharedMemory(const std::string& name, size_t size, bool create, Lo
 			logger_.error("ftruncate failed for: " + name_);
 			throw SharedMemoryException("ftruncate(" + name_ + ") failed");
 		}
+	} else if (size_ == 0) {
+		struct stat st;
+		if (fstat(fd_, &st) < 0) {
+			logger_.error("fstat failed for: " + name_);
+			throw SharedMemoryException("fstat(" + name_ + ") failed");
+		}
+		size_ = static_cast<size_t>(st.st_size);
 	}
 
 	ptr_ = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
@@ -0,0 +1,153 @@
+#include "../include/shm_arena.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+
+namespace {
+
+constexpr uint64_t ALIGNMENT = 64;
+// Every region is preceded by this much bookkeeping, which keeps region data aligned.
+constexpr uint64_t BLOCK_HEADER = ALIGNMENT;
+// Splitting off less than this would only leave unusable slivers.
+constexpr uint64_t MIN_SPLIT = 4 * ALIGNMENT;
+
+constexpr uint64_t align_up(uint64_t value) { return (value + ALIGNMENT - 1) & ~(ALIGNMENT - 1); }
+
+struct Block {
+	// Including the block header.
+	uint64_t size;
+	// Offset of the next free block's header in address order, or 0; meaningless while allocated.
+	uint64_t next_free;
+};
+
+}  // namespace
+
+struct ShmArena::Header {
+	pthread_mutex_t lock;
+	uint64_t size;
+	uint64_t free_head;
+	uint64_t used;
+};
+
+const uint64_t ShmArena::FIRST_BLOCK = align_up(sizeof(ShmArena::Header));
+
+namespace {
+
+class ArenaLock {
+   public:
+	explicit ArenaLock(pthread_mutex_t* mutex) : mutex_(mutex) {
+		int rc = pthread_mutex_lock(mutex_);
+		if (rc == EOWNERDEAD) {
+			// A process died inside allocate()/free(). Both only touch a few words, so carry on with the list as
+			// it is; at worst a region is lost until the segment is recreated.
+			pthread_mutex_consistent(mutex_);
+		} else if (rc != 0) {
+			throw SharedMemoryException("arena lock failed: " + std::string(strerror(rc)));
+		}
+	}
+	~ArenaLock() { pthread_mutex_unlock(mutex_); }
+
+	ArenaLock(const ArenaLock&) = delete;
+	ArenaLock& operator=(const ArenaLock&) = delete;
+
+   private:
+	pthread_mutex_t* mutex_;
+};
+
+}  // namespace
+
+ShmArena ShmArena::create(void* base, size_t size) {
+	auto* header = static_cast<Header*>(base);
+	if (size < FIRST_BLOCK + MIN_SPLIT) {
+		throw SharedMemoryException("arena of " + std::to_string(size) + " bytes is too small");
+	}
+
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+	int rc = pthread_mutex_init(&header->lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+	if (rc != 0) {
+		throw SharedMemoryException("arena mutex init failed: " + std::string(strerror(rc)));
+	}
+
+	header->size = size & ~(ALIGNMENT - 1);
+	header->free_head = FIRST_BLOCK;
+	header->used = 0;
+	ShmArena arena(header);
+	auto* block = reinterpret_cast<Block*>(arena.at(FIRST_BLOCK));
+	block->size = header->size - FIRST_BLOCK;
+	block->next_free = 0;
+	return arena;
+}
+
+ShmArena ShmArena::attach(void* base) { return ShmArena(static_cast<Header*>(base)); }
+
+uint64_t ShmArena::allocate(size_t size) {
+	uint64_t needed = BLOCK_HEADER + align_up(size == 0 ? 1 : size);
+	ArenaLock lock(&header_->lock);
+	uint64_t* link = &header_->free_head;
+	while (*link != 0) {
+		uint64_t offset = *link;
+		auto* block = reinterpret_cast<Block*>(at(offset));
+		if (block->size >= needed) {
+			if (block->size - needed >= MIN_SPLIT) {
+				auto* rest = reinterpret_cast<Block*>(at(offset + needed));
+				rest->size = block->size - needed;
+				rest->next_free = block->next_free;
+				block->size = needed;
+				*link = offset + needed;
+			} else {
+				*link = block->next_free;
+			}
+			header_->used += block->size;
+			return offset + BLOCK_HEADER;
+		}
+		link = &block->next_free;
+	}
+	return NONE;
+}
+
+void ShmArena::free(uint64_t offset) {
+	if (offset == NONE) {
+		return;
+	}
+	uint64_t block_offset = offset - BLOCK_HEADER;
+	auto* block = reinterpret_cast<Block*>(at(block_offset));
+	ArenaLock lock(&header_->lock);
+	header_->used -= block->size;
+
+	uint64_t prev = 0;
+	uint64_t next = header_->free_head;
+	while (next != 0 && next < block_offset) {
+		prev = next;
+		next = reinterpret_cast<Block*>(at(next))->next_free;
+	}
+
+	block->next_free = next;
+	if (next != 0 && block_offset + block->size == next) {
+		auto* following = reinterpret_cast<Block*>(at(next));
+		block->size += following->size;
+		block->next_free = following->next_free;
+	}
+	if (prev == 0) {
+		header_->free_head = block_offset;
+		return;
+	}
+	auto* preceding = reinterpret_cast<Block*>(at(prev));
+	if (prev + preceding->size == block_offset) {
+		preceding->size += block->size;
+		preceding->next_free = block->next_free;
+	} else {
+		preceding->next_free = block_offset;
+	}
+}
+
+size_t ShmArena::capacity() const { return header_->size - FIRST_BLOCK; }
+
+size_t ShmArena::used() const {
+	ArenaLock lock(&header_->lock);
+	return header_->used;
+}
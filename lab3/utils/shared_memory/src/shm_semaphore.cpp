@@ -0,0 +1,69 @@
+#include "../include/shm_semaphore.hpp"
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <string>
+
+#include "custom_exceptions.hpp"
+
+namespace {
+
+// Shared (not FUTEX_PRIVATE) operations: the word is mapped into several processes.
+long futex(std::atomic<uint32_t>& word, int op, uint32_t value, const timespec* timeout) {
+	return syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), op, value, timeout, nullptr, 0);
+}
+
+}  // namespace
+
+void ShmSemaphore::post() {
+	value_.fetch_add(1, std::memory_order_seq_cst);
+	if (waiters_.load(std::memory_order_seq_cst) > 0) {
+		futex(value_, FUTEX_WAKE, 1, nullptr);
+	}
+}
+
+bool ShmSemaphore::try_wait() {
+	uint32_t value = value_.load(std::memory_order_relaxed);
+	while (value > 0) {
+		if (value_.compare_exchange_weak(value, value - 1, std::memory_order_acquire, std::memory_order_relaxed)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void ShmSemaphore::wait() { acquire(std::nullopt); }
+
+bool ShmSemaphore::wait_until(std::chrono::steady_clock::time_point deadline) {
+	return acquire(deadline);
+}
+
+bool ShmSemaphore::acquire(const std::optional<std::chrono::steady_clock::time_point>& deadline) {
+	while (!try_wait()) {
+		timespec timeout{};
+		if (deadline) {
+			auto left = *deadline - std::chrono::steady_clock::now();
+			if (left <= std::chrono::steady_clock::duration::zero()) {
+				return false;
+			}
+			auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(left).count();
+			timeout.tv_sec = static_cast<time_t>(ns / 1000000000);
+			timeout.tv_nsec = static_cast<long>(ns % 1000000000);
+		}
+		// post() bumps the value before it looks for waiters, and FUTEX_WAIT only sleeps while the value is still
+		// 0, so a post between try_wait() and here is never missed.
+		waiters_.fetch_add(1, std::memory_order_seq_cst);
+		long rc = futex(value_, FUTEX_WAIT, 0, deadline ? &timeout : nullptr);
+		int error = errno;
+		waiters_.fetch_sub(1, std::memory_order_seq_cst);
+		if (rc < 0 && error != EAGAIN && error != EINTR && error != ETIMEDOUT) {
+			throw SemaphoreException("futex wait failed: " + std::string(strerror(error)));
+		}
+	}
+	return true;
+}
@@ -0,0 +1,121 @@
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "shm_arena.hpp"
+
+namespace {
+
+constexpr size_t ARENA_SIZE = 64 * 1024;
+// Every region carries this much bookkeeping in front of it.
+constexpr size_t BLOCK_HEADER = 64;
+
+int failures = 0;
+
+void check(bool ok, const std::string& what) {
+	if (!ok) {
+		std::cerr << "FAILED: " << what << std::endl;
+		++failures;
+	}
+}
+
+// A mapping that a forked child shares, like the real segment.
+class Mapping {
+   public:
+	Mapping() : base_(mmap(nullptr, ARENA_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0)) {
+		if (base_ == MAP_FAILED) {
+			std::cerr << "mmap failed" << std::endl;
+			std::exit(EXIT_FAILURE);
+		}
+	}
+	~Mapping() { munmap(base_, ARENA_SIZE); }
+
+	Mapping(const Mapping&) = delete;
+	Mapping& operator=(const Mapping&) = delete;
+
+	void* base() const { return base_; }
+
+   private:
+	void* base_;
+};
+
+void test_allocate() {
+	Mapping mapping;
+	ShmArena arena = ShmArena::create(mapping.base(), ARENA_SIZE);
+	check(arena.used() == 0, "new arena is empty");
+	uint64_t a = arena.allocate(100);
+	uint64_t b = arena.allocate(0);
+	check(a != ShmArena::NONE && b != ShmArena::NONE && a != b, "small regions are handed out");
+	check(reinterpret_cast<uintptr_t>(arena.at(a)) % 64 == 0 && reinterpret_cast<uintptr_t>(arena.at(b)) % 64 == 0,
+	      "regions are aligned");
+	check(b >= a + 100, "regions do not overlap");
+	check(arena.used() > 0, "used counts allocations");
+	check(arena.allocate(ARENA_SIZE) == ShmArena::NONE, "oversized request is refused");
+	arena.free(ShmArena::NONE);
+	arena.free(a);
+	check(arena.allocate(64) == a, "freed region is reused first");
+
+	ShmArena attached = ShmArena::attach(mapping.base());
+	check(attached.used() == arena.used(), "attach sees the same arena");
+}
+
+void test_coalescing() {
+	Mapping mapping;
+	ShmArena arena = ShmArena::create(mapping.base(), ARENA_SIZE);
+	std::vector<uint64_t> regions;
+	for (uint64_t offset = arena.allocate(1000); offset != ShmArena::NONE; offset = arena.allocate(1000)) {
+		regions.push_back(offset);
+	}
+	check(regions.size() > 8, "arena fills with regions");
+	// Freed out of address order, so merges happen on both sides of a block.
+	for (size_t i = 1; i < regions.size(); i += 2) {
+		arena.free(regions[i]);
+	}
+	check(arena.allocate(3000) == ShmArena::NONE, "scattered holes do not add up");
+	for (size_t i = 0; i < regions.size(); i += 2) {
+		arena.free(regions[i]);
+	}
+	check(arena.used() == 0, "everything is returned");
+	uint64_t whole = arena.allocate(arena.capacity() - BLOCK_HEADER);
+	check(whole != ShmArena::NONE, "free neighbours merge back into one region");
+	arena.free(whole);
+}
+
+void test_owner_died() {
+	Mapping mapping;
+	ShmArena arena = ShmArena::create(mapping.base(), ARENA_SIZE);
+	// The arena's lock is the first thing in its header; the child dies holding it, as inside allocate() or free().
+	pid_t child = fork();
+	if (child == 0) {
+		pthread_mutex_lock(static_cast<pthread_mutex_t*>(mapping.base()));
+		_exit(0);
+	}
+	int status = 0;
+	waitpid(child, &status, 0);
+	check(WIFEXITED(status), "child exits holding the lock");
+	uint64_t offset = arena.allocate(100);
+	check(offset != ShmArena::NONE, "arena recovers the lock of a dead owner");
+	arena.free(offset);
+	check(arena.used() == 0, "arena stays usable after recovery");
+}
+
+}  // namespace
+
+int main() {
+	test_allocate();
+	test_coalescing();
+	test_owner_died();
+	if (failures > 0) {
+		std::cerr << failures << " check(s) failed" << std::endl;
+		return EXIT_FAILURE;
+	}
+	std::cout << "shm_arena_test passed" << std::endl;
+	return EXIT_SUCCESS;
+}
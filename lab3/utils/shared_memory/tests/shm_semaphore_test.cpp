@@ -0,0 +1,132 @@
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "shm_semaphore.hpp"
+
+namespace {
+
+using namespace std::chrono_literals;
+using Clock = std::chrono::steady_clock;
+
+int failures = 0;
+
+void check(bool ok, const std::string& what) {
+	if (!ok) {
+		std::cerr << "FAILED: " << what << std::endl;
+		++failures;
+	}
+}
+
+// Zero-filled like a freshly created segment.
+ShmSemaphore* zeroed(void* memory) {
+	std::memset(memory, 0, sizeof(ShmSemaphore));
+	return static_cast<ShmSemaphore*>(memory);
+}
+
+void test_counting() {
+	alignas(ShmSemaphore) unsigned char memory[sizeof(ShmSemaphore)];
+	ShmSemaphore& sem = *zeroed(memory);
+	check(!sem.try_wait(), "zeroed semaphore starts at zero");
+	sem.post();
+	sem.post();
+	check(sem.try_wait() && sem.try_wait(), "each post is one unit");
+	check(!sem.try_wait(), "units are not taken twice");
+	sem.post();
+	sem.wait();
+	check(!sem.try_wait(), "wait takes an available unit");
+}
+
+void test_deadline() {
+	alignas(ShmSemaphore) unsigned char memory[sizeof(ShmSemaphore)];
+	ShmSemaphore& sem = *zeroed(memory);
+	auto start = Clock::now();
+	check(!sem.wait_until(start + 50ms), "wait_until gives up without a post");
+	check(Clock::now() - start >= 50ms, "wait_until waits until its deadline");
+	check(!sem.wait_until(start), "past deadline returns at once");
+	sem.post();
+	check(sem.wait_until(Clock::now() + 1s), "wait_until takes an available unit");
+}
+
+void test_threads() {
+	constexpr int THREADS = 4;
+	constexpr int ROUNDS = 20000;
+	alignas(ShmSemaphore) unsigned char memory[sizeof(ShmSemaphore)];
+	ShmSemaphore& sem = *zeroed(memory);
+	std::atomic<int> taken(0);
+	std::vector<std::thread> consumers;
+	for (int i = 0; i < THREADS; ++i) {
+		consumers.emplace_back([&] {
+			for (int round = 0; round < ROUNDS; ++round) {
+				if (!sem.wait_until(Clock::now() + 10s)) {
+					return;
+				}
+				taken.fetch_add(1);
+			}
+		});
+	}
+	std::vector<std::thread> producers;
+	for (int i = 0; i < THREADS; ++i) {
+		producers.emplace_back([&] {
+			for (int round = 0; round < ROUNDS; ++round) {
+				sem.post();
+			}
+		});
+	}
+	for (auto& thread : producers) {
+		thread.join();
+	}
+	for (auto& thread : consumers) {
+		thread.join();
+	}
+	check(taken.load() == THREADS * ROUNDS, "no post is lost between threads");
+	check(!sem.try_wait(), "no unit is left over");
+}
+
+void test_processes() {
+	void* memory = mmap(nullptr, sizeof(ShmSemaphore) * 2, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (memory == MAP_FAILED) {
+		check(false, "mmap for the process test");
+		return;
+	}
+	// An anonymous shared mapping is zero-filled, which is all the setup a semaphore needs.
+	auto* ping = static_cast<ShmSemaphore*>(memory);
+	auto* pong = ping + 1;
+	pid_t child = fork();
+	if (child == 0) {
+		bool ok = ping->wait_until(Clock::now() + 10s);
+		pong->post();
+		_exit(ok ? 0 : 1);
+	}
+	std::this_thread::sleep_for(20ms);
+	ping->post();
+	check(pong->wait_until(Clock::now() + 10s), "post from another process wakes the waiter");
+	int status = 0;
+	waitpid(child, &status, 0);
+	check(WIFEXITED(status) && WEXITSTATUS(status) == 0, "waiter in another process sees the post");
+	munmap(memory, sizeof(ShmSemaphore) * 2);
+}
+
+}  // namespace
+
+int main() {
+	test_counting();
+	test_deadline();
+	test_threads();
+	test_processes();
+	if (failures > 0) {
+		std::cerr << failures << " check(s) failed" << std::endl;
+		return EXIT_FAILURE;
+	}
+	std::cout << "shm_semaphore_test passed" << std::endl;
+	return EXIT_SUCCESS;
+}
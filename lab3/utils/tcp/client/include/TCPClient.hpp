@@ -5,18 +5,30 @@
 #include <cstdint>
 #include <memory>
 #include <netinet/in.h>
+#include <span>
 
+#include "Protocol.hpp"
+#include "buffer_pool.hpp"
 #include "logger.hpp"
 
 class TCPClient {
 public:
   TCPClient(const std::string& host, uint16_t port, Logger& logger);
+  TCPClient(TCPClient&& other) noexcept;
   ~TCPClient();
 
   void connect();
-  void send(const std::vector<uint8_t>& data);
-  std::vector<uint8_t> receive();
+  // Writes header and payload with one sendmsg; payload_len is filled in from payload.
+  void send(FrameHeader header, std::span<const uint8_t> payload);
+  // The returned payload view stays valid until the next receive() on this client.
+  FrameView receive();
   void close();
+  // Waits up to timeout_ms for the server to have data for us; lets a pipelining caller pick up responses
+  // between sends without blocking.
+  bool wait_readable(int timeout_ms);
+  bool is_connected() const { return connected_; }
+
+  uint32_t next_request_id() { return ++last_request_id_; }
 
 private:
   std::string host_;
@@ -24,4 +36,6 @@ private:
   int sock_fd_;
   Logger& logger_;
   bool connected_;
+  PooledBuffer frame_;
+  uint32_t last_request_id_;
 };
@@ -2,14 +2,28 @@
 #include "TCPClient.hpp"
 
 #include <arpa/inet.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#include <cerrno>
 #include <cstring>
+#include <utility>
 
 #include "custom_exceptions.hpp"
 
 TCPClient::TCPClient(const std::string& host, uint16_t port, Logger& logger)
-    : host_(host), port_(port), sock_fd_(-1), logger_(logger), connected_(false) {}
+    : host_(host), port_(port), sock_fd_(-1), logger_(logger), connected_(false), last_request_id_(0) {}
+
+TCPClient::TCPClient(TCPClient&& other) noexcept
+    : host_(std::move(other.host_)),
+      port_(other.port_),
+      sock_fd_(std::exchange(other.sock_fd_, -1)),
+      logger_(other.logger_),
+      connected_(std::exchange(other.connected_, false)),
+      frame_(std::move(other.frame_)),
+      last_request_id_(other.last_request_id_) {}
 
 TCPClient::~TCPClient() { close(); }
 
@@ -38,47 +52,73 @@ void TCPClient::connect() {
 	logger_.info("Connection to server established");
 }
 
-void TCPClient::send(const std::vector<uint8_t>& data) {
+void TCPClient::send(FrameHeader header, std::span<const uint8_t> payload) {
 	if (!connected_) {
 		logger_.warning("Attempt to send on closed connection");
 		throw TransmissionException("Send on disconnected socket");
 	}
 
-	uint32_t size = data.size();
-	uint32_t net_size = htonl(size);
-
-	if (::send(sock_fd_, &net_size, sizeof(net_size), 0) != sizeof(net_size)) {
-		logger_.warning("Failed to send data length header");
-		throw TransmissionException("Failed to send length header");
-	}
-	if (::send(sock_fd_, data.data(), size, 0) != static_cast<ssize_t>(size)) {
-		logger_.warning("Failed to send full data payload");
-		throw TransmissionException("Partial data payload sent");
+	header.payload_len = static_cast<uint32_t>(payload.size());
+	uint8_t raw_header[FRAME_HEADER_SIZE];
+	encode_frame_header(header, raw_header);
+
+	iovec iov[2] = {{raw_header, sizeof(raw_header)}, {const_cast<uint8_t*>(payload.data()), payload.size()}};
+	msghdr msg{};
+	msg.msg_iov = iov;
+	msg.msg_iovlen = payload.empty() ? 1 : 2;
+	size_t remaining = sizeof(raw_header) + payload.size();
+	while (remaining > 0) {
+		ssize_t sent = ::sendmsg(sock_fd_, &msg, MSG_NOSIGNAL);
+		if (sent < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			logger_.warning("Failed to send frame: " + std::string(strerror(errno)));
+			throw TransmissionException("Failed to send frame");
+		}
+		remaining -= static_cast<size_t>(sent);
+		size_t written = static_cast<size_t>(sent);
+		while (written > 0) {
+			if (written >= msg.msg_iov->iov_len) {
+				written -= msg.msg_iov->iov_len;
+				++msg.msg_iov;
+				--msg.msg_iovlen;
+			} else {
+				msg.msg_iov->iov_base = static_cast<uint8_t*>(msg.msg_iov->iov_base) + written;
+				msg.msg_iov->iov_len -= written;
+				written = 0;
+			}
+		}
 	}
-	logger_.debug("Sent " + std::to_string(size) + " bytes");
+	logger_.debug("Sent " + std::to_string(payload.size()) + " bytes");
 }
 
-std::vector<uint8_t> TCPClient::receive() {
+FrameView TCPClient::receive() {
 	if (!connected_) {
 		logger_.warning("Attempt to receive on closed connection");
 		throw TransmissionException("Receive on disconnected socket");
 	}
 
-	uint32_t net_size;
-	if (::recv(sock_fd_, &net_size, sizeof(net_size), MSG_WAITALL) != sizeof(net_size)) {
-		logger_.error("Failed to receive data length header");
-		throw TransmissionException("Failed to receive length header");
+	uint8_t raw_header[FRAME_HEADER_SIZE];
+	if (::recv(sock_fd_, raw_header, sizeof(raw_header), MSG_WAITALL) != sizeof(raw_header)) {
+		logger_.error("Failed to receive frame header");
+		throw TransmissionException("Failed to receive frame header");
 	}
-	uint32_t size = ntohl(net_size);
+	FrameHeader header = decode_frame_header(raw_header);
+	if (header.version != PROTOCOL_VERSION) {
+		logger_.error("Unsupported protocol version " + std::to_string(header.version));
+		throw TransmissionException("Unsupported protocol version");
+	}
+	uint32_t size = header.payload_len;
 
-	std::vector<uint8_t> buffer(size);
-	if (::recv(sock_fd_, buffer.data(), size, MSG_WAITALL) != static_cast<ssize_t>(size)) {
+	frame_.reset(size);
+	if (size > 0 && ::recv(sock_fd_, frame_.data(), size, MSG_WAITALL) != static_cast<ssize_t>(size)) {
 		logger_.error("Failed to receive full data payload");
 		throw TransmissionException("Incomplete data payload received");
 	}
-	logger_.debug("Received " + std::to_string(size) + " bytes");
+	logger_.debug("Received " + std::to_string(size) + " bytes, status " + status_name(header.status));
 
-	return buffer;
+	return {header, frame_.view()};
 }
 
 void TCPClient::close() {
@@ -88,3 +128,19 @@ void TCPClient::close() {
 		connected_ = false;
 	}
 }
+
+bool TCPClient::wait_readable(int timeout_ms) {
+	if (!connected_) {
+		return false;
+	}
+	pollfd pfd{sock_fd_, POLLIN, 0};
+	int ready;
+	do {
+		ready = ::poll(&pfd, 1, timeout_ms);
+	} while (ready < 0 && errno == EINTR);
+	if (ready < 0) {
+		logger_.error("poll() failed: " + std::string(strerror(errno)));
+		throw TransmissionException("poll() failed");
+	}
+	return ready > 0;
+}
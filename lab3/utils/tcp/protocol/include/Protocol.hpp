@@ -0,0 +1,175 @@
+#pragma once
+
+#include <arpa/inet.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+
+// Every message on the wire is one frame: a fixed 12-byte header followed by payload_len bytes.
+//
+//   0        1        2        3        4               8               12
+//   +--------+--------+--------+--------+---------------+---------------+
+//   |version | opcode | flags  | status |  request_id   |  payload_len  |
+//   +--------+--------+--------+--------+---------------+---------------+
+//
+// Multi-byte fields are big-endian. Responses echo the opcode and request_id of the request they answer.
+constexpr uint8_t PROTOCOL_VERSION = 1;
+constexpr size_t FRAME_HEADER_SIZE = 12;
+
+enum class Opcode : uint8_t {
+	// Payload: u16 file name length, file name, then the first part of the file. With FLAG_MORE the rest follows
+	// in COMPILE_DATA frames carrying the same request id. Reply payload: the compiled binary, or the toolchain's
+	// diagnostics with COMPILATION_FAILED. With FLAG_PRIORITY the payload starts with a u8 priority; a client's
+	// higher-priority jobs go to the compiler before its other waiting ones, default 0. With FLAG_COMPRESSED the
+	// file, from after the name on, is one zlib stream across the upload's frames; a reply on a connection that
+	// agreed on ENCODING_DEFLATE may come the same way, split into frames that all but the last flag FLAG_MORE.
+	COMPILE = 1,
+	COMPILE_DATA = 2,
+	// Payload: i32 sticks taken. The first move on a connection starts a game. Reply payload: i32 taken by the
+	// server, u8 client won, u8 server won, i32 sticks left.
+	PLAY_MOVE = 3,
+	// Payload: u8 set of ENCODING_* the client understands. Reply payload: u8 ENCODING_* the server will use for
+	// replies on this connection, 0 for none. Servers that predate it answer UNKNOWN_OPCODE.
+	HELLO = 4,
+	// Same payload and continuation as COMPILE, but the reply comes as soon as the upload is complete: u64 job id.
+	// The job runs without the connection; its outcome is kept for a while after it finishes.
+	SUBMIT = 5,
+	// Payload: u64 job id, u32 milliseconds to wait for the job to finish. Reply payload: u8 state (0 queued,
+	// 1 running, 2 finished), u8 the job's Status, u32 its result size; JOB_NOT_FOUND for an unknown or expired id.
+	STATUS = 6,
+	// Same payload as STATUS. Reply: the job's outcome as COMPILE would have answered it, JOB_PENDING when it has
+	// not finished within the wait, or JOB_NOT_FOUND. A result can be fetched again until it expires.
+	FETCH = 7,
+	// Many files in one request. Payload: u16 file count, then per file u16 name length, name and u32 size, then the
+	// files back to back; the manifest has to fit in the first frame, the files continue in COMPILE_DATA frames as
+	// with COMPILE, and the whole upload counts against the source size limit. FLAG_PRIORITY applies to every file;
+	// with FLAG_COMPRESSED each file is a zlib stream of its own and the sizes are the compressed ones. Each file is
+	// answered as it finishes, in any order, as COMPILE would have answered it but with its u16 index in the
+	// manifest in front of every frame's payload. A reply without the index fails the whole batch.
+	BATCH = 8,
+};
+
+constexpr uint8_t ENCODING_DEFLATE = 0x01;
+
+// Most files one BATCH may name.
+constexpr size_t MAX_BATCH_FILES = 4096;
+
+enum class Status : uint8_t {
+	OK = 0,
+	COMPILATION_FAILED = 1,
+	UNKNOWN_OPCODE = 2,
+	BAD_REQUEST = 3,
+	UNSUPPORTED_VERSION = 4,
+	SERVER_BUSY = 5,
+	SERVER_ERROR = 6,
+	SERVER_IPC_ERROR = 7,
+	JOB_NOT_FOUND = 8,
+	JOB_PENDING = 9,
+};
+
+// More frames of the same request follow.
+constexpr uint8_t FLAG_MORE = 0x01;
+// COMPILE payload starts with a priority byte.
+constexpr uint8_t FLAG_PRIORITY = 0x02;
+// Payload is part of a zlib stream; see Opcode::COMPILE.
+constexpr uint8_t FLAG_COMPRESSED = 0x04;
+
+struct FrameHeader {
+	uint8_t version = PROTOCOL_VERSION;
+	Opcode opcode = Opcode::COMPILE;
+	uint8_t flags = 0;
+	Status status = Status::OK;
+	uint32_t request_id = 0;
+	uint32_t payload_len = 0;
+};
+
+struct FrameView {
+	FrameHeader header;
+	std::span<const uint8_t> payload;
+};
+
+inline void put_be16(uint8_t* out, uint16_t value) {
+	uint16_t net = htons(value);
+	std::memcpy(out, &net, sizeof(net));
+}
+
+inline void put_be32(uint8_t* out, uint32_t value) {
+	uint32_t net = htonl(value);
+	std::memcpy(out, &net, sizeof(net));
+}
+
+inline uint16_t get_be16(const uint8_t* in) {
+	uint16_t net;
+	std::memcpy(&net, in, sizeof(net));
+	return ntohs(net);
+}
+
+inline uint32_t get_be32(const uint8_t* in) {
+	uint32_t net;
+	std::memcpy(&net, in, sizeof(net));
+	return ntohl(net);
+}
+
+inline void put_be64(uint8_t* out, uint64_t value) {
+	put_be32(out, static_cast<uint32_t>(value >> 32));
+	put_be32(out + 4, static_cast<uint32_t>(value));
+}
+
+inline uint64_t get_be64(const uint8_t* in) { return (uint64_t(get_be32(in)) << 32) | get_be32(in + 4); }
+
+inline void encode_frame_header(const FrameHeader& header, uint8_t* out) {
+	out[0] = header.version;
+	out[1] = static_cast<uint8_t>(header.opcode);
+	out[2] = header.flags;
+	out[3] = static_cast<uint8_t>(header.status);
+	put_be32(out + 4, header.request_id);
+	put_be32(out + 8, header.payload_len);
+}
+
+inline FrameHeader decode_frame_header(const uint8_t* in) {
+	FrameHeader header;
+	header.version = in[0];
+	header.opcode = static_cast<Opcode>(in[1]);
+	header.flags = in[2];
+	header.status = static_cast<Status>(in[3]);
+	header.request_id = get_be32(in + 4);
+	header.payload_len = get_be32(in + 8);
+	return header;
+}
+
+// Header for a reply to request: same opcode and request id.
+inline FrameHeader make_response(const FrameHeader& request, Status status) {
+	FrameHeader header;
+	header.opcode = request.opcode;
+	header.status = status;
+	header.request_id = request.request_id;
+	return header;
+}
+
+inline const char* status_name(Status status) {
+	switch (status) {
+		case Status::OK:
+			return "OK";
+		case Status::COMPILATION_FAILED:
+			return "COMPILATION_FAILED";
+		case Status::UNKNOWN_OPCODE:
+			return "UNKNOWN_OPCODE";
+		case Status::BAD_REQUEST:
+			return "BAD_REQUEST";
+		case Status::UNSUPPORTED_VERSION:
+			return "UNSUPPORTED_VERSION";
+		case Status::SERVER_BUSY:
+			return "SERVER_BUSY";
+		case Status::SERVER_ERROR:
+			return "SERVER_ERROR";
+		case Status::SERVER_IPC_ERROR:
+			return "SERVER_IPC_ERROR";
+		case Status::JOB_NOT_FOUND:
+			return "JOB_NOT_FOUND";
+		case Status::JOB_PENDING:
+			return "JOB_PENDING";
+	}
+	return "UNKNOWN_STATUS";
+}
@@ -0,0 +1,215 @@
+#pragma once
+
+#include <sys/uio.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "Protocol.hpp"
+#include "WorkerPool.hpp"
+#include "buffer_pool.hpp"
+#include "logger.hpp"
+
+constexpr uint32_t MAX_FRAME_SIZE = 20 * 1024 * 1024;
+// Upper bound on iovecs handed to one gathered write; two per queued frame.
+constexpr size_t MAX_WRITE_IOVECS = 16;
+// Worker tasks one connection may have running at once; frame dispatch pauses at the limit.
+constexpr size_t MAX_TASKS_PER_CONNECTION = 16;
+// Received frames one connection may have waiting for dispatch. Past either limit the loop stops reading its socket
+// until dispatch catches up, so a client that outpaces its workers is held back by TCP flow control.
+constexpr size_t MAX_INBOX_FRAMES = 64;
+constexpr size_t MAX_INBOX_BYTES = 4 * 1024 * 1024;
+
+class IoLoop;
+class FrameConnection;
+
+// Per-connection protocol state machine driven by the reactor. on_frame is called on the connection's I/O
+// thread for every complete frame, strictly in order; blocking work must go through
+// FrameConnection::defer or FrameConnection::spawn. Frames are leased from BufferPool::shared() and return there
+// when dropped.
+class FrameSession {
+   public:
+	virtual ~FrameSession() = default;
+
+	virtual void on_frame(FrameConnection& conn, const FrameHeader& header, PooledBuffer&& payload) = 0;
+
+	// The client has stopped sending and every frame it sent has been dispatched. Replies still owed go out as
+	// they become ready; work that is only waiting to start may be given up.
+	virtual void on_hangup() {}
+
+	virtual void on_close() {}
+};
+
+// Framing, dispatch and write queue of one reactor connection. The owning IoLoop moves the bytes.
+class FrameConnection : public std::enable_shared_from_this<FrameConnection> {
+   public:
+	FrameConnection(int fd, IoLoop& loop, Logger& logger);
+	~FrameConnection();
+
+	int fd() const { return fd_; }
+
+	// Thread-safe: queues a frame for writing; payload_len is filled in from payload.
+	void send(FrameHeader header, std::vector<uint8_t> payload);
+
+	// Thread-safe: closes the connection once queued writes are flushed and no deferred task is running.
+	void close();
+
+	// Runs task on the worker pool; frame dispatch for this connection is paused until it returns. If the pool
+	// refuses or sheds the task, on_rejected runs on the I/O thread instead (default: close the connection).
+	void defer(std::function<void()> task, std::function<void()> on_rejected = nullptr);
+
+	// Like defer, but later frames keep being dispatched while task runs, so replies may go out of order.
+	void spawn(std::function<void()> task, std::function<void()> on_rejected = nullptr);
+
+	// Thread-safe: counts replies the session owes for work running outside the worker pool. Until they are
+	// settled the connection is busy, and close() waits for them as for a deferred task.
+	void expectReplies(size_t count);
+	void settleReplies(size_t count);
+
+   private:
+	friend class IoLoop;
+	friend class EventLoop;
+	friend class UringLoop;
+
+	void consume(const uint8_t* bytes, size_t len);
+	void dispatchFrames();
+	void enqueueWrite(FrameHeader header, std::vector<uint8_t>&& payload);
+	// Points iov at the unsent header/payload pieces of the queued frames; returns the number of entries used.
+	size_t gatherWrite(iovec* iov, size_t max_iov) const;
+	void advanceWrite(size_t written);
+	void maybeFinish();
+	bool inboxFull() const;
+	// Nothing received, queued, running or owed: closing now loses no work.
+	bool idle() const;
+	void closeNow();
+	void submit(std::function<void()> task, std::function<void()> on_rejected, bool pause);
+	void taskDone(bool paused);
+
+	int fd_;
+	IoLoop& loop_;
+	Logger& logger_;
+	std::unique_ptr<FrameSession> session_;
+
+	struct InFrame {
+		FrameHeader header;
+		PooledBuffer payload;
+	};
+
+	uint8_t header_[FRAME_HEADER_SIZE];
+	size_t header_read_;
+	bool in_body_;
+	FrameHeader current_;
+	PooledBuffer body_;
+	size_t body_read_;
+	std::deque<InFrame> inbox_;
+	size_t inbox_bytes_;
+	// The loop left the socket unread because the inbox was full.
+	bool read_paused_;
+
+	// Header is kept next to the payload instead of copying both into one buffer.
+	struct OutFrame {
+		uint8_t header[FRAME_HEADER_SIZE];
+		std::vector<uint8_t> payload;
+
+		size_t size() const { return sizeof(header) + payload.size(); }
+	};
+
+	std::deque<OutFrame> outbox_;
+	size_t out_offset_;
+
+	bool paused_;
+	size_t tasks_;
+	size_t owed_replies_;
+	bool peer_closed_;
+	// on_hangup has been called.
+	bool hung_up_;
+	bool close_requested_;
+	bool closed_;
+};
+
+// Common part of the reactor backends: the loop thread, cross-thread posting and connection accounting.
+class IoLoop {
+   public:
+	IoLoop(size_t id, WorkerPool& worker_pool, Logger& logger);
+	virtual ~IoLoop();
+
+	void start();
+
+	// Derived destructors must call stop() themselves.
+	void stop();
+
+	// Thread-safe: hands an accepted socket to this loop.
+	virtual void adopt(int fd, std::unique_ptr<FrameSession> session) = 0;
+
+	// Thread-safe: runs fn on the loop thread.
+	void post(std::function<void()> fn);
+
+	bool inLoopThread() const;
+
+	size_t connectionCount() const { return connection_count_.load(); }
+
+	// Thread-safe: closes the open connections on the loop thread and returns how many were closed; idle_only keeps
+	// those with work in progress, otherwise they are closed even with tasks still running. Must not be called from
+	// the loop thread.
+	size_t closeConnections(bool idle_only);
+
+   protected:
+	friend class FrameConnection;
+
+	virtual void run() = 0;
+	// Called on the loop thread when conn has queued output.
+	virtual void startWrite(FrameConnection& conn) = 0;
+	// Called on the loop thread once a full inbox has room again; reading must start over.
+	virtual void resumeRead(FrameConnection& conn) = 0;
+	// Called on the loop thread once conn is closed; must release the socket and forget the connection.
+	virtual void release(FrameConnection& conn) = 0;
+	// Called on the loop thread, or after it has exited: the connections not yet released.
+	virtual std::vector<std::shared_ptr<FrameConnection>> openConnections() = 0;
+
+	size_t closeAll(bool idle_only = false);
+	void wake();
+	void drainPosted();
+
+	size_t id_;
+	WorkerPool& worker_pool_;
+	Logger& logger_;
+	int wake_fd_;
+	std::atomic<bool> running_;
+	std::thread thread_;
+	std::atomic<std::thread::id> loop_thread_id_;
+
+	std::mutex posted_mutex_;
+	std::vector<std::function<void()>> posted_;
+
+	std::atomic<size_t> connection_count_;
+};
+
+// Readiness-based backend: edge-triggered epoll over non-blocking sockets.
+class EventLoop final : public IoLoop {
+   public:
+	EventLoop(size_t id, WorkerPool& worker_pool, Logger& logger);
+	~EventLoop() override;
+
+	// fd must already be non-blocking.
+	void adopt(int fd, std::unique_ptr<FrameSession> session) override;
+
+   private:
+	void run() override;
+	void startWrite(FrameConnection& conn) override;
+	void resumeRead(FrameConnection& conn) override;
+	void release(FrameConnection& conn) override;
+	std::vector<std::shared_ptr<FrameConnection>> openConnections() override;
+
+	void handleReadable(FrameConnection& conn);
+
+	int epoll_fd_;
+	std::unordered_map<int, std::shared_ptr<FrameConnection>> connections_;
+};
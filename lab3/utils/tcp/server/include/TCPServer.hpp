@@ -1,33 +1,104 @@
 #pragma once
 
 #include <netinet/in.h>
+#include <sys/socket.h>
 
 #include <atomic>
+#include <chrono>
 #include <cstdint>
 #include <functional>
+#include <string>
+#include <memory>
+#include <mutex>
 #include <thread>
+#include <unordered_set>
+#include <vector>
 
+#include "EventLoop.hpp"
+#include "UringLoop.hpp"
+#include "WorkerPool.hpp"
 #include "custom_exceptions.hpp"
 #include "logger.hpp"
 
+struct ListenerConfig {
+	size_t backlog = SOMAXCONN;
+	// Number of SO_REUSEPORT listening sockets, each with its own accept thread; 0 means one per core.
+	size_t acceptors = 1;
+	bool pin_acceptors = false;
+};
+
+struct ListenerStats {
+	uint64_t accepted = 0;
+	uint64_t accept_wakeups = 0;
+	uint32_t accept_queue_len = 0;
+	uint32_t accept_queue_max = 0;
+	// Host-wide TcpExt ListenOverflows / ListenDrops counted since the server started.
+	uint64_t listen_overflows = 0;
+	uint64_t listen_drops = 0;
+};
+
+std::string format_listener_stats(const ListenerStats& stats);
+
+enum class IoBackend { EPOLL, IO_URING };
+
+struct DrainReport {
+	size_t in_flight = 0;
+	size_t drained = 0;
+	size_t killed = 0;
+};
+
 class TCPServer {
    public:
 	using Handler = std::function<void(int client_fd)>;
+	using SessionFactory = std::function<std::unique_ptr<FrameSession>(int client_fd)>;
 
-	TCPServer(uint16_t port, Logger& logger, size_t backlog = 5);
+	TCPServer(uint16_t port, Logger& logger, const ListenerConfig& listener = {});
 	~TCPServer();
 
-	void start(const Handler& handler);
+	// Blocking mode: each accepted socket is queued to the worker pool and handler owns it on a worker thread.
+	void start(const Handler& handler, const WorkerPoolConfig& pool_config = {});
+
+	// Reactor mode: io_threads event loops drive one FrameSession per connection, deferred work runs on the
+	// worker pool. IO_URING falls back to epoll when the kernel refuses to set up a ring.
+	void start(const SessionFactory& factory, size_t io_threads, const WorkerPoolConfig& pool_config = {},
+	           IoBackend backend = IoBackend::EPOLL);
+
+	// Stops accepting, waits up to drain_timeout for live connections to finish on their own, then force-closes
+	// the rest. Reactor connections with no work in progress are closed at once rather than waited for.
+	DrainReport stop(std::chrono::milliseconds drain_timeout = std::chrono::milliseconds(0));
 
-	void stop();
+	size_t liveConnections();
+
+	WorkerPoolStats workerStats() const;
+
+	ListenerStats listenerStats() const;
 
    private:
-	void acceptLoop(const Handler& handler);
+	int openListenSocket(bool reuse_port);
+	size_t liveConnectionsLocked() const;
+	// Reactor mode: closes the connections with no work in progress; returns how many.
+	size_t closeIdleConnections();
+	void openListeners();
+	void startAcceptors(const std::function<void(int)>& on_accept, int accept_flags);
+	void acceptLoop(size_t acceptor_id, int listen_fd, int accept_flags, std::function<void(int)> on_accept);
 
 	uint16_t port_;
-	int listen_fd_;
-	size_t backlog_;
+	ListenerConfig listener_;
+	std::vector<int> listen_fds_;
 	std::atomic<bool> running_;
 	Logger& logger_;
-	std::thread accept_thread_;
+	std::vector<std::thread> accept_threads_;
+	int stop_fd_;
+	std::atomic<uint64_t> accepted_;
+	std::atomic<uint64_t> accept_wakeups_;
+	uint64_t overflows_baseline_;
+	uint64_t drops_baseline_;
+
+	std::unique_ptr<WorkerPool> worker_pool_;
+	std::vector<std::unique_ptr<IoLoop>> loops_;
+	std::vector<UringLoop*> uring_loops_;
+	std::atomic<size_t> next_loop_;
+	std::mutex active_mutex_;
+	std::unordered_set<int> active_fds_;
+	bool force_closing_;
 };
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <linux/io_uring.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "EventLoop.hpp"
+
+// Completion-based backend on a raw io_uring instance: accept, recv and send are submitted as SQEs and completed
+// on the loop thread. Reads land in buffers registered with the ring when the kernel allows it.
+class UringLoop final : public IoLoop {
+   public:
+	// Throws SocketException when io_uring is unavailable so the caller can fall back to epoll.
+	UringLoop(size_t id, WorkerPool& worker_pool, Logger& logger, unsigned entries = 256);
+	~UringLoop() override;
+
+	// fd must be blocking: io_uring returns -EAGAIN instead of waiting on O_NONBLOCK sockets.
+	void adopt(int fd, std::unique_ptr<FrameSession> session) override;
+
+	// Thread-safe: keeps an accept armed on listen_fd and hands every accepted socket to on_accept on the loop
+	// thread. listen_fd must be blocking as well.
+	void acceptOn(int listen_fd, std::function<void(int)> on_accept);
+
+	// Thread-safe: accepts that complete after this call are not re-armed.
+	void stopAccepting() { accepting_ = false; }
+
+   private:
+	enum Op : uint64_t { OP_WAKE = 0, OP_ACCEPT = 1, OP_RECV = 2, OP_SEND = 3 };
+
+	struct UringConnection {
+		std::shared_ptr<FrameConnection> conn;
+		int buf_index = -1;
+		std::vector<uint8_t> heap_buf;
+		// Kept here so the kernel can read them until the send completes.
+		iovec send_iov[MAX_WRITE_IOVECS];
+		msghdr send_msg;
+		bool recv_pending = false;
+		bool send_pending = false;
+		bool released = false;
+	};
+
+	struct Listener {
+		int fd;
+		std::function<void(int)> on_accept;
+	};
+
+	void run() override;
+	void startWrite(FrameConnection& conn) override;
+	void resumeRead(FrameConnection& conn) override;
+	void release(FrameConnection& conn) override;
+	std::vector<std::shared_ptr<FrameConnection>> openConnections() override;
+
+	void closeRing();
+	io_uring_sqe* nextSqe();
+	int submit(unsigned wait_for);
+	void reap();
+	void complete(uint64_t user_data, int res);
+
+	void armWake();
+	void armAccept(size_t listener_id);
+	void armRecv(uint64_t conn_id, UringConnection& entry);
+	void armSend(uint64_t conn_id, UringConnection& entry);
+	void onAccept(size_t listener_id, int res);
+	void onRecv(uint64_t conn_id, int res);
+	void onSend(uint64_t conn_id, int res);
+	void forgetIfIdle(uint64_t conn_id);
+
+	int ring_fd_;
+	io_uring_params params_;
+	void* sq_ring_;
+	size_t sq_ring_size_;
+	void* cq_ring_;
+	size_t cq_ring_size_;
+	io_uring_sqe* sqes_;
+	size_t sqes_size_;
+	unsigned* sq_head_;
+	unsigned* sq_tail_;
+	unsigned* sq_mask_;
+	unsigned* sq_array_;
+	unsigned* cq_head_;
+	unsigned* cq_tail_;
+	unsigned* cq_mask_;
+	io_uring_cqe* cqes_;
+	unsigned sqe_tail_;
+	unsigned to_submit_;
+	size_t inflight_;
+
+	// Fixed receive buffers registered with IORING_REGISTER_BUFFERS, one per connection while it is open.
+	std::vector<uint8_t> buf_arena_;
+	std::vector<iovec> buf_iovecs_;
+	std::vector<int> free_bufs_;
+	bool fixed_bufs_;
+
+	std::atomic<bool> accepting_;
+	std::vector<Listener> listeners_;
+	uint64_t next_conn_id_;
+	std::unordered_map<uint64_t, UringConnection> connections_;
+	std::unordered_map<const FrameConnection*, uint64_t> ids_;
+};
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "logger.hpp"
+
+enum class OverloadPolicy { REJECT_NEW, SHED_OLDEST };
+
+struct WorkerPoolConfig {
+	size_t workers = 16;
+	size_t max_pending = 256;
+	OverloadPolicy policy = OverloadPolicy::REJECT_NEW;
+};
+
+struct WorkerPoolStats {
+	size_t queue_depth = 0;
+	size_t busy_workers = 0;
+	uint64_t accepted = 0;
+	uint64_t rejected = 0;
+	uint64_t shed = 0;
+	uint64_t completed = 0;
+	uint64_t total_wait_us = 0;
+	uint64_t max_wait_us = 0;
+	uint64_t total_run_us = 0;
+	uint64_t max_run_us = 0;
+};
+
+class WorkerPool {
+   public:
+	using Task = std::function<void()>;
+
+	WorkerPool(const WorkerPoolConfig& config, Logger& logger);
+	~WorkerPool();
+
+	// Returns false when the pending queue is full and the policy is REJECT_NEW. With SHED_OLDEST the oldest
+	// pending task is dropped instead and its on_drop callback runs on the submitting thread.
+	bool submit(Task task, Task on_drop = nullptr);
+
+	WorkerPoolStats stats() const;
+
+	void shutdown();
+
+   private:
+	using Clock = std::chrono::steady_clock;
+
+	struct Job {
+		Task run;
+		Task on_drop;
+		Clock::time_point enqueued;
+	};
+
+	void workerLoop(size_t worker_id);
+
+	WorkerPoolConfig config_;
+	Logger& logger_;
+	mutable std::mutex mutex_;
+	std::condition_variable cv_;
+	std::deque<Job> jobs_;
+	std::vector<std::thread> workers_;
+	WorkerPoolStats stats_;
+	bool stopping_;
+};
+
+std::string format_worker_stats(const WorkerPoolStats& stats);
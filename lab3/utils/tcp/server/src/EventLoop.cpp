@@ -0,0 +1,527 @@
+#include "EventLoop.hpp"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <future>
+#include <string>
+
+#include "custom_exceptions.hpp"
+
+namespace {
+
+constexpr int MAX_EPOLL_EVENTS = 64;
+constexpr size_t READ_CHUNK_SIZE = 16 * 1024;
+
+}  // namespace
+
+FrameConnection::FrameConnection(int fd, IoLoop& loop, Logger& logger)
+    : fd_(fd),
+      loop_(loop),
+      logger_(logger),
+      header_{},
+      header_read_(0),
+      in_body_(false),
+      body_read_(0),
+      inbox_bytes_(0),
+      read_paused_(false),
+      out_offset_(0),
+      paused_(false),
+      tasks_(0),
+      owed_replies_(0),
+      peer_closed_(false),
+      hung_up_(false),
+      close_requested_(false),
+      closed_(false) {}
+
+FrameConnection::~FrameConnection() {
+	if (!closed_ && fd_ >= 0) {
+		::close(fd_);
+	}
+}
+
+void FrameConnection::send(FrameHeader header, std::vector<uint8_t> payload) {
+	if (loop_.inLoopThread()) {
+		enqueueWrite(header, std::move(payload));
+		return;
+	}
+	loop_.post([self = shared_from_this(), header, payload = std::move(payload)]() mutable {
+		self->enqueueWrite(header, std::move(payload));
+	});
+}
+
+void FrameConnection::close() {
+	if (loop_.inLoopThread()) {
+		close_requested_ = true;
+		maybeFinish();
+		return;
+	}
+	loop_.post([self = shared_from_this()]() {
+		self->close_requested_ = true;
+		self->maybeFinish();
+	});
+}
+
+void FrameConnection::defer(std::function<void()> task, std::function<void()> on_rejected) {
+	submit(std::move(task), std::move(on_rejected), true);
+}
+
+void FrameConnection::spawn(std::function<void()> task, std::function<void()> on_rejected) {
+	submit(std::move(task), std::move(on_rejected), false);
+}
+
+void FrameConnection::expectReplies(size_t count) {
+	if (loop_.inLoopThread()) {
+		owed_replies_ += count;
+		return;
+	}
+	loop_.post([self = shared_from_this(), count]() { self->owed_replies_ += count; });
+}
+
+void FrameConnection::settleReplies(size_t count) {
+	// Posted behind the replies themselves, so the connection is never seen idle before they are queued.
+	loop_.post([self = shared_from_this(), count]() {
+		self->owed_replies_ -= count;
+		self->maybeFinish();
+	});
+}
+
+void FrameConnection::submit(std::function<void()> task, std::function<void()> on_rejected, bool pause) {
+	++tasks_;
+	paused_ = paused_ || pause;
+	auto self = shared_from_this();
+	auto rejected = [self, on_rejected = std::move(on_rejected), pause]() {
+		self->loop_.post([self, on_rejected, pause]() {
+			self->logger_.warning("Worker pool overloaded, request on fd=" + std::to_string(self->fd_) + " refused");
+			if (on_rejected) {
+				on_rejected();
+			} else {
+				self->close();
+			}
+			self->taskDone(pause);
+		});
+	};
+	bool accepted = loop_.worker_pool_.submit(
+	    [self, task = std::move(task), pause]() {
+		    try {
+			    task();
+		    } catch (const std::exception& ex) {
+			    self->logger_.error("Deferred task exception for fd=" + std::to_string(self->fd_) + ": " + ex.what());
+			    self->close();
+		    }
+		    self->loop_.post([self, pause]() { self->taskDone(pause); });
+	    },
+	    rejected);
+	if (!accepted) {
+		rejected();
+	}
+}
+
+void FrameConnection::taskDone(bool paused) {
+	--tasks_;
+	if (paused) {
+		paused_ = false;
+	}
+	dispatchFrames();
+}
+
+void FrameConnection::consume(const uint8_t* bytes, size_t len) {
+	while (len > 0 && !closed_) {
+		if (!in_body_) {
+			size_t take = std::min(len, sizeof(header_) - header_read_);
+			std::memcpy(header_ + header_read_, bytes, take);
+			header_read_ += take;
+			bytes += take;
+			len -= take;
+			if (header_read_ < sizeof(header_)) {
+				return;
+			}
+			current_ = decode_frame_header(header_);
+			uint32_t size = current_.payload_len;
+			if (size > MAX_FRAME_SIZE) {
+				logger_.error("Declared payload size too large on fd=" + std::to_string(fd_) + ": " +
+				              std::to_string(size));
+				closeNow();
+				return;
+			}
+			header_read_ = 0;
+			body_ = BufferPool::shared().acquire(size);
+			body_read_ = 0;
+			in_body_ = true;
+		}
+
+		size_t take = std::min(len, body_.size() - body_read_);
+		if (take > 0) {
+			std::memcpy(body_.data() + body_read_, bytes, take);
+			body_read_ += take;
+			bytes += take;
+			len -= take;
+		}
+		if (body_read_ == body_.size()) {
+			inbox_bytes_ += body_.size();
+			inbox_.push_back({current_, std::move(body_)});
+			body_read_ = 0;
+			in_body_ = false;
+		}
+	}
+}
+
+void FrameConnection::dispatchFrames() {
+	while (!closed_ && !paused_ && tasks_ < MAX_TASKS_PER_CONNECTION && !close_requested_ && !inbox_.empty()) {
+		auto frame = std::move(inbox_.front());
+		inbox_.pop_front();
+		inbox_bytes_ -= frame.payload.size();
+		try {
+			session_->on_frame(*this, frame.header, std::move(frame.payload));
+		} catch (const std::exception& ex) {
+			logger_.error("Session exception for fd=" + std::to_string(fd_) + ": " + ex.what());
+			closeNow();
+			return;
+		}
+	}
+	if (read_paused_ && !closed_ && !inboxFull()) {
+		read_paused_ = false;
+		loop_.resumeRead(*this);
+	}
+	if (peer_closed_ && !hung_up_ && !closed_ && inbox_.empty()) {
+		hung_up_ = true;
+		try {
+			session_->on_hangup();
+		} catch (const std::exception& ex) {
+			logger_.error("Session on_hangup exception for fd=" + std::to_string(fd_) + ": " + ex.what());
+		}
+	}
+	maybeFinish();
+}
+
+void FrameConnection::enqueueWrite(FrameHeader header, std::vector<uint8_t>&& payload) {
+	if (closed_) {
+		logger_.debug("Dropping " + std::to_string(payload.size()) + " bytes for closed fd=" + std::to_string(fd_));
+		return;
+	}
+	header.payload_len = static_cast<uint32_t>(payload.size());
+	OutFrame frame;
+	encode_frame_header(header, frame.header);
+	frame.payload = std::move(payload);
+	outbox_.push_back(std::move(frame));
+	loop_.startWrite(*this);
+}
+
+size_t FrameConnection::gatherWrite(iovec* iov, size_t max_iov) const {
+	size_t used = 0;
+	size_t skip = out_offset_;
+	for (const auto& frame : outbox_) {
+		if (used + 2 > max_iov) {
+			break;
+		}
+		if (skip < sizeof(frame.header)) {
+			iov[used++] = {const_cast<uint8_t*>(frame.header) + skip, sizeof(frame.header) - skip};
+			skip = 0;
+		} else {
+			skip -= sizeof(frame.header);
+		}
+		if (skip < frame.payload.size()) {
+			iov[used++] = {const_cast<uint8_t*>(frame.payload.data()) + skip, frame.payload.size() - skip};
+		}
+		skip = 0;
+	}
+	return used;
+}
+
+void FrameConnection::advanceWrite(size_t written) {
+	out_offset_ += written;
+	while (!outbox_.empty() && out_offset_ >= outbox_.front().size()) {
+		out_offset_ -= outbox_.front().size();
+		outbox_.pop_front();
+	}
+}
+
+void FrameConnection::maybeFinish() {
+	if (closed_ || tasks_ > 0 || owed_replies_ > 0) {
+		return;
+	}
+	bool idle = inbox_.empty() || close_requested_;
+	if ((peer_closed_ || close_requested_) && idle && outbox_.empty()) {
+		closeNow();
+	}
+}
+
+bool FrameConnection::inboxFull() const {
+	return inbox_.size() >= MAX_INBOX_FRAMES || inbox_bytes_ >= MAX_INBOX_BYTES;
+}
+
+bool FrameConnection::idle() const {
+	return tasks_ == 0 && owed_replies_ == 0 && inbox_.empty() && outbox_.empty() && !in_body_ && header_read_ == 0;
+}
+
+void FrameConnection::closeNow() {
+	if (closed_) {
+		return;
+	}
+	closed_ = true;
+	logger_.info("Client fd=" + std::to_string(fd_) + " connection closed.");
+	if (session_) {
+		try {
+			session_->on_close();
+		} catch (const std::exception& ex) {
+			logger_.error("Session on_close exception for fd=" + std::to_string(fd_) + ": " + ex.what());
+		}
+	}
+	loop_.release(*this);
+}
+
+IoLoop::IoLoop(size_t id, WorkerPool& worker_pool, Logger& logger)
+    : id_(id), worker_pool_(worker_pool), logger_(logger), wake_fd_(-1), running_(false), connection_count_(0) {
+	wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (wake_fd_ < 0) {
+		logger_.error("eventfd failed: " + std::string(strerror(errno)));
+		throw SocketException("eventfd() failed");
+	}
+}
+
+IoLoop::~IoLoop() {
+	if (wake_fd_ >= 0) {
+		::close(wake_fd_);
+	}
+}
+
+void IoLoop::start() {
+	running_ = true;
+	thread_ = std::thread([this]() {
+		loop_thread_id_ = std::this_thread::get_id();
+		logger_.debug("IoLoop " + std::to_string(id_) + " running");
+		run();
+		loop_thread_id_ = std::thread::id();
+		logger_.debug("IoLoop " + std::to_string(id_) + " exiting");
+	});
+	logger_.debug("IoLoop " + std::to_string(id_) + " started");
+}
+
+void IoLoop::stop() {
+	if (!running_.exchange(false)) {
+		return;
+	}
+	wake();
+	if (thread_.joinable()) {
+		thread_.join();
+	}
+	closeAll();
+	{
+		std::lock_guard lock(posted_mutex_);
+		posted_.clear();
+	}
+	logger_.debug("IoLoop " + std::to_string(id_) + " stopped");
+}
+
+void IoLoop::post(std::function<void()> fn) {
+	{
+		std::lock_guard lock(posted_mutex_);
+		posted_.push_back(std::move(fn));
+	}
+	wake();
+}
+
+size_t IoLoop::closeConnections(bool idle_only) {
+	if (!running_.load()) {
+		return 0;
+	}
+	std::promise<size_t> closed;
+	std::future<size_t> result = closed.get_future();
+	post([this, idle_only, &closed]() { closed.set_value(closeAll(idle_only)); });
+	return result.get();
+}
+
+size_t IoLoop::closeAll(bool idle_only) {
+	size_t closed = 0;
+	for (auto& conn : openConnections()) {
+		if (!conn->closed_ && (!idle_only || conn->idle())) {
+			conn->closeNow();
+			++closed;
+		}
+	}
+	return closed;
+}
+
+bool IoLoop::inLoopThread() const { return std::this_thread::get_id() == loop_thread_id_.load(); }
+
+void IoLoop::wake() {
+	uint64_t one = 1;
+	if (::write(wake_fd_, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+		logger_.warning("IoLoop " + std::to_string(id_) + " wake failed: " + std::string(strerror(errno)));
+	}
+}
+
+void IoLoop::drainPosted() {
+	uint64_t counter;
+	while (::read(wake_fd_, &counter, sizeof(counter)) > 0) {
+	}
+	std::vector<std::function<void()>> batch;
+	{
+		std::lock_guard lock(posted_mutex_);
+		batch.swap(posted_);
+	}
+	for (auto& fn : batch) {
+		fn();
+	}
+}
+
+EventLoop::EventLoop(size_t id, WorkerPool& worker_pool, Logger& logger)
+    : IoLoop(id, worker_pool, logger), epoll_fd_(-1) {
+	epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd_ < 0) {
+		logger_.error("epoll_create1 failed: " + std::string(strerror(errno)));
+		throw SocketException("epoll_create1() failed");
+	}
+	epoll_event ev{};
+	ev.events = EPOLLIN;
+	ev.data.fd = wake_fd_;
+	if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &ev) < 0) {
+		::close(epoll_fd_);
+		logger_.error("epoll_ctl(wake_fd) failed: " + std::string(strerror(errno)));
+		throw SocketException("epoll_ctl() failed for wake fd");
+	}
+}
+
+EventLoop::~EventLoop() {
+	stop();
+	if (epoll_fd_ >= 0) {
+		::close(epoll_fd_);
+	}
+}
+
+void EventLoop::adopt(int fd, std::unique_ptr<FrameSession> session) {
+	auto conn = std::make_shared<FrameConnection>(fd, *this, logger_);
+	conn->session_ = std::move(session);
+	connection_count_.fetch_add(1);
+	post([this, conn]() {
+		epoll_event ev{};
+		ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+		ev.data.fd = conn->fd_;
+		if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, conn->fd_, &ev) < 0) {
+			logger_.error("epoll_ctl(ADD) failed for fd=" + std::to_string(conn->fd_) + ": " +
+			              std::string(strerror(errno)));
+			conn->closed_ = true;
+			::close(conn->fd_);
+			connection_count_.fetch_sub(1);
+			return;
+		}
+		connections_[conn->fd_] = conn;
+		logger_.debug("EventLoop " + std::to_string(id_) + " adopted fd=" + std::to_string(conn->fd_));
+	});
+}
+
+void EventLoop::handleReadable(FrameConnection& conn) {
+	uint8_t chunk[READ_CHUNK_SIZE];
+	while (!conn.closed_ && !conn.peer_closed_) {
+		if (conn.inboxFull()) {
+			// The rest stays in the socket; dispatch resumes reading once the inbox has room.
+			conn.read_paused_ = true;
+			break;
+		}
+		ssize_t n = ::recv(conn.fd_, chunk, sizeof(chunk), 0);
+		if (n > 0) {
+			conn.consume(chunk, static_cast<size_t>(n));
+			continue;
+		}
+		if (n == 0) {
+			logger_.debug("Peer closed fd=" + std::to_string(conn.fd_));
+			conn.peer_closed_ = true;
+			break;
+		}
+		if (errno == EINTR) {
+			continue;
+		}
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			break;
+		}
+		logger_.warning("recv failed on fd=" + std::to_string(conn.fd_) + ": " + std::string(strerror(errno)));
+		conn.closeNow();
+		return;
+	}
+	conn.dispatchFrames();
+}
+
+void EventLoop::resumeRead(FrameConnection& conn) {
+	// Edge-triggered: no new event comes for data already waiting. Posted, as dispatch may run inside handleReadable.
+	post([this, self = conn.shared_from_this()]() { handleReadable(*self); });
+}
+
+void EventLoop::startWrite(FrameConnection& conn) {
+	iovec iov[MAX_WRITE_IOVECS];
+	while (!conn.closed_ && !conn.outbox_.empty()) {
+		msghdr msg{};
+		msg.msg_iov = iov;
+		msg.msg_iovlen = conn.gatherWrite(iov, MAX_WRITE_IOVECS);
+		ssize_t n = ::sendmsg(conn.fd_, &msg, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				return;
+			}
+			logger_.warning("send failed on fd=" + std::to_string(conn.fd_) + ": " + std::string(strerror(errno)));
+			conn.closeNow();
+			return;
+		}
+		conn.advanceWrite(static_cast<size_t>(n));
+	}
+	conn.maybeFinish();
+}
+
+void EventLoop::release(FrameConnection& conn) {
+	epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, conn.fd_, nullptr);
+	::close(conn.fd_);
+	auto it = connections_.find(conn.fd_);
+	if (it != connections_.end() && it->second.get() == &conn) {
+		connections_.erase(it);
+		connection_count_.fetch_sub(1);
+	}
+}
+
+std::vector<std::shared_ptr<FrameConnection>> EventLoop::openConnections() {
+	std::vector<std::shared_ptr<FrameConnection>> connections;
+	connections.reserve(connections_.size());
+	for (auto& [fd, conn] : connections_) {
+		connections.push_back(conn);
+	}
+	return connections;
+}
+
+void EventLoop::run() {
+	epoll_event events[MAX_EPOLL_EVENTS];
+	while (running_.load()) {
+		int n = epoll_wait(epoll_fd_, events, MAX_EPOLL_EVENTS, -1);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			logger_.error("epoll_wait failed in loop " + std::to_string(id_) + ": " + std::string(strerror(errno)));
+			break;
+		}
+		for (int i = 0; i < n; ++i) {
+			int fd = events[i].data.fd;
+			if (fd == wake_fd_) {
+				drainPosted();
+				continue;
+			}
+			auto it = connections_.find(fd);
+			if (it == connections_.end()) {
+				continue;
+			}
+			auto conn = it->second;
+			uint32_t mask = events[i].events;
+			if (mask & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+				handleReadable(*conn);
+			}
+			if ((mask & EPOLLOUT) && !conn->closed_) {
+				startWrite(*conn);
+			}
+		}
+	}
+}
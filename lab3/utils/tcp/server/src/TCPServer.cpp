@@ -1,25 +1,216 @@
 #include "TCPServer.hpp"
 
+#include <fcntl.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <chrono>
 #include <cstring>
+#include <fstream>
+#include <sstream>
 #include <system_error>
 
-TCPServer::TCPServer(uint16_t port, Logger& logger, size_t backlog)
-    : port_(port), listen_fd_(-1), backlog_(backlog), running_(false), logger_(logger) {}
+namespace {
+
+// Reads a TcpExt counter (e.g. ListenOverflows) from /proc/net/netstat; returns 0 when unavailable.
+uint64_t read_tcp_ext_counter(const std::string& name) {
+	std::ifstream netstat("/proc/net/netstat");
+	std::string names_line;
+	std::string values_line;
+	while (std::getline(netstat, names_line) && std::getline(netstat, values_line)) {
+		if (names_line.rfind("TcpExt:", 0) != 0) {
+			continue;
+		}
+		std::istringstream names(names_line);
+		std::istringstream values(values_line);
+		std::string key;
+		std::string value;
+		while (names >> key && values >> value) {
+			if (key == name) {
+				return std::strtoull(value.c_str(), nullptr, 10);
+			}
+		}
+	}
+	return 0;
+}
+
+}  // namespace
+
+TCPServer::TCPServer(uint16_t port, Logger& logger, const ListenerConfig& listener)
+    : port_(port),
+      listener_(listener),
+      running_(false),
+      logger_(logger),
+      stop_fd_(-1),
+      accepted_(0),
+      accept_wakeups_(0),
+      overflows_baseline_(0),
+      drops_baseline_(0),
+      next_loop_(0),
+      force_closing_(false) {
+	if (listener_.acceptors == 0) {
+		listener_.acceptors = std::max(1u, std::thread::hardware_concurrency());
+	}
+}
 
 TCPServer::~TCPServer() { stop(); }
 
-void TCPServer::start(const Handler& handler) {
+void TCPServer::start(const Handler& handler, const WorkerPoolConfig& pool_config) {
 	if (running_.load()) {
 		logger_.warning("Server is already running on port " + std::to_string(port_));
 		return;
 	}
 
-	listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
-	if (listen_fd_ < 0) {
+	worker_pool_ = std::make_unique<WorkerPool>(pool_config, logger_);
+
+	startAcceptors([this, handler](int client_fd) {
+		auto close_fd = [client_fd, this_logger = &logger_]() {
+			this_logger->warning("Dropping queued client fd=" + std::to_string(client_fd) + " (overload or shutdown).");
+			::close(client_fd);
+		};
+		bool accepted = worker_pool_->submit(
+		    [this, handler, client_fd]() {
+			    {
+				    std::lock_guard lock(active_mutex_);
+				    if (force_closing_) {
+					    ::close(client_fd);
+					    return;
+				    }
+				    active_fds_.insert(client_fd);
+			    }
+			    try {
+				    handler(client_fd);
+			    } catch (const std::exception& ex) {
+				    logger_.error("Handler exception for fd=" + std::to_string(client_fd) + ": " + ex.what());
+			    }
+			    {
+				    std::lock_guard lock(active_mutex_);
+				    active_fds_.erase(client_fd);
+				    ::close(client_fd);
+			    }
+
+			    logger_.info("Client fd=" + std::to_string(client_fd) + " processing finished.");
+		    },
+		    close_fd);
+		if (!accepted) {
+			logger_.warning("Worker pool full, rejecting client fd=" + std::to_string(client_fd));
+			::close(client_fd);
+		}
+	}, SOCK_CLOEXEC);
+	logger_.info("Server started with " + std::to_string(pool_config.workers) + " workers, listening on port " +
+	             std::to_string(port_));
+}
+
+void TCPServer::start(const SessionFactory& factory, size_t io_threads, const WorkerPoolConfig& pool_config,
+                      IoBackend backend) {
+	if (running_.load()) {
+		logger_.warning("Server is already running on port " + std::to_string(port_));
+		return;
+	}
+	if (io_threads == 0) {
+		io_threads = 1;
+	}
+
+	worker_pool_ = std::make_unique<WorkerPool>(pool_config, logger_);
+	if (backend == IoBackend::IO_URING) {
+		try {
+			for (size_t i = 0; i < io_threads; ++i) {
+				auto loop = std::make_unique<UringLoop>(i, *worker_pool_, logger_);
+				uring_loops_.push_back(loop.get());
+				loops_.push_back(std::move(loop));
+			}
+		} catch (const SocketException& ex) {
+			logger_.warning(std::string("io_uring backend unavailable (") + ex.what() + "), falling back to epoll");
+			uring_loops_.clear();
+			loops_.clear();
+			backend = IoBackend::EPOLL;
+		}
+	}
+	if (backend == IoBackend::EPOLL) {
+		for (size_t i = 0; i < io_threads; ++i) {
+			loops_.push_back(std::make_unique<EventLoop>(i, *worker_pool_, logger_));
+		}
+	}
+	for (auto& loop : loops_) {
+		loop->start();
+	}
+
+	auto on_accept = [this, factory](int client_fd) {
+		auto& loop = *loops_[next_loop_.fetch_add(1) % loops_.size()];
+		loop.adopt(client_fd, factory(client_fd));
+	};
+	if (backend == IoBackend::EPOLL) {
+		startAcceptors(on_accept, SOCK_CLOEXEC | SOCK_NONBLOCK);
+	} else {
+		openListeners();
+		running_ = true;
+		// The ring accepts on its own; each listener is owned by one loop and connections are spread over all.
+		for (size_t i = 0; i < listen_fds_.size(); ++i) {
+			int listen_fd = listen_fds_[i];
+			int flags = fcntl(listen_fd, F_GETFL);
+			if (flags >= 0) {
+				fcntl(listen_fd, F_SETFL, flags & ~O_NONBLOCK);
+			}
+			uring_loops_[i % uring_loops_.size()]->acceptOn(listen_fd, [this, on_accept, i](int client_fd) {
+				accepted_.fetch_add(1);
+				accept_wakeups_.fetch_add(1);
+				logger_.info("New client connected, fd=" + std::to_string(client_fd) + " on port " +
+				             std::to_string(port_) + " (acceptor " + std::to_string(i) + ")");
+				on_accept(client_fd);
+			});
+		}
+	}
+	logger_.info("Server started in reactor mode with " + std::to_string(io_threads) + " " +
+	             (backend == IoBackend::IO_URING ? "io_uring" : "epoll") + " I/O threads, listening on port " +
+	             std::to_string(port_));
+}
+
+WorkerPoolStats TCPServer::workerStats() const { return worker_pool_ ? worker_pool_->stats() : WorkerPoolStats{}; }
+
+void TCPServer::openListeners() {
+	bool reuse_port = listener_.acceptors > 1;
+	try {
+		for (size_t i = 0; i < listener_.acceptors; ++i) {
+			listen_fds_.push_back(openListenSocket(reuse_port));
+		}
+		stop_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (stop_fd_ < 0) {
+			logger_.error("eventfd failed: " + std::string(strerror(errno)));
+			throw SocketException("eventfd() failed for acceptors");
+		}
+	} catch (const SocketException&) {
+		for (int fd : listen_fds_) {
+			::close(fd);
+		}
+		listen_fds_.clear();
+		throw;
+	}
+
+	overflows_baseline_ = read_tcp_ext_counter("ListenOverflows");
+	drops_baseline_ = read_tcp_ext_counter("ListenDrops");
+	logger_.info(std::to_string(listen_fds_.size()) + " listener(s) open on port " + std::to_string(port_) +
+	             " with backlog " + std::to_string(listener_.backlog) + (reuse_port ? " and SO_REUSEPORT" : ""));
+}
+
+void TCPServer::startAcceptors(const std::function<void(int)>& on_accept, int accept_flags) {
+	openListeners();
+	running_ = true;
+	for (size_t i = 0; i < listen_fds_.size(); ++i) {
+		accept_threads_.emplace_back(&TCPServer::acceptLoop, this, i, listen_fds_[i], accept_flags, on_accept);
+	}
+	logger_.info(std::to_string(accept_threads_.size()) + " acceptor thread(s) running on port " +
+	             std::to_string(port_));
+}
+
+int TCPServer::openListenSocket(bool reuse_port) {
+	int listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (listen_fd < 0) {
 		logger_.error("Failed to create listen socket: " + std::string(strerror(errno)));
 		throw SocketException("socket() failed");
 	}
@@ -30,109 +221,239 @@ void TCPServer::start(const Handler& handler) {
 	addr.sin_port = htons(port_);
 
 	int opt = 1;
-	if (setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
+	if (setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
 		logger_.warning("setsockopt(SO_REUSEADDR) failed: " + std::string(strerror(errno)));
 	}
+	if (reuse_port && setsockopt(listen_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+		::close(listen_fd);
+		logger_.error("setsockopt(SO_REUSEPORT) failed: " + std::string(strerror(errno)));
+		throw SocketException("setsockopt(SO_REUSEPORT) failed");
+	}
 
-	if (bind(listen_fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
-		::close(listen_fd_);
-		listen_fd_ = -1;
+	if (bind(listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+		::close(listen_fd);
 		logger_.error("Failed to bind to port " + std::to_string(port_) + ": " + std::string(strerror(errno)));
 		throw SocketException("bind() failed on port " + std::to_string(port_));
 	}
 
-	if (listen(listen_fd_, static_cast<int>(backlog_)) < 0) {
-		::close(listen_fd_);
-		listen_fd_ = -1;
+	if (listen(listen_fd, static_cast<int>(listener_.backlog)) < 0) {
+		::close(listen_fd);
 		logger_.error("Failed to listen on port " + std::to_string(port_) + ": " + std::string(strerror(errno)));
 		throw SocketException("listen() failed");
 	}
-
-	running_ = true;
-	logger_.info("Server started, listening on port " + std::to_string(port_));
-
-	accept_thread_ = std::thread(&TCPServer::acceptLoop, this, handler);
+	return listen_fd;
 }
 
-void TCPServer::acceptLoop(const Handler& handler) {
-	logger_.debug("Accept loop started for port " + std::to_string(port_));
+void TCPServer::acceptLoop(size_t acceptor_id, int listen_fd, int accept_flags, std::function<void(int)> on_accept) {
+	if (listener_.pin_acceptors) {
+		unsigned int cpus = std::max(1u, std::thread::hardware_concurrency());
+		cpu_set_t cpu_set;
+		CPU_ZERO(&cpu_set);
+		CPU_SET(acceptor_id % cpus, &cpu_set);
+		int rc = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+		if (rc != 0) {
+			logger_.warning("Failed to pin acceptor " + std::to_string(acceptor_id) + ": " + std::string(strerror(rc)));
+		}
+	}
+
+	logger_.debug("Accept loop " + std::to_string(acceptor_id) + " started for port " + std::to_string(port_));
+	pollfd fds[2] = {{listen_fd, POLLIN, 0}, {stop_fd_, POLLIN, 0}};
 	while (running_.load()) {
-		sockaddr_in client_addr;
-		socklen_t addr_len = sizeof(client_addr);
-		int client_fd = accept(listen_fd_, reinterpret_cast<sockaddr*>(&client_addr), &addr_len);
-
-		if (!running_.load()) {
-			if (client_fd >= 0) {
-				logger_.debug("Accepted a connection during shutdown, closing fd=" + std::to_string(client_fd));
-				::close(client_fd);
+		int ready = ::poll(fds, 2, -1);
+		if (ready < 0) {
+			if (errno == EINTR) {
+				continue;
 			}
+			logger_.error("poll() failed on listen socket for port " + std::to_string(port_) + ": " +
+			              std::string(strerror(errno)));
+			break;
+		}
+		if (fds[1].revents != 0 || !running_.load()) {
 			logger_.debug("Accept loop: running_ is false, exiting.");
 			break;
 		}
-
-		if (client_fd < 0) {
-			if (running_.load()) {
-				logger_.warning("accept() failed on port " + std::to_string(port_) + ": " +
-				                std::string(strerror(errno)) + ". Retrying...");
-
-			} else {
-				logger_.info("accept() returned error during shutdown for port " + std::to_string(port_) +
-				             ", as expected.");
-			}
-
+		if (fds[0].revents == 0) {
 			continue;
 		}
 
-		logger_.info("New client connected, fd=" + std::to_string(client_fd) + " on port " + std::to_string(port_));
-
-		std::thread([handler, client_fd, this_logger = &logger_]() {
-			try {
-				handler(client_fd);
-			} catch (const std::exception& ex) {
-				this_logger->error("Handler exception for fd=" + std::to_string(client_fd) + ": " + ex.what());
+		// Drain everything the kernel has queued for this wakeup.
+		uint64_t batch = 0;
+		while (running_.load()) {
+			int client_fd = accept4(listen_fd, nullptr, nullptr, accept_flags);
+			if (client_fd < 0) {
+				if (errno == EINTR || errno == ECONNABORTED) {
+					continue;
+				}
+				if (errno == EAGAIN || errno == EWOULDBLOCK) {
+					break;
+				}
+				logger_.warning("accept4() failed on port " + std::to_string(port_) + ": " +
+				                std::string(strerror(errno)) + ". Retrying...");
+				if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+					std::this_thread::sleep_for(std::chrono::milliseconds(10));
+				}
+				break;
 			}
 
-			this_logger->info("Client fd=" + std::to_string(client_fd) + " processing thread finished.");
-		}).detach();
+			++batch;
+			logger_.info("New client connected, fd=" + std::to_string(client_fd) + " on port " +
+			             std::to_string(port_) + " (acceptor " + std::to_string(acceptor_id) + ")");
+			on_accept(client_fd);
+		}
+		if (batch > 0) {
+			accepted_.fetch_add(batch);
+			accept_wakeups_.fetch_add(1);
+		}
 	}
-	logger_.debug("Accept loop finished for port " + std::to_string(port_));
+	logger_.debug("Accept loop " + std::to_string(acceptor_id) + " finished for port " + std::to_string(port_));
 }
 
-void TCPServer::stop() {
+DrainReport TCPServer::stop(std::chrono::milliseconds drain_timeout) {
+	DrainReport report;
 	if (!running_.exchange(false)) {
 		logger_.debug("Server on port " + std::to_string(port_) + " is already stopped or stopping.");
-		return;
+		return report;
 	}
 
 	logger_.info("Server stopping on port " + std::to_string(port_));
 
-	if (listen_fd_ != -1) {
-		if (::shutdown(listen_fd_, SHUT_RD) < 0) {
-			logger_.warning("shutdown(listen_fd_, SHUT_RD) failed for port " + std::to_string(port_) + ": " +
-			                std::string(strerror(errno)));
+	uint64_t one = 1;
+	if (stop_fd_ >= 0 && ::write(stop_fd_, &one, sizeof(one)) < 0) {
+		logger_.warning("Failed to signal acceptors on port " + std::to_string(port_) + ": " +
+		                std::string(strerror(errno)));
+	}
+	for (auto& accept_thread : accept_threads_) {
+		if (!accept_thread.joinable()) {
+			continue;
 		}
+		try {
+			accept_thread.join();
+		} catch (const std::system_error& e) {
+			logger_.error("System error while joining accept thread for port " + std::to_string(port_) + ": " +
+			              std::string(e.what()));
+		}
+	}
+	accept_threads_.clear();
+	logger_.debug("Accept threads joined for port " + std::to_string(port_));
+	for (auto* loop : uring_loops_) {
+		loop->stopAccepting();
+	}
+	ListenerStats final_listener_stats = listenerStats();
 
-		if (::close(listen_fd_) < 0) {
-			logger_.warning("close(listen_fd_) failed for port " + std::to_string(port_) + ": " +
+	for (int listen_fd : listen_fds_) {
+		if (!uring_loops_.empty()) {
+			// Completes the accept the ring still has armed on this socket.
+			::shutdown(listen_fd, SHUT_RD);
+		}
+		if (::close(listen_fd) < 0) {
+			logger_.warning("close(listen_fd) failed for port " + std::to_string(port_) + ": " +
 			                std::string(strerror(errno)));
 		}
-		logger_.debug("Listen socket fd=" + std::to_string(listen_fd_) + " closed for port " + std::to_string(port_));
-		listen_fd_ = -1;
-	} else {
-		logger_.debug("Listen socket was already closed or not opened for port " + std::to_string(port_));
+		logger_.debug("Listen socket fd=" + std::to_string(listen_fd) + " closed for port " + std::to_string(port_));
 	}
+	listen_fds_.clear();
+	if (stop_fd_ >= 0) {
+		::close(stop_fd_);
+		stop_fd_ = -1;
+	}
+	logger_.info("Listener stats on port " + std::to_string(port_) + ": " + format_listener_stats(final_listener_stats));
 
-	if (accept_thread_.joinable()) {
-		logger_.debug("Waiting for accept_thread to join for port " + std::to_string(port_));
-		try {
-			accept_thread_.join();
-			logger_.debug("accept_thread joined successfully for port " + std::to_string(port_));
-		} catch (const std::system_error& e) {
-			logger_.error("System error while joining accept_thread for port " + std::to_string(port_) + ": " +
-			              std::string(e.what()));
+	// Keep-alive connections with nothing in progress have nothing to drain.
+	size_t idle = closeIdleConnections();
+	if (idle > 0) {
+		logger_.info("Closed " + std::to_string(idle) + " idle connection(s) on port " + std::to_string(port_));
+	}
+	report.in_flight = liveConnections();
+	if (report.in_flight > 0) {
+		logger_.info("Draining " + std::to_string(report.in_flight) + " live connection(s) on port " +
+		             std::to_string(port_) + " for up to " + std::to_string(drain_timeout.count()) + " ms");
+	}
+	auto deadline = std::chrono::steady_clock::now() + drain_timeout;
+	while (liveConnections() > 0 && std::chrono::steady_clock::now() < deadline) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		// Connections whose work has finished are not kept open waiting for their client to hang up.
+		closeIdleConnections();
+	}
+
+	{
+		std::lock_guard lock(active_mutex_);
+		force_closing_ = true;
+		report.killed = loops_.empty() ? liveConnectionsLocked() : 0;
+		for (int fd : active_fds_) {
+			::shutdown(fd, SHUT_RDWR);
+		}
+	}
+	// Reactor connections are only closed by their own loop; the tasks still running just see a closed connection.
+	for (auto& loop : loops_) {
+		report.killed += loop->closeConnections(false);
+	}
+	report.killed = std::min(report.killed, report.in_flight);
+	report.drained = report.in_flight - report.killed;
+
+	// Pool tasks post back to their connection's loop, so the loops must outlive every one of them.
+	if (worker_pool_) {
+		worker_pool_->shutdown();
+		logger_.info("Worker pool stats on port " + std::to_string(port_) + ": " +
+		             format_worker_stats(worker_pool_->stats()));
+	}
+	for (auto& loop : loops_) {
+		loop->stop();
+	}
+	uring_loops_.clear();
+	loops_.clear();
+	worker_pool_.reset();
+	logger_.info("Server listener stopped successfully on port " + std::to_string(port_) + ". Connections drained: " +
+	             std::to_string(report.drained) + ", force-closed: " + std::to_string(report.killed));
+	return report;
+}
+
+ListenerStats TCPServer::listenerStats() const {
+	ListenerStats stats;
+	stats.accepted = accepted_.load();
+	stats.accept_wakeups = accept_wakeups_.load();
+	for (int listen_fd : listen_fds_) {
+		tcp_info info{};
+		socklen_t len = sizeof(info);
+		if (getsockopt(listen_fd, IPPROTO_TCP, TCP_INFO, &info, &len) == 0) {
+			// For a listening socket the kernel reports the accept queue length and its limit here.
+			stats.accept_queue_len += info.tcpi_unacked;
+			stats.accept_queue_max += info.tcpi_sacked;
 		}
-	} else {
-		logger_.debug("accept_thread was not joinable for port " + std::to_string(port_));
 	}
-	logger_.info("Server listener stopped successfully on port " + std::to_string(port_));
-}
\ No newline at end of file
+	if (!listen_fds_.empty()) {
+		stats.listen_overflows = read_tcp_ext_counter("ListenOverflows") - overflows_baseline_;
+		stats.listen_drops = read_tcp_ext_counter("ListenDrops") - drops_baseline_;
+	}
+	return stats;
+}
+
+std::string format_listener_stats(const ListenerStats& stats) {
+	return "accepted=" + std::to_string(stats.accepted) + " wakeups=" + std::to_string(stats.accept_wakeups) +
+	       " accept_queue=" + std::to_string(stats.accept_queue_len) + "/" + std::to_string(stats.accept_queue_max) +
+	       " listen_overflows=" + std::to_string(stats.listen_overflows) +
+	       " listen_drops=" + std::to_string(stats.listen_drops);
+}
+
+size_t TCPServer::closeIdleConnections() {
+	size_t closed = 0;
+	for (auto& loop : loops_) {
+		closed += loop->closeConnections(true);
+	}
+	return closed;
+}
+
+size_t TCPServer::liveConnections() {
+	std::lock_guard lock(active_mutex_);
+	return liveConnectionsLocked();
+}
+
+size_t TCPServer::liveConnectionsLocked() const {
+	size_t live = active_fds_.size();
+	if (worker_pool_ && loops_.empty()) {
+		live += worker_pool_->stats().queue_depth;
+	}
+	for (const auto& loop : loops_) {
+		live += loop->connectionCount();
+	}
+	return live;
+}
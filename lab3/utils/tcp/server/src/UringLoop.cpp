@@ -0,0 +1,493 @@
+#include "UringLoop.hpp"
+
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#include "custom_exceptions.hpp"
+
+namespace {
+
+constexpr size_t RECV_BUFFER_SIZE = 16 * 1024;
+constexpr size_t MAX_FIXED_BUFFERS = 128;
+constexpr int OP_BITS = 2;
+
+int io_uring_setup(unsigned entries, io_uring_params* params) {
+	return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int io_uring_enter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+	return static_cast<int>(syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+int io_uring_register(int ring_fd, unsigned opcode, const void* arg, unsigned nr_args) {
+	return static_cast<int>(syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args));
+}
+
+template <typename T>
+T* ring_field(void* ring, uint32_t offset) {
+	return reinterpret_cast<T*>(static_cast<char*>(ring) + offset);
+}
+
+}  // namespace
+
+UringLoop::UringLoop(size_t id, WorkerPool& worker_pool, Logger& logger, unsigned entries)
+    : IoLoop(id, worker_pool, logger),
+      ring_fd_(-1),
+      params_{},
+      sq_ring_(MAP_FAILED),
+      sq_ring_size_(0),
+      cq_ring_(MAP_FAILED),
+      cq_ring_size_(0),
+      sqes_(nullptr),
+      sqes_size_(0),
+      sq_head_(nullptr),
+      sq_tail_(nullptr),
+      sq_mask_(nullptr),
+      sq_array_(nullptr),
+      cq_head_(nullptr),
+      cq_tail_(nullptr),
+      cq_mask_(nullptr),
+      cqes_(nullptr),
+      sqe_tail_(0),
+      to_submit_(0),
+      inflight_(0),
+      fixed_bufs_(false),
+      accepting_(true),
+      next_conn_id_(1) {
+	ring_fd_ = io_uring_setup(entries, &params_);
+	if (ring_fd_ < 0) {
+		logger_.warning("io_uring_setup failed: " + std::string(strerror(errno)));
+		throw SocketException("io_uring_setup() failed");
+	}
+
+	sq_ring_size_ = params_.sq_off.array + params_.sq_entries * sizeof(unsigned);
+	cq_ring_size_ = params_.cq_off.cqes + params_.cq_entries * sizeof(io_uring_cqe);
+	bool single_mmap = (params_.features & IORING_FEAT_SINGLE_MMAP) != 0;
+	if (single_mmap) {
+		sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+	}
+	sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_,
+	                IORING_OFF_SQ_RING);
+	if (sq_ring_ != MAP_FAILED) {
+		cq_ring_ = single_mmap ? sq_ring_
+		                       : mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		                              ring_fd_, IORING_OFF_CQ_RING);
+	}
+	sqes_size_ = params_.sq_entries * sizeof(io_uring_sqe);
+	void* sqes = MAP_FAILED;
+	if (cq_ring_ != MAP_FAILED) {
+		sqes = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+	}
+	if (sqes == MAP_FAILED) {
+		logger_.warning("mmap of io_uring rings failed: " + std::string(strerror(errno)));
+		closeRing();
+		throw SocketException("io_uring mmap() failed");
+	}
+	sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+	sq_head_ = ring_field<unsigned>(sq_ring_, params_.sq_off.head);
+	sq_tail_ = ring_field<unsigned>(sq_ring_, params_.sq_off.tail);
+	sq_mask_ = ring_field<unsigned>(sq_ring_, params_.sq_off.ring_mask);
+	sq_array_ = ring_field<unsigned>(sq_ring_, params_.sq_off.array);
+	cq_head_ = ring_field<unsigned>(cq_ring_, params_.cq_off.head);
+	cq_tail_ = ring_field<unsigned>(cq_ring_, params_.cq_off.tail);
+	cq_mask_ = ring_field<unsigned>(cq_ring_, params_.cq_off.ring_mask);
+	cqes_ = ring_field<io_uring_cqe>(cq_ring_, params_.cq_off.cqes);
+	sqe_tail_ = *sq_tail_;
+
+	size_t buffers = std::min<size_t>(params_.sq_entries, MAX_FIXED_BUFFERS);
+	buf_arena_.resize(buffers * RECV_BUFFER_SIZE);
+	for (size_t i = 0; i < buffers; ++i) {
+		buf_iovecs_.push_back({buf_arena_.data() + i * RECV_BUFFER_SIZE, RECV_BUFFER_SIZE});
+	}
+	if (io_uring_register(ring_fd_, IORING_REGISTER_BUFFERS, buf_iovecs_.data(),
+	                      static_cast<unsigned>(buf_iovecs_.size())) < 0) {
+		logger_.warning("UringLoop " + std::to_string(id_) + " could not register receive buffers (" +
+		                std::string(strerror(errno)) + "), using plain recv");
+		buf_iovecs_.clear();
+		buf_arena_.clear();
+		buf_arena_.shrink_to_fit();
+	} else {
+		fixed_bufs_ = true;
+		for (size_t i = buffers; i > 0; --i) {
+			free_bufs_.push_back(static_cast<int>(i - 1));
+		}
+	}
+	logger_.debug("UringLoop " + std::to_string(id_) + " ring ready: sq=" + std::to_string(params_.sq_entries) +
+	              " cq=" + std::to_string(params_.cq_entries) + " fixed_buffers=" + std::to_string(free_bufs_.size()));
+}
+
+UringLoop::~UringLoop() {
+	stopAccepting();
+	stop();
+	// Sockets are shut down by now, so whatever is still in flight completes promptly; wait for it before the
+	// buffers the kernel may still write into go away.
+	for (int attempt = 0; inflight_ > 0 && attempt < 100; ++attempt) {
+		submit(0);
+		reap();
+		if (inflight_ > 0) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+	if (inflight_ > 0) {
+		logger_.warning("UringLoop " + std::to_string(id_) + " closing with " + std::to_string(inflight_) +
+		                " operation(s) in flight");
+	}
+	connections_.clear();
+	ids_.clear();
+	closeRing();
+}
+
+void UringLoop::closeRing() {
+	if (sqes_ != nullptr) {
+		munmap(sqes_, sqes_size_);
+		sqes_ = nullptr;
+	}
+	if (cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_) {
+		munmap(cq_ring_, cq_ring_size_);
+	}
+	cq_ring_ = MAP_FAILED;
+	if (sq_ring_ != MAP_FAILED) {
+		munmap(sq_ring_, sq_ring_size_);
+		sq_ring_ = MAP_FAILED;
+	}
+	if (ring_fd_ >= 0) {
+		::close(ring_fd_);
+		ring_fd_ = -1;
+	}
+}
+
+void UringLoop::adopt(int fd, std::unique_ptr<FrameSession> session) {
+	auto conn = std::make_shared<FrameConnection>(fd, *this, logger_);
+	conn->session_ = std::move(session);
+	connection_count_.fetch_add(1);
+	post([this, conn]() {
+		uint64_t conn_id = next_conn_id_++;
+		auto& entry = connections_[conn_id];
+		entry.conn = conn;
+		ids_[conn.get()] = conn_id;
+		if (fixed_bufs_ && !free_bufs_.empty()) {
+			entry.buf_index = free_bufs_.back();
+			free_bufs_.pop_back();
+		} else {
+			entry.heap_buf.resize(RECV_BUFFER_SIZE);
+		}
+		logger_.debug("UringLoop " + std::to_string(id_) + " adopted fd=" + std::to_string(conn->fd_));
+		armRecv(conn_id, entry);
+	});
+}
+
+void UringLoop::acceptOn(int listen_fd, std::function<void(int)> on_accept) {
+	post([this, listen_fd, on_accept = std::move(on_accept)]() {
+		listeners_.push_back({listen_fd, on_accept});
+		armAccept(listeners_.size() - 1);
+	});
+}
+
+io_uring_sqe* UringLoop::nextSqe() {
+	unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+	if (sqe_tail_ - head >= params_.sq_entries) {
+		submit(0);
+		head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+		if (sqe_tail_ - head >= params_.sq_entries) {
+			logger_.error("UringLoop " + std::to_string(id_) + " submission queue is full");
+			return nullptr;
+		}
+	}
+	unsigned index = sqe_tail_ & *sq_mask_;
+	io_uring_sqe* sqe = &sqes_[index];
+	std::memset(sqe, 0, sizeof(*sqe));
+	sq_array_[index] = index;
+	++sqe_tail_;
+	++to_submit_;
+	return sqe;
+}
+
+int UringLoop::submit(unsigned wait_for) {
+	__atomic_store_n(sq_tail_, sqe_tail_, __ATOMIC_RELEASE);
+	int rc = io_uring_enter(ring_fd_, to_submit_, wait_for, wait_for > 0 ? IORING_ENTER_GETEVENTS : 0);
+	if (rc < 0) {
+		return -errno;
+	}
+	to_submit_ -= std::min(static_cast<unsigned>(rc), to_submit_);
+	return rc;
+}
+
+void UringLoop::reap() {
+	unsigned head = *cq_head_;
+	while (head != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+		const io_uring_cqe& cqe = cqes_[head & *cq_mask_];
+		uint64_t user_data = cqe.user_data;
+		int res = cqe.res;
+		++head;
+		__atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+		complete(user_data, res);
+	}
+}
+
+void UringLoop::complete(uint64_t user_data, int res) {
+	--inflight_;
+	uint64_t id = user_data >> OP_BITS;
+	switch (user_data & ((1u << OP_BITS) - 1)) {
+		case OP_WAKE:
+			drainPosted();
+			if (running_.load()) {
+				armWake();
+			}
+			break;
+		case OP_ACCEPT:
+			onAccept(static_cast<size_t>(id), res);
+			break;
+		case OP_RECV:
+			onRecv(id, res);
+			break;
+		case OP_SEND:
+			onSend(id, res);
+			break;
+	}
+}
+
+void UringLoop::run() {
+	armWake();
+	while (running_.load()) {
+		int rc = submit(1);
+		if (rc < 0 && rc != -EINTR && rc != -EAGAIN && rc != -EBUSY) {
+			logger_.error("io_uring_enter failed in loop " + std::to_string(id_) + ": " + std::string(strerror(-rc)));
+			break;
+		}
+		reap();
+	}
+}
+
+void UringLoop::armWake() {
+	io_uring_sqe* sqe = nextSqe();
+	if (sqe == nullptr) {
+		return;
+	}
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = wake_fd_;
+	sqe->poll32_events = POLLIN;
+	sqe->user_data = OP_WAKE;
+	++inflight_;
+}
+
+void UringLoop::armAccept(size_t listener_id) {
+	io_uring_sqe* sqe = nextSqe();
+	if (sqe == nullptr) {
+		return;
+	}
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = listeners_[listener_id].fd;
+	sqe->accept_flags = SOCK_CLOEXEC;
+	sqe->user_data = (listener_id << OP_BITS) | OP_ACCEPT;
+	++inflight_;
+}
+
+void UringLoop::onAccept(size_t listener_id, int res) {
+	bool keep_accepting = accepting_.load() && running_.load();
+	if (res >= 0) {
+		if (keep_accepting) {
+			listeners_[listener_id].on_accept(res);
+		} else {
+			::close(res);
+		}
+	} else if (res == -EINVAL || res == -EBADF || res == -ECANCELED || res == -ENOTSOCK) {
+		logger_.debug("UringLoop " + std::to_string(id_) + " stopped accepting on fd=" +
+		              std::to_string(listeners_[listener_id].fd));
+		return;
+	} else if (res != -EINTR && res != -EAGAIN && res != -ECONNABORTED) {
+		logger_.warning("io_uring accept failed on fd=" + std::to_string(listeners_[listener_id].fd) + ": " +
+		                std::string(strerror(-res)) + ". Retrying...");
+		if (res == -EMFILE || res == -ENFILE || res == -ENOBUFS || res == -ENOMEM) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+	}
+	if (keep_accepting) {
+		armAccept(listener_id);
+	}
+}
+
+void UringLoop::armRecv(uint64_t conn_id, UringConnection& entry) {
+	io_uring_sqe* sqe = nextSqe();
+	if (sqe == nullptr) {
+		auto conn = entry.conn;
+		conn->closeNow();
+		return;
+	}
+	sqe->fd = entry.conn->fd_;
+	if (entry.buf_index >= 0) {
+		const iovec& buf = buf_iovecs_[entry.buf_index];
+		sqe->opcode = IORING_OP_READ_FIXED;
+		sqe->addr = reinterpret_cast<uint64_t>(buf.iov_base);
+		sqe->len = static_cast<uint32_t>(buf.iov_len);
+		sqe->buf_index = static_cast<uint16_t>(entry.buf_index);
+	} else {
+		sqe->opcode = IORING_OP_RECV;
+		sqe->addr = reinterpret_cast<uint64_t>(entry.heap_buf.data());
+		sqe->len = static_cast<uint32_t>(entry.heap_buf.size());
+	}
+	sqe->user_data = (conn_id << OP_BITS) | OP_RECV;
+	entry.recv_pending = true;
+	++inflight_;
+}
+
+void UringLoop::onRecv(uint64_t conn_id, int res) {
+	auto it = connections_.find(conn_id);
+	if (it == connections_.end()) {
+		return;
+	}
+	it->second.recv_pending = false;
+	if (it->second.released) {
+		forgetIfIdle(conn_id);
+		return;
+	}
+	auto conn = it->second.conn;
+	if (res > 0) {
+		const uint8_t* data = it->second.buf_index >= 0
+		                          ? static_cast<const uint8_t*>(buf_iovecs_[it->second.buf_index].iov_base)
+		                          : it->second.heap_buf.data();
+		conn->consume(data, static_cast<size_t>(res));
+	} else if (res == 0) {
+		logger_.debug("Peer closed fd=" + std::to_string(conn->fd_));
+		conn->peer_closed_ = true;
+	} else if (res != -EINTR && res != -EAGAIN && res != -ENOBUFS) {
+		logger_.warning("recv failed on fd=" + std::to_string(conn->fd_) + ": " + std::string(strerror(-res)));
+		conn->closeNow();
+		return;
+	}
+	if (!conn->closed_ && !conn->peer_closed_) {
+		if (conn->inboxFull()) {
+			// No recv stays armed until dispatch makes room in the inbox.
+			conn->read_paused_ = true;
+		} else {
+			armRecv(conn_id, connections_[conn_id]);
+		}
+	}
+	conn->dispatchFrames();
+}
+
+void UringLoop::resumeRead(FrameConnection& conn) {
+	auto id_it = ids_.find(&conn);
+	if (id_it == ids_.end()) {
+		return;
+	}
+	auto& entry = connections_[id_it->second];
+	if (!entry.released && !entry.recv_pending && !conn.peer_closed_) {
+		armRecv(id_it->second, entry);
+	}
+}
+
+void UringLoop::startWrite(FrameConnection& conn) {
+	auto id_it = ids_.find(&conn);
+	if (id_it == ids_.end()) {
+		return;
+	}
+	auto& entry = connections_[id_it->second];
+	if (entry.send_pending || entry.released) {
+		return;
+	}
+	if (conn.outbox_.empty()) {
+		conn.maybeFinish();
+		return;
+	}
+	armSend(id_it->second, entry);
+}
+
+void UringLoop::armSend(uint64_t conn_id, UringConnection& entry) {
+	io_uring_sqe* sqe = nextSqe();
+	if (sqe == nullptr) {
+		auto conn = entry.conn;
+		conn->closeNow();
+		return;
+	}
+	auto& conn = *entry.conn;
+	entry.send_msg = {};
+	entry.send_msg.msg_iov = entry.send_iov;
+	entry.send_msg.msg_iovlen = conn.gatherWrite(entry.send_iov, MAX_WRITE_IOVECS);
+	sqe->opcode = IORING_OP_SENDMSG;
+	sqe->fd = conn.fd_;
+	sqe->addr = reinterpret_cast<uint64_t>(&entry.send_msg);
+	sqe->len = 1;
+	sqe->msg_flags = MSG_NOSIGNAL;
+	sqe->user_data = (conn_id << OP_BITS) | OP_SEND;
+	entry.send_pending = true;
+	++inflight_;
+}
+
+void UringLoop::onSend(uint64_t conn_id, int res) {
+	auto it = connections_.find(conn_id);
+	if (it == connections_.end()) {
+		return;
+	}
+	it->second.send_pending = false;
+	if (it->second.released) {
+		forgetIfIdle(conn_id);
+		return;
+	}
+	auto conn = it->second.conn;
+	if (res < 0 && res != -EINTR && res != -EAGAIN) {
+		logger_.warning("send failed on fd=" + std::to_string(conn->fd_) + ": " + std::string(strerror(-res)));
+		conn->closeNow();
+		return;
+	}
+	if (res > 0) {
+		conn->advanceWrite(static_cast<size_t>(res));
+	}
+	startWrite(*conn);
+}
+
+void UringLoop::release(FrameConnection& conn) {
+	auto id_it = ids_.find(&conn);
+	if (id_it == ids_.end()) {
+		::close(conn.fd_);
+		connection_count_.fetch_sub(1);
+		return;
+	}
+	uint64_t conn_id = id_it->second;
+	connections_[conn_id].released = true;
+	// Anything still queued for this fd must reach the kernel before the descriptor number can be reused.
+	if (to_submit_ > 0) {
+		submit(0);
+	}
+	// Completes the pending recv/send; their buffers stay alive until the completions are reaped.
+	::shutdown(conn.fd_, SHUT_RDWR);
+	::close(conn.fd_);
+	connection_count_.fetch_sub(1);
+	forgetIfIdle(conn_id);
+}
+
+void UringLoop::forgetIfIdle(uint64_t conn_id) {
+	auto it = connections_.find(conn_id);
+	if (it == connections_.end()) {
+		return;
+	}
+	auto& entry = it->second;
+	if (!entry.released || entry.recv_pending || entry.send_pending) {
+		return;
+	}
+	if (entry.buf_index >= 0) {
+		free_bufs_.push_back(entry.buf_index);
+	}
+	ids_.erase(entry.conn.get());
+	connections_.erase(it);
+}
+
+std::vector<std::shared_ptr<FrameConnection>> UringLoop::openConnections() {
+	std::vector<std::shared_ptr<FrameConnection>> live;
+	for (auto& [conn_id, entry] : connections_) {
+		if (!entry.released) {
+			live.push_back(entry.conn);
+		}
+	}
+	return live;
+}
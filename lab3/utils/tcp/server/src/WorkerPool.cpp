@@ -0,0 +1,129 @@
+#include "WorkerPool.hpp"
+
+#include <algorithm>
+#include <string>
+
+WorkerPool::WorkerPool(const WorkerPoolConfig& config, Logger& logger)
+    : config_(config), logger_(logger), stopping_(false) {
+	if (config_.workers == 0) {
+		config_.workers = 1;
+	}
+	workers_.reserve(config_.workers);
+	for (size_t i = 0; i < config_.workers; ++i) {
+		workers_.emplace_back(&WorkerPool::workerLoop, this, i);
+	}
+	logger_.debug("WorkerPool started with " + std::to_string(config_.workers) + " workers, max pending " +
+	              std::to_string(config_.max_pending));
+}
+
+WorkerPool::~WorkerPool() { shutdown(); }
+
+bool WorkerPool::submit(Task task, Task on_drop) {
+	Job victim;
+	{
+		std::lock_guard lock(mutex_);
+		if (stopping_) {
+			++stats_.rejected;
+			logger_.warning("WorkerPool: task submitted after shutdown, rejecting it");
+			return false;
+		}
+		if (jobs_.size() >= config_.max_pending) {
+			if (config_.policy == OverloadPolicy::REJECT_NEW || jobs_.empty()) {
+				++stats_.rejected;
+				return false;
+			}
+			victim = std::move(jobs_.front());
+			jobs_.pop_front();
+			++stats_.shed;
+		}
+		jobs_.push_back(Job{std::move(task), std::move(on_drop), Clock::now()});
+		++stats_.accepted;
+		stats_.queue_depth = jobs_.size();
+	}
+	cv_.notify_one();
+
+	if (victim.run) {
+		logger_.warning("WorkerPool: queue full, shedding oldest pending task");
+		if (victim.on_drop) {
+			victim.on_drop();
+		}
+	}
+	return true;
+}
+
+WorkerPoolStats WorkerPool::stats() const {
+	std::lock_guard lock(mutex_);
+	return stats_;
+}
+
+void WorkerPool::shutdown() {
+	std::deque<Job> pending;
+	{
+		std::lock_guard lock(mutex_);
+		if (stopping_) {
+			return;
+		}
+		stopping_ = true;
+		pending.swap(jobs_);
+		stats_.queue_depth = 0;
+	}
+	cv_.notify_all();
+	for (auto& job : pending) {
+		if (job.on_drop) {
+			job.on_drop();
+		}
+	}
+	for (auto& worker : workers_) {
+		if (worker.joinable()) {
+			worker.join();
+		}
+	}
+	logger_.debug("WorkerPool stopped. " + format_worker_stats(stats()));
+}
+
+void WorkerPool::workerLoop(size_t worker_id) {
+	while (true) {
+		Job job;
+		{
+			std::unique_lock lock(mutex_);
+			cv_.wait(lock, [this] { return stopping_ || !jobs_.empty(); });
+			if (jobs_.empty()) {
+				break;
+			}
+			job = std::move(jobs_.front());
+			jobs_.pop_front();
+			stats_.queue_depth = jobs_.size();
+			++stats_.busy_workers;
+		}
+
+		auto started = Clock::now();
+		try {
+			job.run();
+		} catch (const std::exception& ex) {
+			logger_.error("WorkerPool worker " + std::to_string(worker_id) + " task exception: " + ex.what());
+		}
+		auto finished = Clock::now();
+
+		auto wait_us =
+		    static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(started - job.enqueued).count());
+		auto run_us =
+		    static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(finished - started).count());
+		std::lock_guard lock(mutex_);
+		--stats_.busy_workers;
+		++stats_.completed;
+		stats_.total_wait_us += wait_us;
+		stats_.max_wait_us = std::max(stats_.max_wait_us, wait_us);
+		stats_.total_run_us += run_us;
+		stats_.max_run_us = std::max(stats_.max_run_us, run_us);
+	}
+}
+
+std::string format_worker_stats(const WorkerPoolStats& stats) {
+	uint64_t avg_wait_us = stats.completed ? stats.total_wait_us / stats.completed : 0;
+	uint64_t avg_run_us = stats.completed ? stats.total_run_us / stats.completed : 0;
+	return "queue_depth=" + std::to_string(stats.queue_depth) + " busy=" + std::to_string(stats.busy_workers) +
+	       " accepted=" + std::to_string(stats.accepted) + " rejected=" + std::to_string(stats.rejected) +
+	       " shed=" + std::to_string(stats.shed) + " completed=" + std::to_string(stats.completed) +
+	       " wait_us(avg/max)=" + std::to_string(avg_wait_us) + "/" + std::to_string(stats.max_wait_us) +
+	       " handler_us(avg/max)=" + std::to_string(avg_run_us) + "/" + std::to_string(stats.max_run_us);
+}